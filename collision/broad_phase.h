@@ -0,0 +1,424 @@
+#pragma once
+
+// Finding which shapes might be touching without testing every pair.
+//
+// Both of these keep a bounding box for every shape and hand back the pairs
+// whose boxes overlap. They're only maybes, test them properly afterwards
+// (circle_vs_segment.h does circles against segments a batch at a time).
+//
+// SpatialHash
+//  Cuts the world into square cells and remembers which shapes are in each.
+//  Only shapes sharing a cell can overlap. The cells go in a table by a hash
+//  of where they are, so the world doesn't need a size and empty space costs
+//  nothing. A shape that moves without leaving its cells isn't
+//  touched at all. A pair sharing more than one cell is only reported by the
+//  cell that the corner of their overlap is in.
+//  Good when shapes are about the same size, cellSize a bit bigger than most.
+//
+// SweepAndPrune
+//  Keeps the shapes sorted by the left edge of their box. Going along that
+//  list, each one can only overlap the ones after it that start before it
+//  ends. Things don't move far between frames, so the list is nearly sorted
+//  already and an insertion sort puts it right in one pass.
+//  Doesn't need a cell size, but slows down when lots of shapes are lined up
+//  in a column. If the CPU has AVX2 the sweep checks 8 shapes at a time.
+//
+// Both give a shape an id when it's inserted, which is what move() and remove()
+// take and what the pairs are made of. Ids of removed shapes get used again.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BROAD_PHASE_X86
+#include <immintrin.h>
+#endif
+
+namespace broadphase
+{
+	// Whether the sweep can check 8 at a time, asked the first time it's needed
+	inline bool cpuHasAVX2()
+	{
+#ifdef BROAD_PHASE_X86
+		static const bool supported = []()
+		{
+			__builtin_cpu_init();
+			return __builtin_cpu_supports( "avx2" ) != 0;
+		}();
+		return supported;
+#else
+		return false;
+#endif
+	}
+
+	struct Box {
+		float minX, minY, maxX, maxY;
+	};
+
+	inline Box circleBox( float x, float y, float radius ) { return Box{ x - radius, y - radius, x + radius, y + radius }; }
+
+	inline Box segmentBox( float x1, float y1, float x2, float y2 )
+	{
+		return Box{ std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2) };
+	}
+
+	inline bool overlaps( const Box& a, const Box& b )
+	{
+		return a.minX <= b.maxX && b.minX <= a.maxX && a.minY <= b.maxY && b.minY <= a.maxY;
+	}
+
+	// What sort of shape an id is, so the caller knows which test to do on a pair
+	enum ShapeKind : uint8_t {
+		SHAPE_CIRCLE,
+		SHAPE_SEGMENT
+	};
+
+	// a < b
+	struct CandidatePair {
+		uint32_t a, b;
+	};
+
+	// Hands out ids, reusing ones that were given back
+	class IdList {
+	public:
+		uint32_t take()
+		{
+			if( !spare.empty() )
+			{
+				uint32_t id = spare.back();
+				spare.pop_back();
+				return id;
+			}
+			return next++;
+		}
+
+		void give( uint32_t id ) { spare.push_back(id); }
+
+		// Ids in use
+		uint32_t count() const { return next - (uint32_t)spare.size(); }
+
+	private:
+		std::vector<uint32_t> spare;
+		uint32_t next = 0;
+	};
+
+	class SpatialHash {
+	public:
+		// The table starts with bucketCount buckets (a power of two) and
+		// doubles whenever there are more shapes than that
+		explicit SpatialHash( float cellSize, uint32_t bucketCount = 1 << 12 ) : inverseCell( 1 / cellSize )
+		{
+			uint32_t size = 1;
+			while( size < bucketCount ) size *= 2;
+			buckets.resize( size );
+		}
+
+		uint32_t insert( ShapeKind kind, const Box& box )
+		{
+			uint32_t id = ids.take();
+			if( id >= boxes.size() )
+			{
+				boxes.resize( id + 1 );
+				ranges.resize( id + 1 );
+				kinds.resize( id + 1 );
+				alive.resize( id + 1 );
+			}
+			alive[id] = 1;
+			boxes[id] = box;
+			ranges[id] = cellsOf( box );
+			kinds[id] = kind;
+			add( id, ranges[id] );
+
+			if( ids.count() > buckets.size() ) rehash( (uint32_t)buckets.size() * 2 );
+			return id;
+		}
+
+		void move( uint32_t id, const Box& box )
+		{
+			boxes[id] = box;
+			Range cells = cellsOf( box );
+			if( cells == ranges[id] ) return;
+
+			take( id, ranges[id] );
+			ranges[id] = cells;
+			add( id, cells );
+		}
+
+		void remove( uint32_t id )
+		{
+			take( id, ranges[id] );
+			alive[id] = 0;
+			ids.give( id );
+		}
+
+		ShapeKind kind( uint32_t id ) const { return kinds[id]; }
+		const Box& box( uint32_t id ) const { return boxes[id]; }
+
+		// Every pair of shapes with overlapping boxes, once each
+		void pairs( std::vector<CandidatePair>& out ) const
+		{
+			out.clear();
+			for( uint32_t b = 0; b < buckets.size(); b++ )
+			{
+				const std::vector<uint32_t>& bucket = buckets[b];
+				for( size_t i = 0; i + 1 < bucket.size(); i++ )
+				{
+					uint32_t first = bucket[i];
+					const Box& boxI = boxes[first];
+					for( size_t j = i + 1; j < bucket.size(); j++ )
+					{
+						uint32_t second = bucket[j];
+						const Box& boxJ = boxes[second];
+						if( !overlaps( boxI, boxJ ) ) continue;
+
+						// Only the cell with the overlap's top left corner reports it
+						int cx = cellOf( std::max(boxI.minX, boxJ.minX) );
+						int cy = cellOf( std::max(boxI.minY, boxJ.minY) );
+						if( bucketOf( cx, cy ) != b ) continue;
+
+						out.push_back( first < second ? CandidatePair{ first, second } : CandidatePair{ second, first } );
+					}
+				}
+			}
+		}
+
+	private:
+		// The cells a box covers, inclusive
+		struct Range {
+			int x0, y0, x1, y1;
+			bool operator == ( const Range& rhs ) const { return x0 == rhs.x0 && y0 == rhs.y0 && x1 == rhs.x1 && y1 == rhs.y1; }
+		};
+
+		// floor() without the library call
+		int cellOf( float v ) const
+		{
+			float scaled = v * inverseCell;
+			int cell = (int)scaled;
+			return cell - (scaled < (float)cell);
+		}
+		Range cellsOf( const Box& box ) const { return Range{ cellOf(box.minX), cellOf(box.minY), cellOf(box.maxX), cellOf(box.maxY) }; }
+
+		uint32_t bucketOf( int cx, int cy ) const
+		{
+			return ( (uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u ) & ( (uint32_t)buckets.size() - 1 );
+		}
+
+		// Different cells can share a bucket, but a shape only goes in each bucket once
+		void add( uint32_t id, const Range& cells )
+		{
+			for( int cy = cells.y0; cy <= cells.y1; cy++ )
+			{
+				for( int cx = cells.x0; cx <= cells.x1; cx++ )
+				{
+					std::vector<uint32_t>& bucket = buckets[bucketOf( cx, cy )];
+					if( std::find( bucket.begin(), bucket.end(), id ) == bucket.end() ) bucket.push_back( id );
+				}
+			}
+		}
+
+		void take( uint32_t id, const Range& cells )
+		{
+			for( int cy = cells.y0; cy <= cells.y1; cy++ )
+			{
+				for( int cx = cells.x0; cx <= cells.x1; cx++ )
+				{
+					std::vector<uint32_t>& bucket = buckets[bucketOf( cx, cy )];
+					auto found = std::find( bucket.begin(), bucket.end(), id );
+					if( found != bucket.end() )
+					{
+						*found = bucket.back();
+						bucket.pop_back();
+					}
+				}
+			}
+		}
+
+		void rehash( uint32_t bucketCount )
+		{
+			buckets.assign( bucketCount, std::vector<uint32_t>() );
+			for( uint32_t id = 0; id < alive.size(); id++ )
+			{
+				if( alive[id] ) add( id, ranges[id] );
+			}
+		}
+
+		float inverseCell;
+		std::vector<std::vector<uint32_t>> buckets;
+		std::vector<Box> boxes;
+		std::vector<Range> ranges;
+		std::vector<ShapeKind> kinds;
+		std::vector<char> alive;
+		IdList ids;
+	};
+
+	class SweepAndPrune {
+	public:
+		uint32_t insert( ShapeKind kind, const Box& box )
+		{
+			uint32_t id = ids.take();
+			if( id >= entryOf.size() )
+			{
+				entryOf.resize( id + 1 );
+				kinds.resize( id + 1 );
+			}
+			kinds[id] = kind;
+			entryOf[id] = (uint32_t)entries.size();
+			entries.push_back( Entry{ box, id } );
+			return id;
+		}
+
+		void move( uint32_t id, const Box& box ) { entries[entryOf[id]].box = box; }
+
+		// The entry stays in the list until the next pairs(), just not as id
+		void remove( uint32_t id )
+		{
+			entries[entryOf[id]].id = REMOVED;
+			ids.give( id );
+		}
+
+		ShapeKind kind( uint32_t id ) const { return kinds[id]; }
+		const Box& box( uint32_t id ) const { return entries[entryOf[id]].box; }
+
+		// Every pair of shapes with overlapping boxes, once each. Sorts the
+		// list first, so it isn't const.
+		void pairs( std::vector<CandidatePair>& out )
+		{
+			out.clear();
+			sort();
+
+#ifdef BROAD_PHASE_X86
+			if( cpuHasAVX2() )
+			{
+				sweepAVX2( out );
+				return;
+			}
+#endif
+
+			for( size_t i = 0; i < entries.size(); i++ )
+				sweepFrom( out, i, i + 1 );
+		}
+
+	private:
+		static const uint32_t REMOVED = 0xffffffff;
+
+		struct Entry {
+			Box box;
+			uint32_t id;
+		};
+
+		void addPair( std::vector<CandidatePair>& out, size_t i, size_t j ) const
+		{
+			uint32_t first = entries[i].id, second = entries[j].id;
+			out.push_back( first < second ? CandidatePair{ first, second } : CandidatePair{ second, first } );
+		}
+
+		// Entry i against the entries from j on, until they start after it ends
+		void sweepFrom( std::vector<CandidatePair>& out, size_t i, size_t j ) const
+		{
+			float maxX = entries[i].box.maxX, minY = minYs[i], maxY = maxYs[i];
+			for( ; j < entries.size() && minXs[j] <= maxX; j++ )
+			{
+				if( minYs[j] <= maxY && minY <= maxYs[j] ) addPair( out, i, j );
+			}
+		}
+
+#ifdef BROAD_PHASE_X86
+		// The same, 8 at a time: which have started before this one ends, and
+		// which overlap it up and down. The last few go one at a time.
+		__attribute__((target("avx2")))
+		void sweepAVX2( std::vector<CandidatePair>& out ) const
+		{
+			size_t n = entries.size();
+			for( size_t i = 0; i < n; i++ )
+			{
+				__m256 endX = _mm256_set1_ps( entries[i].box.maxX );
+				__m256 lowY = _mm256_set1_ps( minYs[i] ), highY = _mm256_set1_ps( maxYs[i] );
+				size_t j = i + 1;
+				bool ended = false;
+
+				for( ; j + 8 <= n && !ended; j += 8 )
+				{
+					int started = _mm256_movemask_ps( _mm256_cmp_ps( _mm256_loadu_ps( &minXs[j] ), endX, _CMP_LE_OQ ) );
+					int between = _mm256_movemask_ps( _mm256_and_ps(
+						_mm256_cmp_ps( _mm256_loadu_ps( &minYs[j] ), highY, _CMP_LE_OQ ),
+						_mm256_cmp_ps( _mm256_loadu_ps( &maxYs[j] ), lowY, _CMP_GE_OQ ) ) );
+
+					for( int k = 0, hits = started & between; hits; k++, hits >>= 1 )
+					{
+						if( hits & 1 ) addPair( out, i, j + k );
+					}
+					ended = started != 0xff;
+				}
+
+				if( !ended ) sweepFrom( out, i, j );
+			}
+		}
+#endif
+
+		// An insertion sort that's moved entries this many times the length of
+		// the list is having a bad time (things teleporting) and gives up for std::sort
+		static const size_t MAX_SHIFTS_PER_ENTRY = 8;
+
+		static bool leftOf( const Entry& a, const Entry& b ) { return a.box.minX < b.box.minX; }
+
+		// Drops removed entries and sorts by left edge, keeping entryOf
+		// pointing at each id's entry.
+		//
+		// Entries inserted since last time are on the end and could go anywhere,
+		// so they're sorted on their own and merged in. The rest have only moved
+		// a little and get the insertion sort.
+		void sort()
+		{
+			size_t kept = 0, keptSorted = 0;
+			for( size_t i = 0; i < entries.size(); i++ )
+			{
+				if( entries[i].id == REMOVED ) continue;
+				entries[kept++] = entries[i];
+				if( i < sortedCount ) keptSorted = kept;
+			}
+			entries.resize( kept );
+
+			size_t shifts = 0, maxShifts = MAX_SHIFTS_PER_ENTRY * keptSorted;
+			for( size_t i = 1; i < keptSorted; i++ )
+			{
+				Entry e = entries[i];
+				size_t j = i;
+				for( ; j > 0 && entries[j - 1].box.minX > e.box.minX; j-- )
+					entries[j] = entries[j - 1];
+				entries[j] = e;
+
+				shifts += i - j;
+				if( shifts > maxShifts )
+				{
+					std::sort( entries.begin(), entries.begin() + keptSorted, leftOf );
+					break;
+				}
+			}
+
+			std::sort( entries.begin() + keptSorted, entries.end(), leftOf );
+			std::inplace_merge( entries.begin(), entries.begin() + keptSorted, entries.end(), leftOf );
+			sortedCount = entries.size();
+
+			// The sweep only looks at these, so they go in arrays of their own
+			minXs.resize( entries.size() );
+			minYs.resize( entries.size() );
+			maxYs.resize( entries.size() );
+			for( size_t i = 0; i < entries.size(); i++ )
+			{
+				entryOf[entries[i].id] = (uint32_t)i;
+				minXs[i] = entries[i].box.minX;
+				minYs[i] = entries[i].box.minY;
+				maxYs[i] = entries[i].box.maxY;
+			}
+		}
+
+		std::vector<Entry> entries;
+		size_t sortedCount = 0;  // entries at the front that were there for the last sort()
+		std::vector<float> minXs, minYs, maxYs;
+		std::vector<uint32_t> entryOf;
+		std::vector<ShapeKind> kinds;
+		IdList ids;
+	};
+}
@@ -0,0 +1 @@
+time c++ main.cpp -O2 -lsdl2 -framework opengl -lglew -std=c++11
\ No newline at end of file
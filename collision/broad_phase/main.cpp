@@ -0,0 +1,367 @@
+#define TJH_DRAW_IMPLEMENTATION
+#include "../tjh_draw.h"
+
+#include "../tjh_math.h"
+#include "../circle_vs_segment.h"
+#include "../broad_phase.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace broadphase;
+
+const int WIDTH = 1280;
+const int HEIGHT = 720;
+
+// What gets drawn, and what -bench does unless it's given a number of circles
+const int DRAW_CIRCLES = 2000;
+const int DEFAULT_BENCH_CIRCLES = 100000;
+
+// One wall for every this many circles
+const int CIRCLES_PER_WALL = 100;
+
+// Circles taken out and put back somewhere else every frame, to keep insert and remove honest
+const int CHURN_PER_FRAME = 100;
+
+const float MIN_RADIUS = 1;
+const float MAX_RADIUS = 4;
+const float MAX_SPEED = 60;
+const float MAX_WALL_LENGTH = 40;
+
+// Cells about twice as wide as the biggest circle. Smaller and the circles are
+// in more cells and keep moving between them, bigger and more pairs share one.
+const float CELL_SIZE = 4 * MAX_RADIUS;
+
+// -bench runs this many frames of 1/60th of a second
+const int BENCH_FRAMES = 120;
+const float FRAME_TIME = 1.0f / 60;
+
+float randomFloat( float low, float high )
+{
+	return low + (high - low) * (rand() / (float)RAND_MAX);
+}
+
+double millisecondsSince( std::chrono::steady_clock::time_point start )
+{
+	return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Circles bouncing round a box with some walls in it. The shapes themselves
+// are kept as arrays for circle_vs_segment.h, with their broad phase ids
+// alongside, and shapeIndex to get from an id back to the circle or wall.
+struct World {
+	float width, height;
+
+	Circles circles;
+	std::vector<float> vx, vy;
+	std::vector<uint32_t> circleIds;
+	std::vector<char> touched;
+
+	Segments walls;
+	std::vector<uint32_t> wallIds;
+
+	std::vector<uint32_t> shapeIndex;
+
+	// Filled in by narrowPhase()
+	std::vector<CandidatePair> candidates;
+	std::vector<uint32_t> testCircles, testWalls;
+	std::vector<uint8_t> wallHits;
+	long long hits = 0;
+};
+
+void setShapeIndex( World& world, uint32_t id, uint32_t index )
+{
+	if( id >= world.shapeIndex.size() ) world.shapeIndex.resize( id + 1 );
+	world.shapeIndex[id] = index;
+}
+
+void placeCircle( World& world, int i )
+{
+	world.circles.x[i] = randomFloat( 0, world.width );
+	world.circles.y[i] = randomFloat( 0, world.height );
+	world.vx[i] = randomFloat( -MAX_SPEED, MAX_SPEED );
+	world.vy[i] = randomFloat( -MAX_SPEED, MAX_SPEED );
+}
+
+template<typename BroadPhase>
+void makeWorld( World& world, BroadPhase& broadPhase, int numCircles, float width, float height )
+{
+	world.width = width;
+	world.height = height;
+
+	for( int i = 0; i < numCircles; i++ )
+	{
+		world.circles.add( 0, 0, randomFloat( MIN_RADIUS, MAX_RADIUS ) );
+		world.vx.push_back( 0 );
+		world.vy.push_back( 0 );
+		placeCircle( world, i );
+
+		uint32_t id = broadPhase.insert( SHAPE_CIRCLE, circleBox( world.circles.x[i], world.circles.y[i], world.circles.radius[i] ) );
+		world.circleIds.push_back( id );
+		setShapeIndex( world, id, i );
+	}
+	world.touched.resize( numCircles );
+
+	for( int i = 0; i < numCircles / CIRCLES_PER_WALL; i++ )
+	{
+		float x = randomFloat( 0, width ), y = randomFloat( 0, height );
+		float angle = randomFloat( 0, TWO_PI ), length = randomFloat( 5, MAX_WALL_LENGTH );
+		world.walls.add( x, y, x + std::cos(angle) * length, y + std::sin(angle) * length );
+
+		uint32_t id = broadPhase.insert( SHAPE_SEGMENT, segmentBox( world.walls.x1[i], world.walls.y1[i], world.walls.x2[i], world.walls.y2[i] ) );
+		world.wallIds.push_back( id );
+		setShapeIndex( world, id, i );
+	}
+}
+
+// Moves every circle and tells the broad phase, bouncing off the edges
+template<typename BroadPhase>
+void moveCircles( World& world, BroadPhase& broadPhase, float dt )
+{
+	Circles& c = world.circles;
+	for( size_t i = 0; i < c.size(); i++ )
+	{
+		c.x[i] += world.vx[i] * dt;
+		c.y[i] += world.vy[i] * dt;
+		if( c.x[i] < 0 || c.x[i] > world.width ) world.vx[i] = -world.vx[i];
+		if( c.y[i] < 0 || c.y[i] > world.height ) world.vy[i] = -world.vy[i];
+
+		broadPhase.move( world.circleIds[i], circleBox( c.x[i], c.y[i], c.radius[i] ) );
+	}
+}
+
+// Takes a few circles out and puts them back in somewhere new
+template<typename BroadPhase>
+void churn( World& world, BroadPhase& broadPhase, int count )
+{
+	for( int k = 0; k < count && !world.circleIds.empty(); k++ )
+	{
+		int i = rand() % world.circles.size();
+		broadPhase.remove( world.circleIds[i] );
+
+		placeCircle( world, i );
+		uint32_t id = broadPhase.insert( SHAPE_CIRCLE, circleBox( world.circles.x[i], world.circles.y[i], world.circles.radius[i] ) );
+		world.circleIds[i] = id;
+		setShapeIndex( world, id, i );
+	}
+}
+
+// Works out which of the candidate pairs really touch. Circles against circles
+// are tested as they come, circles against walls are saved up and done in one
+// batch. Walls don't care about each other.
+template<typename BroadPhase>
+void narrowPhase( World& world, const BroadPhase& broadPhase )
+{
+	std::fill( world.touched.begin(), world.touched.end(), 0 );
+	world.testCircles.clear();
+	world.testWalls.clear();
+	world.hits = 0;
+
+	const Circles& c = world.circles;
+	for( const CandidatePair& pair : world.candidates )
+	{
+		ShapeKind kindA = broadPhase.kind( pair.a ), kindB = broadPhase.kind( pair.b );
+		uint32_t a = world.shapeIndex[pair.a], b = world.shapeIndex[pair.b];
+
+		if( kindA == SHAPE_CIRCLE && kindB == SHAPE_CIRCLE )
+		{
+			float dx = c.x[a] - c.x[b], dy = c.y[a] - c.y[b], r = c.radius[a] + c.radius[b];
+			if( dx*dx + dy*dy < r*r )
+			{
+				world.touched[a] = world.touched[b] = 1;
+				world.hits++;
+			}
+		}
+		else if( kindA != kindB )
+		{
+			world.testCircles.push_back( kindA == SHAPE_CIRCLE ? a : b );
+			world.testWalls.push_back( kindA == SHAPE_CIRCLE ? b : a );
+		}
+	}
+
+	size_t tests = world.testCircles.size();
+	world.wallHits.resize( hitBytes( tests ) );
+	touchingPairs( world.circles, world.walls, world.testCircles.data(), world.testWalls.data(), tests, world.wallHits.data() );
+	for( size_t k = 0; k < tests; k++ )
+	{
+		if( world.wallHits[k / 8] >> (k % 8) & 1 )
+		{
+			world.touched[world.testCircles[k]] = 1;
+			world.hits++;
+		}
+	}
+}
+
+struct FrameTimes {
+	double move = 0, pairs = 0, narrow = 0, worst = 0;
+	long long candidates = 0, hits = 0;
+};
+
+// BENCH_FRAMES frames of moving, churning and colliding numCircles circles.
+// The first frame's candidate pairs are kept in firstPairs, sorted.
+template<typename BroadPhase>
+FrameTimes runFrames( BroadPhase& broadPhase, int numCircles, std::vector<CandidatePair>& firstPairs )
+{
+	srand( 1 );
+
+	// About the same crowding whatever the count
+	float side = std::sqrt( (float)numCircles ) * 12;
+	World world;
+	makeWorld( world, broadPhase, numCircles, side, side );
+
+	FrameTimes times;
+	for( int frame = 0; frame < BENCH_FRAMES; frame++ )
+	{
+		auto start = std::chrono::steady_clock::now();
+		moveCircles( world, broadPhase, FRAME_TIME );
+		churn( world, broadPhase, CHURN_PER_FRAME );
+		auto moved = std::chrono::steady_clock::now();
+
+		broadPhase.pairs( world.candidates );
+		auto paired = std::chrono::steady_clock::now();
+
+		narrowPhase( world, broadPhase );
+
+		times.move += std::chrono::duration<double, std::milli>( moved - start ).count();
+		times.pairs += std::chrono::duration<double, std::milli>( paired - moved ).count();
+		times.narrow += millisecondsSince( paired );
+		times.worst = std::max( times.worst, millisecondsSince( start ) );
+		times.candidates += world.candidates.size();
+		times.hits += world.hits;
+
+		if( frame == 0 ) firstPairs = world.candidates;
+	}
+
+	std::sort( firstPairs.begin(), firstPairs.end(), []( const CandidatePair& x, const CandidatePair& y )
+	{
+		return x.a < y.a || (x.a == y.a && x.b < y.b);
+	});
+
+	times.move /= BENCH_FRAMES;
+	times.pairs /= BENCH_FRAMES;
+	times.narrow /= BENCH_FRAMES;
+	times.candidates /= BENCH_FRAMES;
+	times.hits /= BENCH_FRAMES;
+	return times;
+}
+
+int benchmark( int numCircles )
+{
+	printf( "%d moving circles, %d walls, %d frames, %d removed and put back each frame\n",
+		numCircles, numCircles / CIRCLES_PER_WALL, BENCH_FRAMES, CHURN_PER_FRAME );
+	printf( "%-16s %8s %8s %8s %8s %8s %11s %8s %6s   (ms per frame)\n", "", "move", "pairs", "narrow", "total", "worst", "candidates", "hits", "60 Hz" );
+
+	FrameTimes results[2];
+	std::vector<CandidatePair> firstPairs[2];
+	for( int b = 0; b < 2; b++ )
+	{
+		FrameTimes t;
+		if( b == 0 )
+		{
+			SpatialHash hash( CELL_SIZE );
+			t = runFrames( hash, numCircles, firstPairs[b] );
+		}
+		else
+		{
+			SweepAndPrune sweep;
+			t = runFrames( sweep, numCircles, firstPairs[b] );
+		}
+		results[b] = t;
+
+		double total = t.move + t.pairs + t.narrow;
+		printf( "%-16s %8.2f %8.2f %8.2f %8.2f %8.2f %11lld %8lld %6s\n", b == 0 ? "spatial hash" : "sweep and prune",
+			t.move, t.pairs, t.narrow, total, t.worst, t.candidates, t.hits, total < 1000.0 / 60 ? "yes" : "no" );
+		fflush( stdout );
+	}
+
+	// Same world, same boxes and the same ids, they'd better agree. Every frame
+	// on how many, and on exactly which pairs in the first one.
+	bool samePairs = firstPairs[0].size() == firstPairs[1].size() && std::equal( firstPairs[0].begin(), firstPairs[0].end(), firstPairs[1].begin(),
+		[]( const CandidatePair& x, const CandidatePair& y ) { return x.a == y.a && x.b == y.b; } );
+	bool agree = samePairs && results[0].candidates == results[1].candidates && results[0].hits == results[1].hits;
+	if( !agree ) printf( "the two broad phases found different pairs!\n" );
+	return agree ? 0 : 1;
+}
+
+int main( int argc, char* argv[] )
+{
+	for( int i = 1; i < argc; i++ )
+	{
+		if( strcmp( argv[i], "-bench" ) == 0 )
+		{
+			int numCircles = DEFAULT_BENCH_CIRCLES;
+			if( i + 1 < argc && atoi( argv[i + 1] ) > 0 ) numCircles = atoi( argv[++i] );
+			return benchmark( numCircles );
+		}
+	}
+
+	// Space switches between the two
+	SpatialHash hash( CELL_SIZE );
+	SweepAndPrune sweep;
+	World hashWorld, sweepWorld;
+	srand( 1 );
+	makeWorld( hashWorld, hash, DRAW_CIRCLES, WIDTH, HEIGHT );
+	srand( 1 );
+	makeWorld( sweepWorld, sweep, DRAW_CIRCLES, WIDTH, HEIGHT );
+	bool useHash = true;
+
+	draw::init("broad phase", WIDTH, HEIGHT );
+
+	char buf[256];
+	int textHeight = 12;
+
+	bool done = false;
+	while( !done )
+	{
+		SDL_Event event;
+		while( SDL_PollEvent( &event ) ) {
+			if( event.type == SDL_QUIT ) done = true;
+			else if( event.type == SDL_KEYDOWN
+				&& event.key.keysym.scancode == SDL_SCANCODE_ESCAPE ) done = true;
+			else if( event.type == SDL_KEYDOWN
+				&& event.key.keysym.scancode == SDL_SCANCODE_SPACE ) useHash = !useHash;
+		}
+
+		World& world = useHash ? hashWorld : sweepWorld;
+		auto start = std::chrono::steady_clock::now();
+		if( useHash )
+		{
+			moveCircles( world, hash, FRAME_TIME );
+			hash.pairs( world.candidates );
+			narrowPhase( world, hash );
+		}
+		else
+		{
+			moveCircles( world, sweep, FRAME_TIME );
+			sweep.pairs( world.candidates );
+			narrowPhase( world, sweep );
+		}
+		double time = millisecondsSince( start );
+
+		draw::clear( 0.1, 0.1, 0.1 );
+
+		draw::setColor( 0.9 );
+		for( size_t w = 0; w < world.walls.size(); w++ )
+			draw::line( world.walls.x1[w], world.walls.y1[w], world.walls.x2[w], world.walls.y2[w] );
+
+		for( size_t i = 0; i < world.circles.size(); i++ )
+		{
+			if( world.touched[i] ) draw::setColor( 0.9, 0.2, 0.2 );
+			else draw::setColor( 0.5 );
+			draw::circle( world.circles.x[i], world.circles.y[i], world.circles.radius[i], 8 );
+		}
+
+		draw::setColor( 1 );
+		sprintf( buf, "%s: %.2f ms, %d candidates, %lld touching", useHash ? "spatial hash" : "sweep and prune",
+			time, (int)world.candidates.size(), world.hits );
+		draw::text( buf, 10, 10, textHeight );
+
+		draw::present();
+	}
+
+	draw::shutdown();
+	return 0;
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+// Lots of circles against lots of line segments at once.
+//
+// The circles and segments are kept a coordinate per array (x's together, y's
+// together and so on) so 8 of them load straight into one AVX register, and
+// every test is on squared distances, no sqrt and no divide:
+//
+//  - if the closest point on the segment's line is between the ends, the
+//    distance from the line is cross( d, c - p1 ) / |d|, so compare
+//    cross squared against radius squared times |d| squared
+//  - otherwise it's the distance to the nearest end
+//  - and if either end is in the circle it's touching whatever else happens
+//
+// Answers come back as bits, 8 to a byte, first one in the lowest bit.
+//
+// AVX2 is used if the CPU has it, checked the first time it's needed, so no
+// special build flags. Otherwise it all does one pair at a time with the same maths.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CIRCLE_SEGMENT_X86
+#include <immintrin.h>
+#endif
+
+struct Circles {
+	std::vector<float> x, y, radius;
+
+	void add( float cx, float cy, float r ) { x.push_back(cx); y.push_back(cy); radius.push_back(r); }
+	size_t size() const { return x.size(); }
+	void clear() { x.clear(); y.clear(); radius.clear(); }
+};
+
+struct Segments {
+	std::vector<float> x1, y1, x2, y2;
+
+	void add( float ax, float ay, float bx, float by ) { x1.push_back(ax); y1.push_back(ay); x2.push_back(bx); y2.push_back(by); }
+	size_t size() const { return x1.size(); }
+	void clear() { x1.clear(); y1.clear(); x2.clear(); y2.clear(); }
+};
+
+// One pair, what the batches do for each of theirs
+inline bool circleTouchesSegment( float cx, float cy, float r, float x1, float y1, float x2, float y2 )
+{
+	float dx = x2 - x1, dy = y2 - y1;
+	float fx = cx - x1, fy = cy - y1;
+	float gx = cx - x2, gy = cy - y2;
+	float r2 = r * r;
+
+	if( fx*fx + fy*fy < r2 || gx*gx + gy*gy < r2 ) return true;
+
+	float t = fx*dx + fy*dy;
+	float lengthSquared = dx*dx + dy*dy;
+	float cross = dx*fy - dy*fx;
+	return t > 0 && t < lengthSquared && cross*cross < r2 * lengthSquared;
+}
+
+// Whether the batches can do 8 pairs at a time
+inline bool circleSegmentAVX2()
+{
+#ifdef CIRCLE_SEGMENT_X86
+	static const bool supported = []()
+	{
+		__builtin_cpu_init();
+		return __builtin_cpu_supports( "avx2" ) != 0;
+	}();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+#ifdef CIRCLE_SEGMENT_X86
+// The same for 8 pairs, a bit each
+__attribute__((target("avx2")))
+inline int circleTouchesSegment8( __m256 cx, __m256 cy, __m256 r, __m256 x1, __m256 y1, __m256 x2, __m256 y2 )
+{
+	__m256 dx = _mm256_sub_ps( x2, x1 ), dy = _mm256_sub_ps( y2, y1 );
+	__m256 fx = _mm256_sub_ps( cx, x1 ), fy = _mm256_sub_ps( cy, y1 );
+	__m256 gx = _mm256_sub_ps( cx, x2 ), gy = _mm256_sub_ps( cy, y2 );
+	__m256 r2 = _mm256_mul_ps( r, r );
+
+	__m256 near1 = _mm256_cmp_ps( _mm256_add_ps( _mm256_mul_ps( fx, fx ), _mm256_mul_ps( fy, fy ) ), r2, _CMP_LT_OQ );
+	__m256 near2 = _mm256_cmp_ps( _mm256_add_ps( _mm256_mul_ps( gx, gx ), _mm256_mul_ps( gy, gy ) ), r2, _CMP_LT_OQ );
+
+	__m256 t = _mm256_add_ps( _mm256_mul_ps( fx, dx ), _mm256_mul_ps( fy, dy ) );
+	__m256 lengthSquared = _mm256_add_ps( _mm256_mul_ps( dx, dx ), _mm256_mul_ps( dy, dy ) );
+	__m256 cross = _mm256_sub_ps( _mm256_mul_ps( dx, fy ), _mm256_mul_ps( dy, fx ) );
+
+	__m256 between = _mm256_and_ps( _mm256_cmp_ps( t, _mm256_setzero_ps(), _CMP_GT_OQ ), _mm256_cmp_ps( t, lengthSquared, _CMP_LT_OQ ) );
+	__m256 close = _mm256_cmp_ps( _mm256_mul_ps( cross, cross ), _mm256_mul_ps( r2, lengthSquared ), _CMP_LT_OQ );
+
+	__m256 hit = _mm256_or_ps( _mm256_or_ps( near1, near2 ), _mm256_and_ps( between, close ) );
+	return _mm256_movemask_ps( hit );
+}
+#endif
+
+// How many bytes of bits count answers take
+inline size_t hitBytes( size_t count ) { return (count + 7) / 8; }
+
+// Circles from i on against segment s, one at a time
+inline void touchingFrom( const Circles& circles, const Segments& segments, size_t s, size_t i, uint8_t* row )
+{
+	for( ; i < circles.size(); i++ )
+	{
+		if( i % 8 == 0 ) row[i / 8] = 0;
+		if( circleTouchesSegment( circles.x[i], circles.y[i], circles.radius[i],
+			segments.x1[s], segments.y1[s], segments.x2[s], segments.y2[s] ) ) row[i / 8] |= 1 << (i % 8);
+	}
+}
+
+// Pairs from k on, one at a time
+inline void touchingPairsFrom( const Circles& circles, const Segments& segments,
+	const uint32_t* circleIndex, const uint32_t* segmentIndex, size_t k, size_t count, uint8_t* hits )
+{
+	for( ; k < count; k++ )
+	{
+		uint32_t c = circleIndex[k], s = segmentIndex[k];
+		if( k % 8 == 0 ) hits[k / 8] = 0;
+		if( circleTouchesSegment( circles.x[c], circles.y[c], circles.radius[c],
+			segments.x1[s], segments.y1[s], segments.x2[s], segments.y2[s] ) ) hits[k / 8] |= 1 << (k % 8);
+	}
+}
+
+#ifdef CIRCLE_SEGMENT_X86
+__attribute__((target("avx2")))
+inline void touchingAVX2( const Circles& circles, const Segments& segments, uint8_t* hits )
+{
+	size_t n = circles.size();
+	size_t rowBytes = hitBytes( n );
+
+	for( size_t s = 0; s < segments.size(); s++ )
+	{
+		uint8_t* row = hits + s * rowBytes;
+		size_t i = 0;
+
+		__m256 x1 = _mm256_set1_ps( segments.x1[s] ), y1 = _mm256_set1_ps( segments.y1[s] );
+		__m256 x2 = _mm256_set1_ps( segments.x2[s] ), y2 = _mm256_set1_ps( segments.y2[s] );
+
+		for( ; i + 8 <= n; i += 8 )
+		{
+			row[i / 8] = (uint8_t)circleTouchesSegment8( _mm256_loadu_ps( &circles.x[i] ), _mm256_loadu_ps( &circles.y[i] ),
+				_mm256_loadu_ps( &circles.radius[i] ), x1, y1, x2, y2 );
+		}
+
+		touchingFrom( circles, segments, s, i, row );
+	}
+}
+
+__attribute__((target("avx2")))
+inline void touchingPairsAVX2( const Circles& circles, const Segments& segments,
+	const uint32_t* circleIndex, const uint32_t* segmentIndex, size_t count, uint8_t* hits )
+{
+	size_t k = 0;
+	for( ; k + 8 <= count; k += 8 )
+	{
+		__m256i c = _mm256_loadu_si256( (const __m256i*)(circleIndex + k) );
+		__m256i s = _mm256_loadu_si256( (const __m256i*)(segmentIndex + k) );
+
+		hits[k / 8] = (uint8_t)circleTouchesSegment8(
+			_mm256_i32gather_ps( circles.x.data(), c, 4 ), _mm256_i32gather_ps( circles.y.data(), c, 4 ),
+			_mm256_i32gather_ps( circles.radius.data(), c, 4 ),
+			_mm256_i32gather_ps( segments.x1.data(), s, 4 ), _mm256_i32gather_ps( segments.y1.data(), s, 4 ),
+			_mm256_i32gather_ps( segments.x2.data(), s, 4 ), _mm256_i32gather_ps( segments.y2.data(), s, 4 ) );
+	}
+
+	touchingPairsFrom( circles, segments, circleIndex, segmentIndex, k, count, hits );
+}
+#endif
+
+// Every circle against every segment. Segment s's row of bits starts at
+// hits + s * hitBytes( circles.size() ), a bit per circle.
+inline void touching( const Circles& circles, const Segments& segments, uint8_t* hits )
+{
+#ifdef CIRCLE_SEGMENT_X86
+	if( circleSegmentAVX2() )
+	{
+		touchingAVX2( circles, segments, hits );
+		return;
+	}
+#endif
+
+	size_t rowBytes = hitBytes( circles.size() );
+	for( size_t s = 0; s < segments.size(); s++ )
+		touchingFrom( circles, segments, s, 0, hits + s * rowBytes );
+}
+
+// Just the given pairs, circle circleIndex[k] against segment segmentIndex[k],
+// with bit k of hits for the answer. A broad phase's list of maybes goes here.
+inline void touchingPairs( const Circles& circles, const Segments& segments,
+	const uint32_t* circleIndex, const uint32_t* segmentIndex, size_t count, uint8_t* hits )
+{
+#ifdef CIRCLE_SEGMENT_X86
+	if( circleSegmentAVX2() )
+	{
+		touchingPairsAVX2( circles, segments, circleIndex, segmentIndex, count, hits );
+		return;
+	}
+#endif
+
+	touchingPairsFrom( circles, segments, circleIndex, segmentIndex, 0, count, hits );
+}
@@ -1 +1 @@
-time c++ main.cpp -lsdl2 -framework opengl -lglew -std=c++11
\ No newline at end of file
+time c++ main.cpp -O2 -lsdl2 -framework opengl -lglew -std=c++11
\ No newline at end of file
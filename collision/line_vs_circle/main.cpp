@@ -2,10 +2,24 @@
 #include "../tjh_draw.h"
 
 #include "../tjh_math.h"
+#include "../circle_vs_segment.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 
 const int WIDTH = 1280;
 const int HEIGHT = 720;
 
+// Little circles and walls that get tested all at once every frame
+const int NUM_DOTS = 400;
+const int NUM_WALLS = 8;
+
+// -bench tests this many circles against this many segments unless it's given numbers
+const int DEFAULT_BENCH_CIRCLES = 10000;
+const int DEFAULT_BENCH_SEGMENTS = 1000;
+
 struct circle {
 	vec2 pos;
 	float radius;
@@ -24,6 +38,15 @@ float dist( float x1, float y1, float x2, float y2 )
 	return (vec2(x1, y1) - vec2(x2, y2)).length();
 }
 
+// The point on the line through l (not just between its ends) closest to the circle
+vec2 closestPoint( const circle& c, const line& l )
+{
+	vec2 lineNormalized = vec2( l.x2 - l.x1, l.y2 - l.y1 ).normalized();
+	vec2 lineToCircle( c.pos.x - l.x1, c.pos.y - l.y1 );
+	return vec2(l.x1, l.y1) + lineNormalized * lineToCircle.dot( lineNormalized );
+}
+
+// One at a time, see circle_vs_segment.h for lots at once
 bool isTouching( const circle& c, const line& l )
 {	
 	vec2 line( l.x2 - l.x1, l.y2 - l.y1 );
@@ -34,8 +57,6 @@ bool isTouching( const circle& c, const line& l )
 	float closestDist = lineToCircle.dot( lineNormalized );
 	vec2 closestPoint = vec2(l.x1, l.y1) + lineNormalized * closestDist;
 
-	draw::circle( closestPoint.x, closestPoint.y, 10 );
-
 	if( closestDist < 0 )
 	{
 		return c.pos.distance( {l.x1, l.y1} ) < c.radius;
@@ -48,8 +69,130 @@ bool isTouching( const circle& c, const line& l )
 	return closestPoint.distance( c.pos ) < c.radius;
 }
 
-int main()
+float randomFloat( float low, float high )
+{
+	return low + (high - low) * (rand() / (float)RAND_MAX);
+}
+
+void randomCircles( Circles& circles, int count )
+{
+	for( int i = 0; i < count; i++ )
+		circles.add( randomFloat(0, WIDTH), randomFloat(0, HEIGHT), randomFloat(2, 20) );
+}
+
+void randomSegments( Segments& segments, int count )
+{
+	for( int i = 0; i < count; i++ )
+	{
+		float x = randomFloat(0, WIDTH), y = randomFloat(0, HEIGHT);
+		segments.add( x, y, x + randomFloat(-200, 200), y + randomFloat(-200, 200) );
+	}
+}
+
+double millisecondsSince( std::chrono::steady_clock::time_point start )
 {
+	return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Every circle against every segment with isTouching(), then with the batch
+// functions, and how many hits each found
+int benchmark( int numCircles, int numSegments )
+{
+	Circles circles;
+	Segments segments;
+	randomCircles( circles, numCircles );
+	randomSegments( segments, numSegments );
+	long long pairs = (long long)numCircles * numSegments;
+
+	printf( "%d circles against %d segments, %lld pairs\n", numCircles, numSegments, pairs );
+	printf( "the batches go %s\n", circleSegmentAVX2() ? "8 at a time with AVX2" : "one at a time, no AVX2" );
+
+	auto start = std::chrono::steady_clock::now();
+	long long oneAtATime = 0;
+	for( int s = 0; s < numSegments; s++ )
+	{
+		line l{ segments.x1[s], segments.y1[s], segments.x2[s], segments.y2[s] };
+		for( int i = 0; i < numCircles; i++ )
+		{
+			circle c{ { circles.x[i], circles.y[i] }, circles.radius[i] };
+			if( isTouching( c, l ) ) oneAtATime++;
+		}
+	}
+	double oneTime = millisecondsSince( start );
+
+	auto countBits = []( const std::vector<uint8_t>& bits )
+	{
+		long long total = 0;
+		for( uint8_t b : bits ) total += __builtin_popcount( b );
+		return total;
+	};
+
+	std::vector<uint8_t> hits( hitBytes( numCircles ) * numSegments );
+	start = std::chrono::steady_clock::now();
+	touching( circles, segments, hits.data() );
+	double allTime = millisecondsSince( start );
+	long long all = countBits( hits );
+
+	// The same pairs again as a list
+	std::vector<uint32_t> circleIndex( pairs ), segmentIndex( pairs );
+	for( long long k = 0; k < pairs; k++ )
+	{
+		circleIndex[k] = (uint32_t)(k % numCircles);
+		segmentIndex[k] = (uint32_t)(k / numCircles);
+	}
+
+	std::vector<uint8_t> pairHits( hitBytes( pairs ) );
+	start = std::chrono::steady_clock::now();
+	touchingPairs( circles, segments, circleIndex.data(), segmentIndex.data(), pairs, pairHits.data() );
+	double pairTime = millisecondsSince( start );
+	long long listed = countBits( pairHits );
+
+	// Every bit of both batches against the one pair at a time version with the
+	// same maths, which doesn't go anywhere near the 8 at a time code
+	long long wrong = 0;
+	for( int s = 0; s < numSegments; s++ )
+	{
+		for( int i = 0; i < numCircles; i++ )
+		{
+			bool expected = circleTouchesSegment( circles.x[i], circles.y[i], circles.radius[i],
+				segments.x1[s], segments.y1[s], segments.x2[s], segments.y2[s] );
+			long long k = (long long)s * numCircles + i;
+			bool all = hits[s * hitBytes( numCircles ) + i / 8] >> (i % 8) & 1;
+			bool listed = pairHits[k / 8] >> (k % 8) & 1;
+			if( all != expected || listed != expected ) wrong++;
+		}
+	}
+
+	printf( "%-15s %10s %12s %8s\n", "", "ms", "pairs/us", "hits" );
+	printf( "%-15s %10.2f %12.1f %8lld\n", "isTouching", oneTime, pairs / oneTime / 1000, oneAtATime );
+	printf( "%-15s %10.2f %12.1f %8lld\n", "touching", allTime, pairs / allTime / 1000, all );
+	printf( "%-15s %10.2f %12.1f %8lld\n", "touchingPairs", pairTime, pairs / pairTime / 1000, listed );
+
+	// isTouching() rounds differently, so one right on the edge could go either way
+	// and its count is only there to compare with
+	printf( "%lld pairs different from circleTouchesSegment()\n", wrong );
+	return wrong == 0 ? 0 : 1;
+}
+
+int main( int argc, char* argv[] )
+{
+	for( int i = 1; i < argc; i++ )
+	{
+		if( strcmp( argv[i], "-bench" ) == 0 )
+		{
+			int numCircles = DEFAULT_BENCH_CIRCLES, numSegments = DEFAULT_BENCH_SEGMENTS;
+			if( i + 1 < argc && atoi( argv[i + 1] ) > 0 ) numCircles = atoi( argv[++i] );
+			if( i + 1 < argc && atoi( argv[i + 1] ) > 0 ) numSegments = atoi( argv[++i] );
+			return benchmark( numCircles, numSegments );
+		}
+	}
+
+	Circles dots;
+	Segments walls;
+	randomCircles( dots, NUM_DOTS );
+	randomSegments( walls, NUM_WALLS );
+	std::vector<uint8_t> dotHits( hitBytes( NUM_DOTS ) * NUM_WALLS );
+
 	draw::init("collision", WIDTH, HEIGHT );
 
 	char buf[256];	
@@ -74,9 +217,31 @@ int main()
 
 		draw::clear( 0.1, 0.1, 0.1 );
 
+		// Every dot against every wall, a dot touching any of them goes red
+		touching( dots, walls, dotHits.data() );
+
+		draw::setColor( 0.5 );
+		for( int w = 0; w < NUM_WALLS; w++ )
+			draw::line( walls.x1[w], walls.y1[w], walls.x2[w], walls.y2[w] );
+
+		for( int i = 0; i < NUM_DOTS; i++ )
+		{
+			bool hit = false;
+			for( int w = 0; w < NUM_WALLS; w++ )
+				hit = hit || (dotHits[w * hitBytes( NUM_DOTS ) + i / 8] >> (i % 8) & 1);
+
+			if( hit ) draw::setColor( 0.9, 0.2, 0.2 );
+			else draw::setColor( 0.5 );
+			draw::circle( dots.x[i], dots.y[i], dots.radius[i] );
+		}
+
 		c1.pos.x = mouseX;
 		c1.pos.y = mouseY;
 
+		vec2 closest = closestPoint( c1, l1 );
+		draw::setColor( 0.9 );
+		draw::circle( closest.x, closest.y, 10 );
+
 		if( isTouching( c1, l1 ) )
 		{
 			draw::setColor( 0.9, 0.2, 0.2 );
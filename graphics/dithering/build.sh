@@ -0,0 +1 @@
+c++ main.cpp -O2 -std=c++11 -pthread -o dither
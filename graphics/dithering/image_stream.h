@@ -0,0 +1,216 @@
+#pragma once
+
+// Reading and writing images a row at a time.
+//
+// stb_image and stb_image_write both want the whole image in memory at once,
+// which is a problem when the image is bigger than the memory we have. Binary
+// PPM files are simple enough to read row by row ourselves, and a PNG can be
+// written row by row if we don't compress it (each row goes into a "stored"
+// deflate block, so there's no compressor state to carry along).
+//
+// Anything else is loaded with stb_image as usual and handed out a row at a time,
+// so stb_image.h needs to be included before this.
+
+#include "image_write.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+typedef unsigned char u8;
+
+class RowReader
+{
+public:
+	virtual ~RowReader() {}
+
+	// Reads the next row as width * 3 bytes of rgb
+	virtual bool readRow( u8* rgb ) = 0;
+
+	int width = 0;
+	int height = 0;
+};
+
+class RowWriter
+{
+public:
+	virtual ~RowWriter() {}
+
+	// Writes the next row from width * 3 bytes of rgb
+	virtual bool writeRow( const u8* rgb ) = 0;
+
+	// Writes anything that has to come after the last row
+	virtual bool finish() { return true; }
+};
+
+// Binary PPM (P6) with 8 bits per channel
+class PPMReader : public RowReader
+{
+public:
+	~PPMReader() { if( file ) fclose( file ); }
+
+	bool open( const char* filename )
+	{
+		file = fopen( filename, "rb" );
+		if( !file ) return false;
+
+		int maxval;
+		if( fgetc( file ) != 'P' || fgetc( file ) != '6'
+			|| !readNumber( width ) || !readNumber( height ) || !readNumber( maxval )
+			|| width <= 0 || height <= 0 || maxval != 255 )
+			return false;
+
+		// Exactly one whitespace character comes between the header and the pixels,
+		// readNumber() has already eaten it
+		return true;
+	}
+
+	bool readRow( u8* rgb ) override
+	{
+		return fread( rgb, 3, width, file ) == (size_t)width;
+	}
+
+private:
+	// Reads a number from the header, skipping whitespace and # comments
+	bool readNumber( int& value )
+	{
+		int c = fgetc( file );
+		while( c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n' )
+		{
+			if( c == '#' )
+				while( c != '\n' && c != EOF ) c = fgetc( file );
+			c = fgetc( file );
+		}
+
+		if( c < '0' || c > '9' ) return false;
+
+		value = 0;
+		while( c >= '0' && c <= '9' )
+		{
+			value = value * 10 + (c - '0');
+			c = fgetc( file );
+		}
+		return true;
+	}
+
+	FILE* file = nullptr;
+};
+
+// Loads the whole image up front, for formats we can't stream. It takes as much
+// memory as the image does, so -stream only stays small with PPM input.
+class WholeImageReader : public RowReader
+{
+public:
+	~WholeImageReader() { if( image ) stbi_image_free( image ); }
+
+	bool open( const char* filename )
+	{
+		int c;
+		image = stbi_load( filename, &width, &height, &c, 3 );
+		return image != nullptr;
+	}
+
+	bool readRow( u8* rgb ) override
+	{
+		if( row >= height ) return false;
+		memcpy( rgb, image + (size_t)row++ * width * 3, width * 3 );
+		return true;
+	}
+
+private:
+	u8* image = nullptr;
+	int row = 0;
+};
+
+// PPM, or PAM if pam is true
+class PPMWriter : public RowWriter
+{
+public:
+	~PPMWriter() { if( file ) fclose( file ); }
+
+	bool open( const char* filename, int width, int height, bool pam = false )
+	{
+		this->width = width;
+		file = fopen( filename, "wb" );
+		return file && fprintf( file, pnmHeader( pam ), width, height ) > 0;
+	}
+
+	bool writeRow( const u8* rgb ) override
+	{
+		return fwrite( rgb, 3, width, file ) == (size_t)width;
+	}
+
+	bool finish() override
+	{
+		bool ok = fclose( file ) == 0;
+		file = nullptr;
+		return ok;
+	}
+
+private:
+	FILE* file = nullptr;
+	int width = 0;
+};
+
+// Uncompressed PNG, each row is written as its own IDAT chunk.
+//
+// Given a palette it writes an indexed PNG, and rows are passed in as one
+// palette index per pixel rather than rgb.
+class PNGStreamWriter : public RowWriter
+{
+public:
+	~PNGStreamWriter() { if( file ) fclose( file ); }
+
+	bool open( const char* filename, int width, int height, const u8* palette = nullptr, int paletteCount = 0 )
+	{
+		this->width = width;
+		this->height = height;
+		channels = palette ? 1 : 3;
+
+		file = fopen( filename, "wb" );
+		if( !file ) return false;
+
+		png::writeStart( file, width, height, channels, palette, paletteCount );
+
+		// zlib header: deflate, 32K window, no preset dictionary
+		const u8 zlibHeader[] = { 0x78, 0x01 };
+		return png::writeChunk( file, "IDAT", zlibHeader, sizeof(zlibHeader) );
+	}
+
+	bool writeRow( const u8* pixels ) override
+	{
+		// Each row starts with its filter type, 0 means no filter
+		scanline.resize( 1 + width * channels );
+		scanline[0] = 0;
+		memcpy( &scanline[1], pixels, width * channels );
+		adler.add( scanline.data(), scanline.size() );
+
+		chunk.clear();
+		png::storedBlocks( scanline.data(), scanline.size(), ++row == height, chunk );
+		return png::writeChunk( file, "IDAT", chunk.data(), chunk.size() );
+	}
+
+	bool finish() override
+	{
+		u8 check[4];
+		png::putBigEndian( check, adler.value() );
+		png::writeChunk( file, "IDAT", check, sizeof(check) );
+		png::writeChunk( file, "IEND", nullptr, 0 );
+
+		bool ok = !ferror( file );
+		ok = fclose( file ) == 0 && ok;
+		file = nullptr;
+		return ok;
+	}
+
+private:
+	FILE* file = nullptr;
+	int width = 0;
+	int height = 0;
+	int channels = 3;
+	int row = 0;
+	png::Adler32 adler;
+	std::vector<u8> scanline;
+	std::vector<u8> chunk;
+};
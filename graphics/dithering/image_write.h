@@ -0,0 +1,276 @@
+#pragma once
+
+// Writing the dithered image out.
+//
+// stbi_write_png always compresses as hard as it's set up to and only does rgb.
+// A dithered image only has a handful of colours though, so here we can also:
+// - write raw PPM / PAM, which costs nothing to encode but is big
+// - write an indexed PNG, one byte per pixel pointing into a palette, which is
+//   a third of the data to filter and compress before we even start
+// - pick how hard to compress, from 0 (stored, no compression at all) to 9
+//
+// The deflate itself is stb_image_write's stbi_zlib_compress(), whose "quality"
+// is how many earlier matches it remembers for each hash, so stb_image_write.h
+// needs its implementation included before this.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+typedef unsigned char u8;
+
+// From stb_image_write.h, it's not in the header part of this version
+unsigned char* stbi_zlib_compress( unsigned char* data, int data_len, int* out_len, int quality );
+
+namespace png
+{
+	inline void putBigEndian( u8* out, unsigned int v )
+	{
+		out[0] = v >> 24;
+		out[1] = v >> 16;
+		out[2] = v >> 8;
+		out[3] = v;
+	}
+
+	inline unsigned int crc32( unsigned int crc, const u8* data, size_t len )
+	{
+		// Built the first time through, static locals are thread safe to initialise
+		struct Table
+		{
+			unsigned int v[256];
+			Table()
+			{
+				for( unsigned int n = 0; n < 256; n++ )
+				{
+					unsigned int c = n;
+					for( int k = 0; k < 8; k++ )
+						c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+					v[n] = c;
+				}
+			}
+		};
+		static const Table table;
+
+		for( size_t i = 0; i < len; i++ )
+			crc = table.v[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return crc;
+	}
+
+	// Running adler32 checksum for the end of a zlib stream
+	struct Adler32
+	{
+		unsigned int a = 1;
+		unsigned int b = 0;
+
+		void add( const u8* data, size_t len )
+		{
+			// Sums can go 5552 bytes before they might overflow
+			while( len > 0 )
+			{
+				size_t block = len < 5552 ? len : 5552;
+				for( size_t i = 0; i < block; i++ )
+				{
+					a += data[i];
+					b += a;
+				}
+				a %= 65521;
+				b %= 65521;
+				data += block;
+				len -= block;
+			}
+		}
+
+		unsigned int value() const { return (b << 16) | a; }
+	};
+
+	inline bool writeChunk( FILE* file, const char* type, const u8* data, size_t len )
+	{
+		u8 length[4];
+		putBigEndian( length, (unsigned int)len );
+		fwrite( length, 1, 4, file );
+		fwrite( type, 1, 4, file );
+		if( len ) fwrite( data, 1, len, file );
+
+		unsigned int crc = crc32( 0xffffffffu, (const u8*)type, 4 );
+		crc = crc32( crc, data, len ) ^ 0xffffffffu;
+
+		u8 crcBytes[4];
+		putBigEndian( crcBytes, crc );
+		return fwrite( crcBytes, 1, 4, file ) == 4;
+	}
+
+	// Signature, header and palette (if there is one).
+	// channels is 3 for rgb or 1 for indices into the palette.
+	inline void writeStart( FILE* file, int width, int height, int channels, const u8* palette, int paletteCount )
+	{
+		const u8 signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+		fwrite( signature, 1, sizeof(signature), file );
+
+		u8 header[13];
+		putBigEndian( header, width );
+		putBigEndian( header + 4, height );
+		header[8] = 8;                        // bits per channel
+		header[9] = channels == 1 ? 3 : 2;    // indexed or rgb
+		header[10] = 0;                       // deflate
+		header[11] = 0;                       // standard filters
+		header[12] = 0;                       // not interlaced
+		writeChunk( file, "IHDR", header, sizeof(header) );
+
+		if( channels == 1 )
+			writeChunk( file, "PLTE", palette, paletteCount * 3 );
+	}
+
+	// Appends data to a deflate stream as "stored" blocks, which is to say not compressed
+	inline void storedBlocks( const u8* data, size_t len, bool last, std::vector<u8>& out )
+	{
+		size_t start = 0;
+		do
+		{
+			size_t block = len - start < 65535 ? len - start : 65535;
+			bool lastBlock = last && start + block == len;
+
+			out.push_back( lastBlock ? 1 : 0 );
+			out.push_back( block & 0xff );
+			out.push_back( block >> 8 );
+			out.push_back( ~block & 0xff );
+			out.push_back( (~block >> 8) & 0xff );
+			out.insert( out.end(), data + start, data + start + block );
+
+			start += block;
+		} while( start < len );
+	}
+
+	inline u8 paeth( int a, int b, int c )
+	{
+		int p = a + b - c, pa = abs( p - a ), pb = abs( p - b ), pc = abs( p - c );
+		if( pa <= pb && pa <= pc ) return (u8)a;
+		if( pb <= pc ) return (u8)b;
+		return (u8)c;
+	}
+
+	// Filters one row into out (which starts with the filter type byte).
+	// prev is the row above or nullptr for the first row, bpp is bytes per pixel.
+	inline void filterRow( int type, const u8* row, const u8* prev, int len, int bpp, u8* out )
+	{
+		out[0] = (u8)type;
+		for( int i = 0; i < len; i++ )
+		{
+			int left = i >= bpp ? row[i - bpp] : 0;
+			int up = prev ? prev[i] : 0;
+			int upLeft = (prev && i >= bpp) ? prev[i - bpp] : 0;
+
+			int predict = 0;
+			switch( type )
+			{
+			case 1: predict = left; break;
+			case 2: predict = up; break;
+			case 3: predict = (left + up) >> 1; break;
+			case 4: predict = paeth( left, up, upLeft ); break;
+			}
+			out[i + 1] = (u8)(row[i] - predict);
+		}
+	}
+}
+
+// How hard to compress for each level, as stbi_zlib_compress() "quality"
+// (level 0 means don't compress)
+const int PNG_QUALITY[10] = { 0, 5, 5, 6, 7, 8, 12, 16, 24, 32 };
+
+// Level 5 is what stbi_write_png does
+const int PNG_DEFAULT_LEVEL = 5;
+
+// Writes a whole PNG. channels is 3 for rgb, or 1 for indices into the palette.
+//
+// Level 0 stores the image uncompressed, 1 compresses without filtering the rows
+// first, and 2 and above try every filter on each row and keep the one that
+// looks most compressible, like stbi_write_png does. Indexed images are never
+// filtered, filters don't help with palette indices.
+inline bool writePNG( const char* filename, int width, int height, int channels, const u8* pixels,
+	const u8* palette, int paletteCount, int level )
+{
+	int rowBytes = width * channels;
+	std::vector<u8> filtered( (size_t)(rowBytes + 1) * height );
+	std::vector<u8> trial( rowBytes + 1 );
+
+	for( int y = 0; y < height; y++ )
+	{
+		const u8* row = pixels + (size_t)y * rowBytes;
+		const u8* prev = y > 0 ? row - rowBytes : nullptr;
+		u8* out = &filtered[(size_t)y * (rowBytes + 1)];
+
+		if( level < 2 || channels == 1 )
+		{
+			png::filterRow( 0, row, prev, rowBytes, channels, out );
+			continue;
+		}
+
+		// Smallest sum of the filtered bytes (as signed values) usually compresses best
+		int bestSum = -1;
+		for( int type = 0; type < 5; type++ )
+		{
+			png::filterRow( type, row, prev, rowBytes, channels, trial.data() );
+
+			int sum = 0;
+			for( int i = 1; i <= rowBytes; i++ )
+				sum += abs( (signed char)trial[i] );
+
+			if( bestSum < 0 || sum < bestSum )
+			{
+				bestSum = sum;
+				std::copy( trial.begin(), trial.end(), out );
+			}
+		}
+	}
+
+	std::vector<u8> zlib;
+	if( level <= 0 )
+	{
+		zlib.push_back( 0x78 );
+		zlib.push_back( 0x01 );
+		png::storedBlocks( filtered.data(), filtered.size(), true, zlib );
+
+		png::Adler32 adler;
+		adler.add( filtered.data(), filtered.size() );
+		u8 check[4];
+		png::putBigEndian( check, adler.value() );
+		zlib.insert( zlib.end(), check, check + 4 );
+	}
+	else
+	{
+		int len = 0;
+		u8* compressed = stbi_zlib_compress( filtered.data(), (int)filtered.size(), &len,
+			PNG_QUALITY[level > 9 ? 9 : level] );
+		if( !compressed ) return false;
+		zlib.assign( compressed, compressed + len );
+		free( compressed );
+	}
+
+	FILE* file = fopen( filename, "wb" );
+	if( !file ) return false;
+
+	png::writeStart( file, width, height, channels, palette, paletteCount );
+	png::writeChunk( file, "IDAT", zlib.data(), zlib.size() );
+	png::writeChunk( file, "IEND", nullptr, 0 );
+
+	bool ok = !ferror( file );
+	return fclose( file ) == 0 && ok;
+}
+
+inline const char* pnmHeader( bool pam )
+{
+	return pam ? "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n" : "P6\n%d %d\n255\n";
+}
+
+// Raw rgb as a PPM, or a PAM if pam is true, which is the same with a wordier header
+inline bool writePNM( const char* filename, int width, int height, const u8* rgb, bool pam )
+{
+	FILE* file = fopen( filename, "wb" );
+	if( !file ) return false;
+
+	fprintf( file, pnmHeader( pam ), width, height );
+	fwrite( rgb, 3, (size_t)width * height, file );
+
+	bool ok = !ferror( file );
+	return fclose( file ) == 0 && ok;
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+// Error diffusion with the error kept in its own buffers.
+//
+// The original version in main.cpp adds the error straight back into the image,
+// which is stored as u8. That means negative error is lost, anything over 255
+// wraps around, and every share of the error goes through a float.
+//
+// Here the error for the current row and the rows below live in separate arrays
+// of signed 16 bit values, one per channel, counted in fractions of a level
+// (1/16ths for Floyd-Steinberg, 1/48ths for Jarvis-Judice-Ninke and so on).
+// That makes every weight an exact integer multiply, and the image itself is
+// never written to.
+//
+// Each kernel is a list of taps, worked out at compile time. Spreading the error
+// expands into one line of code per tap, so there are no loops or checks on the
+// shape of the kernel left for each pixel. A wider kernel only costs its extra taps.
+
+#include "wavefront.h"
+
+#include <algorithm>
+#include <vector>
+
+typedef unsigned char u8;
+
+// A share of the error: `weight` goes to the pixel `dx` along (in the direction
+// the row is going) and `dy` rows down
+template<int DX, int DY, int WEIGHT>
+struct Tap
+{
+	static const int dx = DX;
+	static const int dy = DY;
+	static const int weight = WEIGHT;
+};
+
+// Adds up a list of taps at compile time
+template<typename... Taps>
+struct TapList;
+
+template<>
+struct TapList<>
+{
+	static const int rows = 1;
+	static const int reach = 0;
+	static const int total = 0;
+
+	static void spread( short* const*, int, int, int ) {}
+};
+
+template<typename T, typename... Rest>
+struct TapList<T, Rest...>
+{
+	typedef TapList<Rest...> Next;
+
+	// How many rows of error it needs, including this one
+	static const int rows = T::dy + 1 > Next::rows ? T::dy + 1 : Next::rows;
+	// How far left or right it reaches
+	static const int reach = (T::dx < 0 ? -T::dx : T::dx) > Next::reach ? (T::dx < 0 ? -T::dx : T::dx) : Next::reach;
+	// Sum of all the weights
+	static const int total = T::weight + Next::total;
+
+	// rows[0] is this row, rows[1] the one below and so on
+	static inline void spread( short* const* rows, int x, int dir, int error )
+	{
+		rows[T::dy][x + T::dx * dir] += (short)(error * T::weight);
+		Next::spread( rows, x, dir, error );
+	}
+};
+
+// Weights are DIVISOR-ths of the error
+template<int DIVISOR, typename... Taps>
+struct Kernel
+{
+	typedef TapList<Taps...> taps;
+
+	static const int divisor = DIVISOR;
+	static const int rows = taps::rows;
+	static const int reach = taps::reach;
+
+	static_assert( taps::total <= DIVISOR, "a kernel can't spread more error than there is" );
+	static_assert( reach <= 2, "rows of error only have room for kernels 2 pixels either side" );
+};
+
+//            X   7
+//        3   5   1     (1/16)
+struct FloydSteinberg : Kernel<16,
+	Tap<1,0,7>,
+	Tap<-1,1,3>, Tap<0,1,5>, Tap<1,1,1>> {};
+
+//                X   7   5
+//        3   5   7   5   3
+//        1   3   5   3   1     (1/48)
+struct JarvisJudiceNinke : Kernel<48,
+	Tap<1,0,7>, Tap<2,0,5>,
+	Tap<-2,1,3>, Tap<-1,1,5>, Tap<0,1,7>, Tap<1,1,5>, Tap<2,1,3>,
+	Tap<-2,2,1>, Tap<-1,2,3>, Tap<0,2,5>, Tap<1,2,3>, Tap<2,2,1>> {};
+
+//                X   8   4
+//        2   4   8   4   2
+//        1   2   4   2   1     (1/42)
+struct Stucki : Kernel<42,
+	Tap<1,0,8>, Tap<2,0,4>,
+	Tap<-2,1,2>, Tap<-1,1,4>, Tap<0,1,8>, Tap<1,1,4>, Tap<2,1,2>,
+	Tap<-2,2,1>, Tap<-1,2,2>, Tap<0,2,4>, Tap<1,2,2>, Tap<2,2,1>> {};
+
+//            X   1   1
+//        1   1   1
+//            1             (1/8, the last 2/8 is thrown away on purpose)
+struct Atkinson : Kernel<8,
+	Tap<1,0,1>, Tap<2,0,1>,
+	Tap<-1,1,1>, Tap<0,1,1>, Tap<1,1,1>,
+	Tap<0,2,1>> {};
+
+//                X   5   3
+//        2   4   5   4   2
+//            2   3   2         (1/32)
+struct Sierra : Kernel<32,
+	Tap<1,0,5>, Tap<2,0,3>,
+	Tap<-2,1,2>, Tap<-1,1,4>, Tap<0,1,5>, Tap<1,1,4>, Tap<2,1,2>,
+	Tap<-1,2,2>, Tap<0,2,3>, Tap<1,2,2>> {};
+
+// Spare values either side of each row of error, so the edges don't need any checks
+const int ERROR_PADDING = 2;
+
+// One row of error, in 1/divisor-ths of a level
+struct ErrorRow
+{
+	std::vector<short> r, g, b;
+
+	void resize( int width )
+	{
+		r.assign( width + ERROR_PADDING * 2, 0 );
+		g.assign( width + ERROR_PADDING * 2, 0 );
+		b.assign( width + ERROR_PADDING * 2, 0 );
+	}
+
+	void clear()
+	{
+		std::fill( r.begin(), r.end(), 0 );
+		std::fill( g.begin(), g.end(), 0 );
+		std::fill( b.begin(), b.end(), 0 );
+	}
+};
+
+// Adds the error (in 1/DIVISOR-ths) to a pixel value, rounding to the nearest level.
+// Error never adds up to more than a pixel's worth (255 * DIVISOR), which fits in a
+// short, so shifting it positive first lets the division always round the same way.
+template<int DIVISOR>
+inline int withError( int value, int error )
+{
+	value += (error + DIVISOR / 2 + 256 * DIVISOR) / DIVISOR - 256;
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// Dithers one row with kernel K.
+//
+// src and dst are this row as rgb. errors[0] is the error for this row, errors[1]
+// for the row below and so on, K::rows of them. dir is the direction this row
+// goes in, positive is to the right, and the kernel is mirrored when going left.
+//
+// closest( r, g, b ) returns a pointer to the rgb of the closest palette colour.
+//
+// If a wavefront is given, row y waits on row y - 1 before reading error it
+// might still be adding to, like ditherRow() in main.cpp. Rows further up don't
+// need checking, row y - 1 already waited on them.
+template<typename K, typename Closest>
+void ditherRowKernel( const u8* src, u8* dst, int width, int y, int dir, int aboveDir,
+	ErrorRow* const* errors, Wavefront* wavefront, Closest closest )
+{
+	short* r[K::rows];
+	short* g[K::rows];
+	short* b[K::rows];
+	for( int i = 0; i < K::rows; i++ )
+	{
+		r[i] = errors[i]->r.data() + ERROR_PADDING;
+		g[i] = errors[i]->g.data() + ERROR_PADDING;
+		b[i] = errors[i]->b.data() + ERROR_PADDING;
+	}
+
+	// The row above adds to columns up to `reach` either side of where it is, and we
+	// add to columns up to `reach` ahead of us, so it has to be 2 * reach + 1 ahead
+	const int lag = 2 * K::reach + 1;
+
+	int known = 0;
+
+	for( int i = 0; i < width; i++ )
+	{
+		int x = dir > 0 ? i : width - 1 - i;
+
+		// Progress is counted in pixels along each row's own direction. If the row
+		// above went the other way, the first pixel we need is the last one it did.
+		if( wavefront )
+			wavefront->waitFor( y - 1, aboveDir == dir ? std::min( width, i + lag ) : width, known );
+
+		int red   = withError<K::divisor>( src[x * 3    ], r[0][x] );
+		int green = withError<K::divisor>( src[x * 3 + 1], g[0][x] );
+		int blue  = withError<K::divisor>( src[x * 3 + 2], b[0][x] );
+
+		const u8* c = closest( red, green, blue );
+		dst[x * 3    ] = c[0];
+		dst[x * 3 + 1] = c[1];
+		dst[x * 3 + 2] = c[2];
+
+		K::taps::spread( r, x, dir, red - c[0] );
+		K::taps::spread( g, x, dir, green - c[1] );
+		K::taps::spread( b, x, dir, blue - c[2] );
+
+		if( wavefront && (i + 1) % PUBLISH_EVERY == 0 )
+			wavefront->publish( y, i + 1 );
+	}
+
+	if( wavefront )
+		wavefront->publish( y, width );
+}
+
+// The rows of error a kernel is working with, the first one is the current row.
+// When a row is done the first one is cleared and moved to the back.
+template<typename K>
+struct ErrorWindow
+{
+	ErrorRow rows[K::rows];
+	ErrorRow* pointers[K::rows];
+
+	ErrorWindow( int width )
+	{
+		for( int i = 0; i < K::rows; i++ )
+		{
+			rows[i].resize( width );
+			pointers[i] = &rows[i];
+		}
+	}
+
+	void next()
+	{
+		pointers[0]->clear();
+		std::rotate( pointers, pointers + 1, pointers + K::rows );
+	}
+};
+
+// Dithers a whole image with kernel K. The image is never changed.
+//
+// On one thread this only needs K::rows rows of error. With more threads every
+// row in flight needs its own as well, so it keeps a ring of K::rows + threads
+// of them. Before a row adds error to a slot for the first time, it waits for
+// the row that used that slot last time round to finish, then clears it.
+template<typename K, typename Closest>
+void ditherImageKernel( const u8* image, u8* dithered_image, int width, int height,
+	bool serpentine, int threads, Closest closest )
+{
+	// Rows snake back and forth unless serpentine is off
+	auto direction = [=]( int y ) { return (serpentine && y % 2 == 1) ? -1 : 1; };
+
+	if( threads <= 1 )
+	{
+		ErrorWindow<K> window( width );
+
+		for( int y = 0; y < height; y++ )
+		{
+			size_t row = (size_t)y * width * 3;
+			ditherRowKernel<K>( image + row, dithered_image + row, width, y,
+				direction( y ), direction( y - 1 ), window.pointers, nullptr, closest );
+			window.next();
+		}
+		return;
+	}
+
+	const int ring = K::rows + std::min( threads, height );
+	std::vector<ErrorRow> errors( ring );
+	for( auto& e : errors )
+		e.resize( width );
+
+	Wavefront wavefront( height );
+
+	wavefront.run( threads, [&]( int y )
+	{
+		// The deepest row we add to shares a slot with this row, which has to be done with it.
+		// Rows finish in order, so every other row that used the slot is done too.
+		int previous = y + K::rows - 1 - ring;
+		if( previous >= 0 )
+		{
+			int known = 0;
+			wavefront.waitFor( previous, width, known );
+			errors[(y + K::rows - 1) % ring].clear();
+		}
+
+		ErrorRow* rows[K::rows];
+		for( int i = 0; i < K::rows; i++ )
+			rows[i] = &errors[(y + i) % ring];
+
+		size_t row = (size_t)y * width * 3;
+		ditherRowKernel<K>( image + row, dithered_image + row, width, y,
+			direction( y ), direction( y - 1 ), rows, &wavefront, closest );
+	});
+}
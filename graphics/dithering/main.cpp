@@ -7,10 +7,33 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include "image_stream.h"
+#include "kernels.h"
+#include "ordered.h"
+#include "palette.h"
+#include "perceptual.h"
+#include "quantize.h"
+#include "wavefront.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
 typedef unsigned char u8;
 
-// Colour palette to use for dithering
-u8 palette[] = 
+// Colour palette to use for dithering, unless one is given on the command line
+u8 defaultPalette[] = 
 {
 	255, 255, 255,
 	255,   0,   0,
@@ -22,6 +45,32 @@ u8 palette[] =
 	  0,   0,   0
 };
 
+// The palette actually in use, as rgb triples
+std::vector<u8> palette( defaultPalette, defaultPalette + sizeof(defaultPalette) );
+
+// How to find the closest palette colour to a pixel, see palette.h
+enum Search
+{
+	SEARCH_AUTO,    // lookup table for normal palettes, simd for huge ones
+	SEARCH_LUT,     // PaletteLUT
+	SEARCH_SIMD,    // PaletteSearch, with the widest instructions the CPU has
+	SEARCH_SCALAR,  // PaletteSearch, without simd
+	SEARCH_BRUTE    // getClosestIndexBruteForce(), the original loop
+};
+
+Search search = SEARCH_AUTO;
+
+// Past this many colours the lookup table takes longer to build than it saves
+const int MAX_LUT_COLOURS = 1024;
+
+// Built from the palette once we know what it is
+PaletteLUT paletteLUT;
+PaletteSearch paletteSearch;
+
+// Match colours by how they look (in OKLab) instead of by rgb, see perceptual.h
+bool perceptual = false;
+PerceptualLUT perceptualLUT;
+
 int clamp( int v, int lo, int hi )
 {
 	if( v < lo ) return lo;
@@ -80,106 +129,1111 @@ void addColour( u8* image, int width, int x, int y, Colour c )
 	image[ y * width * 3 + x * 3 + 2 ] += c.b;
 }
 
-Colour getClosest( Colour target )
+// Checks every colour in the palette for the closest one, returns its index
+int getClosestIndexBruteForce( int r, int g, int b )
 {
-	Colour result;
+	int result = 0;
 	float closest = -1;
-	for( int i = 0; i < sizeof(palette)/sizeof(*palette); i+=3)
+	for( size_t i = 0; i < palette.size(); i+=3)
 	{
-		int dist_r = (target.r - palette[i]);
-		int dist_g = (target.g - palette[i+1]);
-		int dist_b = (target.b - palette[i+2]);
+		int dist_r = (r - palette[i]);
+		int dist_g = (g - palette[i+1]);
+		int dist_b = (b - palette[i+2]);
 
 		float dist_squared = dist_r * dist_r + dist_g * dist_g + dist_b * dist_b;
 		if( closest < 0 or dist_squared < closest)
 		{
-			result.r = palette[i];
-			result.g = palette[i+1];
-			result.b = palette[i+2];
+			result = i / 3;
 			closest = dist_squared;
 		}
 	}
 	return result;
 }
 
-int main( int argc, char* argv[] )
+// Same answer as getClosestIndexBruteForce(), but faster
+int getClosestIndex( int r, int g, int b )
+{
+	if( perceptual )
+		return search == SEARCH_BRUTE ? perceptualLUT.closestBruteForce( r, g, b ) : perceptualLUT.closest( r, g, b );
+
+	switch( search )
+	{
+	case SEARCH_BRUTE:
+		return getClosestIndexBruteForce( r, g, b );
+	case SEARCH_SIMD:
+	case SEARCH_SCALAR:
+		return paletteSearch.closest( r, g, b );
+	default:
+		return paletteLUT.closest( r, g, b );
+	}
+}
+
+// Builds whatever the chosen search needs, once the palette is known
+void prepareSearch()
+{
+	int count = (int)palette.size() / 3;
+
+	if( search == SEARCH_AUTO )
+		search = count <= MAX_LUT_COLOURS ? SEARCH_LUT : SEARCH_SIMD;
+
+	auto start = std::chrono::steady_clock::now();
+
+	// Perceptual matching always has a lookup table, brute force is checked against it
+	if( perceptual )
+	{
+		perceptualLUT = PerceptualLUT( palette.data(), count );
+
+		auto built = std::chrono::steady_clock::now();
+		printf( "built perceptual lookup table for %d colours in %.1f ms, %.2f colours to check per box\n",
+			count, std::chrono::duration<double, std::milli>( built - start ).count(),
+			perceptualLUT.averageCandidates() );
+	}
+	else if( search == SEARCH_LUT )
+	{
+		paletteLUT = PaletteLUT( palette.data(), count );
+
+		auto built = std::chrono::steady_clock::now();
+		printf( "built lookup table for %d colours in %.1f ms, %.2f colours to check per box\n",
+			count, std::chrono::duration<double, std::milli>( built - start ).count(),
+			paletteLUT.averageCandidates() );
+	}
+	else if( search == SEARCH_SIMD || search == SEARCH_SCALAR )
+	{
+		paletteSearch = PaletteSearch( palette.data(), count );
+		if( search == SEARCH_SCALAR )
+			paletteSearch.forceScalar();
+
+		printf( "searching %d colours using %s\n", count, paletteSearch.instructionSet() );
+	}
+}
+
+Colour getClosest( Colour target )
+{
+	int i = getClosestIndex( target.r, target.g, target.b ) * 3;
+	return { palette[i], palette[i+1], palette[i+2] };
+}
+
+// The rgb of the closest palette colour, for the kernels in kernels.h
+const u8* closestRGB( int r, int g, int b )
+{
+	return &palette[getClosestIndex( r, g, b ) * 3];
+}
+
+// Reads a palette from a text file, one colour per line as "r g b" from 0 to 255
+bool loadPalette( const char* filename )
+{
+	FILE* file = fopen( filename, "r" );
+	if( !file )
+		return false;
+
+	std::vector<u8> colours;
+	int r, g, b;
+	while( fscanf( file, "%d %d %d", &r, &g, &b ) == 3 )
+	{
+		colours.push_back( (u8)clamp( r, 0, 255 ) );
+		colours.push_back( (u8)clamp( g, 0, 255 ) );
+		colours.push_back( (u8)clamp( b, 0, 255 ) );
+	}
+	fclose( file );
+
+	// The lookup table stores colour indices as 16 bits
+	if( colours.empty() || colours.size() / 3 > 65536 )
+		return false;
+
+	palette = colours;
+	return true;
+}
+
+// Rows snake back and forth by default, but can all run left to right.
+// Left to right is what lets the wavefront really overlap rows, see ditherRow()
+int rowDirection( int y, bool serpentine )
+{
+	return (serpentine && y % 2 == 1) ? -1 : 1;
+}
+
+// Dither a single row of the image.
+//
+// dir is the direction this row goes in, positive is to the right.
+// aboveDir is the direction of the row above, which decides if it sends us any error.
+//
+// If a wavefront is given we're sharing the image with other threads, so we
+// wait on the row above before reading anything it might still be changing,
+// and tell the row below how far we've got.
+void ditherRow( u8* original_image, u8* dithered_image, int width, int height,
+	int y, int dir, int aboveDir, Wavefront* wavefront )
+{
+	int known = 0;
+	int done = 0;
+
+	// See the 3/16 share below
+	Colour wrapped = { 0, 0, 0 };
+	int lastX = (dir > 0 ? width - 1 : 0);
+
+	// A little ugly, x will either increase or decrease
+	// depending on what direction we are currently going in
+	for( int x = (dir > 0 ? 0 : width - 1);
+		x != (dir > 0 ? width : -1);
+		x += dir )
+	{
+		// Rows going right add error to x-1, x and x+1 of the row below. Before we
+		// read x, or add our own error to x+dir, the row above has to be done with
+		// every column up to x+2. (Rows going left only ever push error back up
+		// into the row above, see below, so they don't hold anyone up)
+		if( wavefront && aboveDir > 0 )
+			wavefront->waitFor( y - 1, std::min( width, x + 3 ), known );
+
+		if( x == lastX )
+			addColour( original_image, width, x, y, wrapped );
+
+		Colour original = getColour( original_image, width, x, y );
+
+		// Get the closset colour form the palette (defined at the top of the file)
+		Colour closest  = getClosest( original );
+
+
+		setColour( dithered_image, width, x, y, closest );
+
+		// Take the error and distribute it over nearby pixels
+		// This pattern was just copied from wikipedia, there may be other patterns that
+		// produce different effects.
+		// https://en.wikipedia.org/wiki/Floyd–Steinberg_dithering
+		//
+		// Note the "next row" is y + dir, so rows going left push their error back
+		// into the row above, which is already finished. The output depends on
+		// this so it's kept as is.
+
+		Colour error = original - closest;
+
+		// Also, before we write to the image we check the pixel is actually in range
+		// and we aren't writing off the edge or something
+		if( inRange(x + dir, 0, width - 1) )
+		{
+			addColour( original_image, width, x + dir, y, error * (7.0f/16.0f) );
+		}
+
+		if( inRange(x + dir, 0, width - 1)
+			&& y < height - 1 )
+		{
+			// For the first pixel in a row x - dir is off the edge, which in memory is
+			// the last pixel of this row. Hang on to it and add it just before we get
+			// there, by then the row above is definitely done adding to that pixel.
+			if( inRange(x - dir, 0, width - 1) )
+				addColour( original_image, width, x - dir, y + dir, error * (3.0f/16.0f) );
+			else
+				wrapped = error * (3.0f/16.0f);
+		}
+
+		if( inRange(y + dir, 0, height - 1) )
+		{
+			addColour( original_image, width, x      , y + dir, error * (5.0f/16.0f) );
+		}
+
+		if( inRange(x + dir, 0, width - 1)
+			&& y < height - 1)
+		{
+			addColour( original_image, width, x + dir, y + dir, error * (1.0f/16.0f) );
+		}
+
+		// Only rows going right report partial progress, as it's counted
+		// in columns from the left
+		if( wavefront && dir > 0 && ++done % PUBLISH_EVERY == 0 )
+			wavefront->publish( y, done );
+	}
+
+	if( wavefront )
+		wavefront->publish( y, width );
+}
+
+// The original single threaded version, one row after another
+void ditherSerial( u8* original_image, u8* dithered_image, int width, int height, bool serpentine )
+{
+	for( int y = 0; y < height; y++ )
+	{
+		ditherRow( original_image, dithered_image, width, height,
+			y, rowDirection( y, serpentine ), rowDirection( y - 1, serpentine ), nullptr );
+	}
+}
+
+// Same result as ditherSerial(), bit for bit, but rows run at the same time on several threads.
+//
+// With the snaking rows a row going left has to wait for the whole row above
+// to finish, so only pairs of rows overlap. Left to right rows only have to stay
+// a few pixels behind each other, so every thread can be kept busy.
+void ditherParallel( u8* original_image, u8* dithered_image, int width, int height,
+	bool serpentine, int threads )
+{
+	Wavefront wavefront( height );
+
+	wavefront.run( threads, [&]( int y )
+	{
+		ditherRow( original_image, dithered_image, width, height,
+			y, rowDirection( y, serpentine ), rowDirection( y - 1, serpentine ), &wavefront );
+	});
+}
+
+// Which error diffusion to use
+enum KernelType
 {
-	// Use snow.jpg by default, or get from the command line
-	const char* filename = "snow.jpg";
-	if( argc > 1 )
-		filename = argv[1];
+	KERNEL_LEGACY,    // ditherRow(), error added back into the u8 image
+	KERNEL_FLOYD,     // the rest are in kernels.h, with fixed point error buffers
+	KERNEL_JARVIS,
+	KERNEL_STUCKI,
+	KERNEL_ATKINSON,
+	KERNEL_SIERRA
+};
+
+// Dithers a whole image with one of the kernels in kernels.h
+void ditherImage( const u8* image, u8* dithered_image, int width, int height,
+	KernelType kernel, bool serpentine, int threads )
+{
+	switch( kernel )
+	{
+	case KERNEL_JARVIS:
+		ditherImageKernel<JarvisJudiceNinke>( image, dithered_image, width, height, serpentine, threads, closestRGB );
+		break;
+	case KERNEL_STUCKI:
+		ditherImageKernel<Stucki>( image, dithered_image, width, height, serpentine, threads, closestRGB );
+		break;
+	case KERNEL_ATKINSON:
+		ditherImageKernel<Atkinson>( image, dithered_image, width, height, serpentine, threads, closestRGB );
+		break;
+	case KERNEL_SIERRA:
+		ditherImageKernel<Sierra>( image, dithered_image, width, height, serpentine, threads, closestRGB );
+		break;
+	default:
+		ditherImageKernel<FloydSteinberg>( image, dithered_image, width, height, serpentine, threads, closestRGB );
+		break;
+	}
+}
+
+// The threshold map for -ordered, made once at startup
+ThresholdMap orderedMap;
+
+// How far to nudge pixels for ordered dithering. With n levels per channel the
+// palette colours are about 255 / (n - 1) apart, and a palette of `count`
+// colours has roughly the cube root of that many levels per channel.
+int orderedSpread()
+{
+	float levels = std::cbrt( (float)(palette.size() / 3) );
+	return (int)std::lround( 255.0f / std::max( 1.0f, levels - 1.0f ) );
+}
+
+// How many rows each thread takes at a time for ordered dithering
+const int ORDERED_TILE_ROWS = 32;
+
+// Ordered dithering, every pixel is independent so the image is split into
+// strips of rows and the strips are shared out between the threads
+void ditherOrdered( const u8* image, u8* dithered_image, int width, int height, int threads )
+{
+	OrderedRows rows( orderedMap, orderedSpread(), width );
+
+	int tiles = (height + ORDERED_TILE_ROWS - 1) / ORDERED_TILE_ROWS;
+	parallelFor( tiles, threads, [&]( int tile )
+	{
+		int end = std::min( height, (tile + 1) * ORDERED_TILE_ROWS );
+		for( int y = tile * ORDERED_TILE_ROWS; y < end; y++ )
+		{
+			size_t row = (size_t)y * width * 3;
+			ditherRowOrdered( image + row, dithered_image + row, width, y, rows, closestRGB );
+		}
+	});
+}
+
+// What the dithered image gets saved as
+enum OutputFormat
+{
+	FORMAT_DEFAULT,  // png, keeping the input's file name (and extension)
+	FORMAT_PNG,
+	FORMAT_INDEXED,  // png with the palette in it, one byte per pixel
+	FORMAT_PPM,
+	FORMAT_PAM
+};
+
+// An indexed png can't have more than this many colours
+const int MAX_INDEXED_COLOURS = 256;
+
+// Every dithered pixel is exactly one of the palette colours, so this finds its index.
+// When the palette has the same colour twice it's always the first one, like the search.
+void toIndices( const u8* rgb, u8* indices, int count )
+{
+	for( int i = 0; i < count; i++ )
+		indices[i] = (u8)getClosestIndex( rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2] );
+}
+
+// Turns each row into palette indices before handing it on to a PNGStreamWriter
+class IndexedRowWriter : public RowWriter
+{
+public:
+	bool open( const char* filename, int width, int height )
+	{
+		indices.resize( width );
+		return png.open( filename, width, height, palette.data(), (int)palette.size() / 3 );
+	}
+
+	bool writeRow( const u8* rgb ) override
+	{
+		toIndices( rgb, indices.data(), (int)indices.size() );
+		return png.writeRow( indices.data() );
+	}
+
+	bool finish() override { return png.finish(); }
+
+private:
+	PNGStreamWriter png;
+	std::vector<u8> indices;
+};
+
+// How many colours -quantize makes unless -colours says otherwise
+const int DEFAULT_QUANTIZE_COLOURS = 16;
+
+// Everything that decides how an image gets dithered
+struct Options
+{
+	int threads = 1;
+	bool serpentine = true;
+	bool stream = false;
+	bool ordered = false;  // use orderedMap instead of error diffusion
+	KernelType kernel = KERNEL_LEGACY;
+	OutputFormat format = FORMAT_DEFAULT;
+	int level = PNG_DEFAULT_LEVEL;  // png compression, 0 to 9
+};
+
+bool endsWith( const char* s, const char* suffix )
+{
+	size_t len = strlen( s ), suffixLen = strlen( suffix );
+	return len >= suffixLen && strcmp( s + len - suffixLen, suffix ) == 0;
+}
+
+// PPM files are read a row at a time, anything else has to be loaded whole
+std::unique_ptr<RowReader> openReader( const char* filename )
+{
+	if( endsWith( filename, ".ppm" ) )
+	{
+		std::unique_ptr<PPMReader> ppm( new PPMReader );
+		if( ppm->open( filename ) ) return ppm;
+	}
+	else
+	{
+		std::unique_ptr<WholeImageReader> whole( new WholeImageReader );
+		if( whole->open( filename ) ) return whole;
+	}
+	return nullptr;
+}
+
+// The kernels in kernels.h don't touch the image, so streaming them only
+// needs the current row and the kernel's rows of error
+template<typename K>
+bool streamKernel( RowReader& reader, RowWriter& writer, bool serpentine )
+{
+	int width = reader.width;
+	std::vector<u8> row( (size_t)width * 3 );
+	std::vector<u8> dithered( (size_t)width * 3 );
+	ErrorWindow<K> errors( width );
+
+	for( int y = 0; y < reader.height; y++ )
+	{
+		if( !reader.readRow( row.data() ) ) return false;
+
+		ditherRowKernel<K>( row.data(), dithered.data(), width, y,
+			rowDirection( y, serpentine ), rowDirection( y - 1, serpentine ),
+			errors.pointers, nullptr, closestRGB );
+
+		if( !writer.writeRow( dithered.data() ) ) return false;
+
+		errors.next();
+	}
+
+	return writer.finish();
+}
+
+// Dithers the image a row at a time, reading and writing as we go.
+//
+// Error only ever goes to the row below (or back up to the row above, which is
+// thrown away) so we only need three rows of the image in memory: the one
+// above, the one we're on and the one below. The other kernels use streamKernel().
+// The result is the same as dithering the whole image in one go.
+bool ditherStream( const char* inName, const char* outName, const Options& options )
+{
+	std::unique_ptr<RowReader> reader = openReader( inName );
+	if( !reader ) return false;
+	if( !endsWith( inName, ".ppm" ) )
+		printf( "%s isn't a .ppm, so it's loaded whole and only the output is streamed\n", inName );
+
+	int width = reader->width;
+	int height = reader->height;
+
+	std::unique_ptr<RowWriter> writer;
+	if( options.format == FORMAT_PPM || options.format == FORMAT_PAM || endsWith( outName, ".ppm" ) )
+	{
+		PPMWriter* ppm = new PPMWriter;
+		writer.reset( ppm );
+		if( !ppm->open( outName, width, height, options.format == FORMAT_PAM ) ) return false;
+	}
+	else if( options.format == FORMAT_INDEXED )
+	{
+		IndexedRowWriter* indexed = new IndexedRowWriter;
+		writer.reset( indexed );
+		if( !indexed->open( outName, width, height ) ) return false;
+	}
+	else
+	{
+		PNGStreamWriter* png = new PNGStreamWriter;
+		writer.reset( png );
+		if( !png->open( outName, width, height ) ) return false;
+	}
+
+	// Rows 0, 1 and 2 of the window are the rows above, on and below the current one
+	size_t rowBytes = (size_t)width * 3;
+	std::vector<u8> window( rowBytes * 3 );
+	std::vector<u8> dithered( rowBytes * 2 );
+
+	bool serpentine = options.serpentine;
+
+	if( options.ordered )
+	{
+		OrderedRows rows( orderedMap, orderedSpread(), width );
+		for( int y = 0; y < height; y++ )
+		{
+			if( !reader->readRow( &window[0] ) ) return false;
+			ditherRowOrdered( &window[0], &dithered[0], width, y, rows, closestRGB );
+			if( !writer->writeRow( &dithered[0] ) ) return false;
+		}
+		return writer->finish();
+	}
+
+	switch( options.kernel )
+	{
+	case KERNEL_LEGACY:
+		break;
+	case KERNEL_JARVIS:
+		return streamKernel<JarvisJudiceNinke>( *reader, *writer, serpentine );
+	case KERNEL_STUCKI:
+		return streamKernel<Stucki>( *reader, *writer, serpentine );
+	case KERNEL_ATKINSON:
+		return streamKernel<Atkinson>( *reader, *writer, serpentine );
+	case KERNEL_SIERRA:
+		return streamKernel<Sierra>( *reader, *writer, serpentine );
+	case KERNEL_FLOYD:
+		return streamKernel<FloydSteinberg>( *reader, *writer, serpentine );
+	}
+
+	if( !reader->readRow( &window[rowBytes] ) ) return false;
+	if( height > 1 && !reader->readRow( &window[rowBytes * 2] ) ) return false;
+
+	for( int y = 0; y < height; y++ )
+	{
+		// Pretend the image ends after the row below, or after this row if it's the last one
+		int windowHeight = (y == height - 1) ? 2 : 3;
+
+		ditherRow( window.data(), dithered.data(), width, windowHeight,
+			1, rowDirection( y, serpentine ), rowDirection( y - 1, serpentine ), nullptr );
+
+		if( !writer->writeRow( &dithered[rowBytes] ) ) return false;
+
+		// Slide the window down a row
+		memmove( &window[0], &window[rowBytes], rowBytes * 2 );
+		if( y + 2 < height && !reader->readRow( &window[rowBytes * 2] ) ) return false;
+	}
+
+	return writer->finish();
+}
+
+// What happened to one image, times are in milliseconds
+struct FileStats
+{
+	int width = 0;
+	int height = 0;
+	double decode = 0;
+	double dither = 0;
+	double encode = 0;
+	double streamed = 0;  // -stream does all three at once
+};
+
+double millisecondsSince( std::chrono::steady_clock::time_point start )
+{
+	return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Puts "dithered_" in front of the file name, but after any directories.
+// If a format was asked for the extension is swapped to match it.
+std::string outputName( const std::string& filename, OutputFormat format )
+{
+	size_t slash = filename.find_last_of( "/\\" );
+	size_t nameStart = slash == std::string::npos ? 0 : slash + 1;
+	std::string name = filename.substr( 0, nameStart ) + "dithered_" + filename.substr( nameStart );
+
+	if( format == FORMAT_DEFAULT )
+		return name;
+
+	size_t dot = name.find_last_of( '.' );
+	if( dot != std::string::npos && dot > nameStart )
+		name.erase( dot );
+
+	switch( format )
+	{
+	case FORMAT_PPM: return name + ".ppm";
+	case FORMAT_PAM: return name + ".pam";
+	default:         return name + ".png";
+	}
+}
+
+// Saves a dithered image in whatever format the options ask for
+bool writeImage( const char* filename, int width, int height, const u8* rgb, const Options& options )
+{
+	switch( options.format )
+	{
+	case FORMAT_PPM:
+	case FORMAT_PAM:
+		return writePNM( filename, width, height, rgb, options.format == FORMAT_PAM );
+
+	case FORMAT_INDEXED:
+	{
+		std::vector<u8> indices( (size_t)width * height );
+		toIndices( rgb, indices.data(), width * height );
+		return writePNG( filename, width, height, 1, indices.data(), palette.data(), (int)palette.size() / 3, options.level );
+	}
+
+	default:
+		return writePNG( filename, width, height, 3, rgb, nullptr, 0, options.level );
+	}
+}
+
+// Dithers a whole image that's already in memory
+void ditherPixels( u8* image, u8* dithered_image, int width, int height, const Options& options )
+{
+	int threads = options.threads;
+	bool serpentine = options.serpentine;
+
+	if( options.ordered )
+		ditherOrdered( image, dithered_image, width, height, threads );
+	else if( options.kernel != KERNEL_LEGACY )
+		ditherImage( image, dithered_image, width, height, options.kernel, serpentine, threads );
+	else if( threads > 1 )
+		ditherParallel( image, dithered_image, width, height, serpentine, threads );
+	else
+		ditherSerial( image, dithered_image, width, height, serpentine );
+}
+
+// Loads, dithers and saves one image
+bool ditherFile( const char* filename, const Options& options, FileStats& stats )
+{
+	std::string outName = outputName( filename, options.format );
+
+	if( options.stream )
+	{
+		auto start = std::chrono::steady_clock::now();
+		bool ok = ditherStream( filename, outName.c_str(), options );
+		stats.streamed = millisecondsSince( start );
+		return ok;
+	}
+
+	auto start = std::chrono::steady_clock::now();
 
 	int width, height, c;
 	u8* original_image = stbi_load( filename, &width, &height, &c, 3 );
-	u8* dithered_image = new u8[width * height * 3];
-
-	// This ditheing implementation snakes form left to right to hopefully spread
-	// the error around a bit more evenly
-	//
-	// dir indicates the current direction, positive is to the right
-	int dir = 1;
-	
-	for( int y = 0; y < height; y++ )
+	if( !original_image )
+		return false;
+	u8* dithered_image = new u8[(size_t)width * height * 3];
+
+	stats.width = width;
+	stats.height = height;
+	stats.decode = millisecondsSince( start );
+	start = std::chrono::steady_clock::now();
+
+	ditherPixels( original_image, dithered_image, width, height, options );
+
+	stats.dither = millisecondsSince( start );
+	start = std::chrono::steady_clock::now();
+
+	bool ok = writeImage( outName.c_str(), width, height, dithered_image, options );
+
+	stats.encode = millisecondsSince( start );
+
+	delete[] dithered_image;
+	stbi_image_free(original_image);
+
+	return ok;
+}
+
+// Adds every image stb_image can read in a directory, skipping ones we've already dithered
+void addDirectory( const std::string& dir, std::vector<std::string>& files )
+{
+	DIR* d = opendir( dir.c_str() );
+	if( !d ) return;
+
+	std::vector<std::string> found;
+	while( dirent* entry = readdir( d ) )
+	{
+		std::string name = entry->d_name;
+		if( name[0] == '.' || name.compare( 0, 9, "dithered_" ) == 0 )
+			continue;
+
+		std::string path = dir + "/" + name;
+		int w, h, c;
+		if( stbi_info( path.c_str(), &w, &h, &c ) )
+			found.push_back( path );
+	}
+	closedir( d );
+
+	std::sort( found.begin(), found.end() );
+	files.insert( files.end(), found.begin(), found.end() );
+}
+
+bool isDirectory( const char* path )
+{
+	struct stat info;
+	return stat( path, &info ) == 0 && S_ISDIR( info.st_mode );
+}
+
+// Dithers lots of images at once, each worker takes the next image and does
+// the whole thing (decode, dither, encode) on its own. That keeps every core
+// busy without the images having to wait on each other.
+int ditherBatch( const std::vector<std::string>& files, const Options& options, int workers )
+{
+	// Each image is already on its own thread
+	Options single = options;
+	single.threads = 1;
+
+	std::mutex statsMutex;
+	FileStats total;
+	double pixels = 0;
+	int failed = 0;
+
+	auto start = std::chrono::steady_clock::now();
+
+	parallelFor( (int)files.size(), workers, [&]( int i )
+	{
+		FileStats stats;
+		bool ok = ditherFile( files[i].c_str(), single, stats );
+
+		std::lock_guard<std::mutex> lock( statsMutex );
+		if( !ok )
+		{
+			printf( "could not dither %s\n", files[i].c_str() );
+			failed++;
+			return;
+		}
+		total.decode += stats.decode;
+		total.dither += stats.dither;
+		total.encode += stats.encode;
+		total.streamed += stats.streamed;
+		pixels += (double)stats.width * stats.height;
+	});
+
+	double seconds = millisecondsSince( start ) / 1000.0;
+	int done = (int)files.size() - failed;
+
+	printf( "dithered %d of %d images in %.2f s using %d worker%s\n", done, (int)files.size(),
+		seconds, workers, workers == 1 ? "" : "s" );
+
+	// Stage times are added up over every worker, so they can add up to more than the wall time
+	if( done > 0 )
+	{
+		if( options.stream )
+		{
+			printf( "  stream  %10.1f ms total %8.2f ms per image\n", total.streamed, total.streamed / done );
+		}
+		else
+		{
+			printf( "  decode  %10.1f ms total %8.2f ms per image\n", total.decode, total.decode / done );
+			printf( "  dither  %10.1f ms total %8.2f ms per image\n", total.dither, total.dither / done );
+			printf( "  encode  %10.1f ms total %8.2f ms per image\n", total.encode, total.encode / done );
+			printf( "  %.2f megapixels per second\n", pixels / 1e6 / seconds );
+		}
+		printf( "  %.2f images per second\n", done / seconds );
+	}
+
+	return failed == 0 ? 0 : 1;
+}
+
+// How many times -bench does each step, the fastest time is the one shown
+const int BENCH_RUNS = 3;
+
+long long fileSize( const char* path )
+{
+	struct stat info;
+	return stat( path, &info ) == 0 ? (long long)info.st_size : -1;
+}
+
+// Times decoding, dithering and then saving each image in every output format,
+// to see where the time goes and what each format costs in time and space
+int benchmarkFormats( const std::vector<std::string>& files, const Options& options )
+{
+	struct Format
+	{
+		const char* name;
+		OutputFormat format;
+		int level;
+	};
+
+	std::vector<Format> formats;
+	formats.push_back( { "ppm", FORMAT_PPM, 0 } );
+	formats.push_back( { "pam", FORMAT_PAM, 0 } );
+	for( int level : { 0, 1, PNG_DEFAULT_LEVEL, 9 } )
+		formats.push_back( { "png", FORMAT_PNG, level } );
+	if( (int)palette.size() / 3 <= MAX_INDEXED_COLOURS )
+		for( int level : { 0, 1, PNG_DEFAULT_LEVEL, 9 } )
+			formats.push_back( { "indexed", FORMAT_INDEXED, level } );
+
+	auto fastest = [&]( std::function<void()> step )
 	{
-		// A little ugly, x will either increase or decrease
-		// depending on what direction we are currently going in
-		for( int x = (dir > 0 ? 0 : width - 1);
-			x != (dir > 0 ? width : -1);
-			x += dir )
+		double best = -1;
+		for( int run = 0; run < BENCH_RUNS; run++ )
 		{
-			Colour original = getColour( original_image, width, x, y );
+			auto start = std::chrono::steady_clock::now();
+			step();
+			double ms = millisecondsSince( start );
+			if( best < 0 || ms < best ) best = ms;
+		}
+		return best;
+	};
 
-			// Get the closset colour form the palette (defined at the top of the file)
-			Colour closest  = getClosest( original );
+	for( const std::string& file : files )
+	{
+		int width = 0, height = 0, c;
+		u8* image = nullptr;
+		double decode = fastest( [&]()
+		{
+			if( image ) stbi_image_free( image );
+			image = stbi_load( file.c_str(), &width, &height, &c, 3 );
+		});
+		if( !image )
+		{
+			printf( "could not load %s\n", file.c_str() );
+			return 1;
+		}
 
+		// The original kernel adds the error back into the image, so each run starts from a fresh copy
+		size_t bytes = (size_t)width * height * 3;
+		std::vector<u8> original( image, image + bytes );
+		std::vector<u8> dithered( bytes );
+		stbi_image_free( image );
 
-			setColour( dithered_image, width, x, y, closest );
+		std::vector<u8> working( bytes );
+		double dither = -1;
+		for( int run = 0; run < BENCH_RUNS; run++ )
+		{
+			working = original;
+			auto start = std::chrono::steady_clock::now();
+			ditherPixels( working.data(), dithered.data(), width, height, options );
+			double ms = millisecondsSince( start );
+			if( dither < 0 || ms < dither ) dither = ms;
+		}
 
-			// Take the error and distribute it over nearby pixels
-			// This pattern was just copied from wikipedia, there may be other patterns that
-			// produce different effects.
-			// https://en.wikipedia.org/wiki/Floyd–Steinberg_dithering
+		printf( "%s, %dx%d, fastest of %d runs\n", file.c_str(), width, height, BENCH_RUNS );
+		printf( "  decode  %8.1f ms\n", decode );
+		printf( "  dither  %8.1f ms\n", dither );
 
-			Colour error = original - closest;
+		for( const Format& f : formats )
+		{
+			Options o = options;
+			o.format = f.format;
+			o.level = f.level;
+			std::string outName = outputName( file, f.format );
 
-			// Also, before we write to the image we check the pixel is actually in range
-			// and we aren't writing off the edge or something
-			if( inRange(x + dir, 0, width - 1) )
+			bool ok = true;
+			double encode = fastest( [&]() { ok = writeImage( outName.c_str(), width, height, dithered.data(), o ) && ok; } );
+			if( !ok )
 			{
-				addColour( original_image, width, x + dir, y, error * (7.0f/16.0f) );
+				printf( "could not write %s\n", outName.c_str() );
+				return 1;
 			}
 
-			if( inRange(x + dir, 0, width - 1)
-				&& y < height - 1 )
+			char label[32];
+			if( f.format == FORMAT_PNG || f.format == FORMAT_INDEXED )
+				snprintf( label, sizeof(label), "%s %d", f.name, f.level );
+			else
+				snprintf( label, sizeof(label), "%s", f.name );
+
+			printf( "  %-10s %8.1f ms %10.1f KB\n", label, encode, fileSize( outName.c_str() ) / 1024.0 );
+		}
+	}
+
+	return 0;
+}
+
+// How to make a palette from the images, instead of using the default or -palette
+enum Quantize
+{
+	QUANTIZE_NONE,
+	QUANTIZE_MEDIAN,  // median cut
+	QUANTIZE_KMEANS   // median cut, then refined with k-means
+};
+
+// Rows read from an image at a time while building the histogram
+const int HISTOGRAM_STRIP_ROWS = 256;
+
+// Replaces the palette with `count` colours picked from all of the images together,
+// so a batch of images shares one palette
+bool generatePalette( const std::vector<std::string>& files, Quantize method, int count, int threads )
+{
+	auto start = std::chrono::steady_clock::now();
+
+	ColourHistogram histogram;
+	for( const std::string& file : files )
+	{
+		std::unique_ptr<RowReader> reader = openReader( file.c_str() );
+		if( !reader )
+		{
+			printf( "could not load %s\n", file.c_str() );
+			return false;
+		}
+
+		size_t rowBytes = (size_t)reader->width * 3;
+		std::vector<u8> strip( rowBytes * std::min( reader->height, HISTOGRAM_STRIP_ROWS ) );
+		for( int y = 0; y < reader->height; y += HISTOGRAM_STRIP_ROWS )
+		{
+			int rows = std::min( reader->height - y, HISTOGRAM_STRIP_ROWS );
+			for( int i = 0; i < rows; i++ )
+				if( !reader->readRow( &strip[rowBytes * i] ) ) return false;
+			histogram.add( strip.data(), (size_t)reader->width * rows, threads );
+		}
+	}
+
+	double histogramTime = millisecondsSince( start );
+	start = std::chrono::steady_clock::now();
+
+	std::vector<WeightedColour> colours = histogram.colours();
+	std::vector<u8> generated = medianCut( colours, count );
+	if( method == QUANTIZE_KMEANS )
+		generated = kMeans( colours, generated, threads );
+
+	if( generated.empty() ) return false;
+	palette = generated;
+
+	printf( "made a palette of %d colours (from %d) in %.1f ms histogram + %.1f ms %s\n",
+		(int)palette.size() / 3, (int)colours.size(), histogramTime, millisecondsSince( start ),
+		method == QUANTIZE_KMEANS ? "k-means" : "median cut" );
+	return true;
+}
+
+void printUsage( const char* program )
+{
+	printf( "usage: %s [-j threads] [-raster] [-palette file] [-search name] [-perceptual] [-stream] [-kernel name] [-ordered map] [-quantize method] [-colours n] [-format name] [-level n] [-bench] [image or directory ...]\n", program );
+	printf( "  -j threads   dither using this many threads, 0 uses every core (default 1)\n" );
+	printf( "               with more than one image, each thread works on its own image\n" );
+	printf( "  -raster      every row goes left to right instead of snaking back and forth\n" );
+	printf( "  -palette     text file of colours to dither with, one \"r g b\" per line\n" );
+	printf( "  -search      how to find the closest palette colour: auto (default), lut, simd, scalar or brute\n" );
+	printf( "  -perceptual  pick the colour that looks closest (in OKLab) rather than the closest rgb,\n" );
+	printf( "               with its own lookup table (or brute force with -search brute)\n" );
+	printf( "  -stream      read, dither and write a row at a time, the output is an uncompressed png\n" );
+	printf( "               (or ppm if the name ends in .ppm). Only .ppm input is read a row at a time,\n" );
+	printf( "               anything else is still loaded whole first\n" );
+	printf( "  -kernel      legacy: the original version, error is added back into the image (default)\n" );
+	printf( "               floyd, jarvis, stucki, atkinson or sierra: exact fixed point error buffers\n" );
+	printf( "  -ordered     ordered dithering instead, fast but rougher: bayer2, bayer4, bayer8 or bluenoise\n" );
+	printf( "  -quantize    make the palette from the images: median (median cut) or kmeans\n" );
+	printf( "  -colours     how many colours -quantize makes (default %d)\n", DEFAULT_QUANTIZE_COLOURS );
+	printf( "  -format      save as png, indexed (png with a palette, up to 256 colours), ppm or pam,\n" );
+	printf( "               the extension of the output changes to match (default png, same name)\n" );
+	printf( "  -level       how hard to compress a png, 0 (not at all) to 9 (default %d)\n", PNG_DEFAULT_LEVEL );
+	printf( "  -bench       time decoding, dithering and saving in every format (snow.jpg and adrian.jpg by default)\n" );
+}
+
+int main( int argc, char* argv[] )
+{
+	Options options;
+	std::vector<std::string> files;
+	bool batch = false;
+	bool bench = false;
+	Quantize quantize = QUANTIZE_NONE;
+	int quantizeColours = DEFAULT_QUANTIZE_COLOURS;
+
+	for( int i = 1; i < argc; i++ )
+	{
+		if( strcmp( argv[i], "-j" ) == 0 && i + 1 < argc )
+		{
+			options.threads = atoi( argv[++i] );
+			if( options.threads <= 0 )
+				options.threads = std::max( 1u, std::thread::hardware_concurrency() );
+		}
+		else if( strcmp( argv[i], "-raster" ) == 0 )
+		{
+			options.serpentine = false;
+		}
+		else if( strcmp( argv[i], "-palette" ) == 0 && i + 1 < argc )
+		{
+			if( !loadPalette( argv[++i] ) )
 			{
-				addColour( original_image, width, x - dir, y + dir, error * (3.0f/16.0f) );
+				printf( "could not load palette %s\n", argv[i] );
+				return 1;
 			}
-
-			if( inRange(y, 0, height - 1) )
+		}
+		else if( strcmp( argv[i], "-search" ) == 0 && i + 1 < argc )
+		{
+			i++;
+			if( strcmp( argv[i], "auto" ) == 0 )
+				search = SEARCH_AUTO;
+			else if( strcmp( argv[i], "lut" ) == 0 )
+				search = SEARCH_LUT;
+			else if( strcmp( argv[i], "simd" ) == 0 )
+				search = SEARCH_SIMD;
+			else if( strcmp( argv[i], "scalar" ) == 0 )
+				search = SEARCH_SCALAR;
+			else if( strcmp( argv[i], "brute" ) == 0 )
+				search = SEARCH_BRUTE;
+			else
 			{
-				addColour( original_image, width, x      , y + dir, error * (5.0f/16.0f) );
+				printUsage( argv[0] );
+				return 1;
 			}
-
-			if( inRange(x + dir, 0, width - 1)
-				&& y < height - 1)
+		}
+		else if( strcmp( argv[i], "-perceptual" ) == 0 )
+		{
+			perceptual = true;
+		}
+		else if( strcmp( argv[i], "-stream" ) == 0 )
+		{
+			options.stream = true;
+		}
+		else if( strcmp( argv[i], "-kernel" ) == 0 && i + 1 < argc )
+		{
+			i++;
+			if( strcmp( argv[i], "legacy" ) == 0 )
+				options.kernel = KERNEL_LEGACY;
+			else if( strcmp( argv[i], "floyd" ) == 0 )
+				options.kernel = KERNEL_FLOYD;
+			else if( strcmp( argv[i], "jarvis" ) == 0 )
+				options.kernel = KERNEL_JARVIS;
+			else if( strcmp( argv[i], "stucki" ) == 0 )
+				options.kernel = KERNEL_STUCKI;
+			else if( strcmp( argv[i], "atkinson" ) == 0 )
+				options.kernel = KERNEL_ATKINSON;
+			else if( strcmp( argv[i], "sierra" ) == 0 )
+				options.kernel = KERNEL_SIERRA;
+			else
 			{
-				addColour( original_image, width, x + dir, y + dir, error * (1.0f/16.0f) );
+				printUsage( argv[0] );
+				return 1;
 			}
 		}
+		else if( strcmp( argv[i], "-ordered" ) == 0 && i + 1 < argc )
+		{
+			i++;
+			options.ordered = true;
+			if( strcmp( argv[i], "bayer2" ) == 0 )
+				orderedMap = bayerMap( 2 );
+			else if( strcmp( argv[i], "bayer4" ) == 0 )
+				orderedMap = bayerMap( 4 );
+			else if( strcmp( argv[i], "bayer8" ) == 0 )
+				orderedMap = bayerMap( 8 );
+			else if( strcmp( argv[i], "bluenoise" ) == 0 )
+				orderedMap = blueNoiseMap( 64 );
+			else
+			{
+				printUsage( argv[0] );
+				return 1;
+			}
+		}
+		else if( strcmp( argv[i], "-quantize" ) == 0 && i + 1 < argc )
+		{
+			i++;
+			if( strcmp( argv[i], "median" ) == 0 )
+				quantize = QUANTIZE_MEDIAN;
+			else if( strcmp( argv[i], "kmeans" ) == 0 )
+				quantize = QUANTIZE_KMEANS;
+			else
+			{
+				printUsage( argv[0] );
+				return 1;
+			}
+		}
+		else if( strcmp( argv[i], "-colours" ) == 0 && i + 1 < argc )
+		{
+			quantizeColours = clamp( atoi( argv[++i] ), 1, 65536 );
+		}
+		else if( strcmp( argv[i], "-format" ) == 0 && i + 1 < argc )
+		{
+			i++;
+			if( strcmp( argv[i], "png" ) == 0 )
+				options.format = FORMAT_PNG;
+			else if( strcmp( argv[i], "indexed" ) == 0 )
+				options.format = FORMAT_INDEXED;
+			else if( strcmp( argv[i], "ppm" ) == 0 )
+				options.format = FORMAT_PPM;
+			else if( strcmp( argv[i], "pam" ) == 0 )
+				options.format = FORMAT_PAM;
+			else
+			{
+				printUsage( argv[0] );
+				return 1;
+			}
+		}
+		else if( strcmp( argv[i], "-level" ) == 0 && i + 1 < argc )
+		{
+			options.level = clamp( atoi( argv[++i] ), 0, 9 );
+		}
+		else if( strcmp( argv[i], "-bench" ) == 0 )
+		{
+			bench = true;
+		}
+		else if( argv[i][0] == '-' )
+		{
+			printUsage( argv[0] );
+			return 1;
+		}
+		else if( isDirectory( argv[i] ) )
+		{
+			addDirectory( argv[i], files );
+			batch = true;
+		}
+		else
+		{
+			files.push_back( argv[i] );
+		}
+	}
 
-		// Switch direction
-		dir *= -1;
+	// The perceptual lookup table does its own search, only brute force has a version of it
+	if( perceptual && (search == SEARCH_SIMD || search == SEARCH_SCALAR) )
+	{
+		printf( "-perceptual can't be used with -search simd or scalar, use auto, lut or brute\n" );
+		return 1;
 	}
 
-	const char* prefix = "dithered_";
-	int size = (argc > 1 ? strlen(argv[1]) : 0) + strlen(prefix);
-	char outName[size];
-	sprintf( outName, "%s%s", prefix, filename );
+	// Use snow.jpg by default, -bench does adrian.jpg too
+	if( files.empty() && !batch )
+	{
+		files.push_back( "snow.jpg" );
+		if( bench )
+			files.push_back( "adrian.jpg" );
+	}
 
-	stbi_write_png( outName, width, height, 3, dithered_image, width * 3 );
+	if( quantize != QUANTIZE_NONE && !generatePalette( files, quantize, quantizeColours, options.threads ) )
+		return 1;
 
-	delete[] dithered_image;
-	stbi_image_free(original_image);
+	if( options.format == FORMAT_INDEXED && (int)palette.size() / 3 > MAX_INDEXED_COLOURS )
+	{
+		printf( "an indexed png can't have more than %d colours\n", MAX_INDEXED_COLOURS );
+		return 1;
+	}
+
+	prepareSearch();
+
+	if( bench )
+		return benchmarkFormats( files, options );
+
+	if( batch || files.size() > 1 )
+		return ditherBatch( files, options, options.threads );
+
+	const char* filename = files[0].c_str();
+
+	FileStats stats;
+	if( !ditherFile( filename, options, stats ) )
+	{
+		printf( "could not dither %s: %s\n", filename, stbi_failure_reason() );
+		return 1;
+	}
+
+	if( options.stream )
+	{
+		printf( "streamed %s in %.1f ms\n", filename, stats.streamed );
+	}
+	else
+	{
+		printf( "dithered %dx%d in %.1f ms using %d thread%s\n", stats.width, stats.height,
+			stats.dither, options.threads, options.threads == 1 ? "" : "s" );
+	}
 
 	return 0;
-}
\ No newline at end of file
+}
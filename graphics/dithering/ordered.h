@@ -0,0 +1,229 @@
+#pragma once
+
+// Ordered dithering.
+//
+// Instead of pushing error onto the neighbours, every pixel gets nudged up or down
+// by a value from a small tiled "threshold map" before picking the closest colour.
+// No pixel depends on any other, so rows can be done 16 bytes at a time with SIMD
+// and chunks of the image on as many threads as we like. It doesn't look as good
+// as error diffusion, but it's very fast, which is great for previews and thumbnails.
+//
+// Two kinds of map:
+// - Bayer, the classic recursive pattern, tiny and regular (you can see the crosshatch)
+// - blue noise, made with Ulichney's void-and-cluster method. Looks random but
+//   has no clumps, so it's much less noticeable.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef unsigned char u8;
+
+// size x size thresholds, each value from 0 to size * size - 1 appears once
+struct ThresholdMap
+{
+	int size = 0;
+	std::vector<int> values;
+};
+
+// size must be a power of two
+inline ThresholdMap bayerMap( int size )
+{
+	ThresholdMap map;
+	map.size = 1;
+	map.values.assign( 1, 0 );
+
+	// Each step the map doubles in size, the new map is 4 copies of the old one
+	// with 0, 2, 3 and 1 added in the corners:
+	//   4*M + 0   4*M + 2
+	//   4*M + 3   4*M + 1
+	while( map.size < size )
+	{
+		int n = map.size;
+		std::vector<int> next( n * 2 * n * 2 );
+		for( int y = 0; y < n; y++ )
+		for( int x = 0; x < n; x++ )
+		{
+			int v = map.values[y * n + x] * 4;
+			next[ y      * n * 2 + x    ] = v;
+			next[ y      * n * 2 + x + n] = v + 2;
+			next[(y + n) * n * 2 + x    ] = v + 3;
+			next[(y + n) * n * 2 + x + n] = v + 1;
+		}
+		map.size = n * 2;
+		map.values.swap( next );
+	}
+
+	return map;
+}
+
+// Void-and-cluster. Every pixel has an "energy", how crowded it is by the pixels
+// that are switched on nearby (a gaussian, wrapping around the edges so the map tiles).
+// The tightest cluster is the "on" pixel with the most energy, the largest void
+// is the "off" pixel with the least.
+inline ThresholdMap blueNoiseMap( int size, float sigma = 1.5f )
+{
+	int n = size * size;
+
+	// Energy a pixel at (0, 0) adds to each pixel, with wrap around
+	std::vector<float> gaussian( n );
+	for( int y = 0; y < size; y++ )
+	for( int x = 0; x < size; x++ )
+	{
+		int dx = std::min( x, size - x );
+		int dy = std::min( y, size - y );
+		gaussian[y * size + x] = std::exp( -(dx * dx + dy * dy) / (2 * sigma * sigma) );
+	}
+
+	std::vector<u8> on( n, 0 );
+	std::vector<float> energy( n, 0 );
+
+	auto toggle = [&]( int p )
+	{
+		on[p] = !on[p];
+		float sign = on[p] ? 1.0f : -1.0f;
+		int px = p % size, py = p / size;
+		for( int y = 0; y < size; y++ )
+		for( int x = 0; x < size; x++ )
+		{
+			int dx = (x - px + size) % size;
+			int dy = (y - py + size) % size;
+			energy[y * size + x] += sign * gaussian[dy * size + dx];
+		}
+	};
+
+	auto tightestCluster = [&]()
+	{
+		int best = -1;
+		for( int p = 0; p < n; p++ )
+			if( on[p] && (best < 0 || energy[p] > energy[best]) ) best = p;
+		return best;
+	};
+
+	auto largestVoid = [&]()
+	{
+		int best = -1;
+		for( int p = 0; p < n; p++ )
+			if( !on[p] && (best < 0 || energy[p] < energy[best]) ) best = p;
+		return best;
+	};
+
+	// Start with 10% of pixels on at random (a fixed seed, so the map is always the same)
+	unsigned int seed = 12345;
+	int ones = std::max( 1, n / 10 );
+	for( int placed = 0; placed < ones; )
+	{
+		seed = seed * 1664525u + 1013904223u;
+		int p = (seed >> 8) % n;
+		if( !on[p] ) { toggle( p ); placed++; }
+	}
+
+	// Move pixels from the tightest cluster to the largest void until it settles
+	for( int i = 0; i < n; i++ )
+	{
+		int cluster = tightestCluster();
+		toggle( cluster );
+		int hole = largestVoid();
+		toggle( hole );
+		if( hole == cluster ) break;
+	}
+
+	ThresholdMap map;
+	map.size = size;
+	map.values.assign( n, 0 );
+
+	// Rank the starting pixels by taking away the tightest cluster each time
+	std::vector<u8> start = on;
+	std::vector<float> startEnergy = energy;
+	for( int rank = ones - 1; rank >= 0; rank-- )
+	{
+		int p = tightestCluster();
+		toggle( p );
+		map.values[p] = rank;
+	}
+
+	// Then rank everything else by filling the largest void each time
+	on = start;
+	energy = startEnergy;
+	for( int rank = ones; rank < n; rank++ )
+	{
+		int p = largestVoid();
+		toggle( p );
+		map.values[p] = rank;
+	}
+
+	return map;
+}
+
+// The threshold map turned into offsets to add to each byte of a row,
+// one row of offsets per row of the map, already tiled out to the image width.
+class OrderedRows
+{
+public:
+	// spread is how far apart the palette colours are, roughly
+	OrderedRows( const ThresholdMap& map, int spread, int width ) :
+		size( map.size ), rowBytes( width * 3 ), offsets( map.size * width * 3 )
+	{
+		int n = size * size;
+		for( int y = 0; y < size; y++ )
+		for( int x = 0; x < width; x++ )
+		{
+			// From -spread/2 to +spread/2
+			int t = map.values[y * size + x % size];
+			short offset = (short)std::lround( ((t + 0.5f) / n - 0.5f) * spread );
+			for( int c = 0; c < 3; c++ )
+				offsets[(size_t)y * rowBytes + x * 3 + c] = offset;
+		}
+	}
+
+	// out = src + offset, kept between 0 and 255
+	void apply( const u8* src, u8* out, int y ) const
+	{
+		const short* offset = &offsets[(size_t)(y % size) * rowBytes];
+		int i = 0;
+
+#ifdef __SSE2__
+		// 16 bytes at a time: widen to 16 bits, add, and pack back down,
+		// which clamps to 0..255 for free
+		const __m128i zero = _mm_setzero_si128();
+		for( ; i + 16 <= rowBytes; i += 16 )
+		{
+			__m128i bytes = _mm_loadu_si128( (const __m128i*)(src + i) );
+			__m128i lo = _mm_add_epi16( _mm_unpacklo_epi8( bytes, zero ), _mm_loadu_si128( (const __m128i*)(offset + i) ) );
+			__m128i hi = _mm_add_epi16( _mm_unpackhi_epi8( bytes, zero ), _mm_loadu_si128( (const __m128i*)(offset + i + 8) ) );
+			_mm_storeu_si128( (__m128i*)(out + i), _mm_packus_epi16( lo, hi ) );
+		}
+#endif
+
+		for( ; i < rowBytes; i++ )
+		{
+			int v = src[i] + offset[i];
+			out[i] = v < 0 ? 0 : (v > 255 ? 255 : v);
+		}
+	}
+
+private:
+	int size;
+	int rowBytes;
+	std::vector<short> offsets;
+};
+
+// Dithers one row. closest( r, g, b ) returns a pointer to the rgb of the closest palette colour.
+template<typename Closest>
+void ditherRowOrdered( const u8* src, u8* dst, int width, int y, const OrderedRows& rows, Closest closest )
+{
+	// Nudge the whole row first (in dst, it gets overwritten as we go)
+	rows.apply( src, dst, y );
+
+	for( int x = 0; x < width * 3; x += 3 )
+	{
+		const u8* c = closest( dst[x], dst[x + 1], dst[x + 2] );
+		dst[x    ] = c[0];
+		dst[x + 1] = c[1];
+		dst[x + 2] = c[2];
+	}
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+// Finding the closest palette colour to a pixel, fast.
+//
+// Checking every palette colour for every pixel is fine for 8 colours but gets
+// slow with 256 of them. Instead we chop the RGB cube into small boxes up front,
+// and for each box work out which palette colours could possibly be the closest
+// to *something* inside it. Usually that's only one or two, so looking up a
+// pixel is just finding its box and checking a handful of colours.
+//
+// The answers are exactly the same as the brute force search, ties included
+// (the first colour in the palette wins).
+//
+// For really big palettes building the table takes too long, so there's also
+// PaletteSearch at the bottom which is still brute force, but checks 4 or 8
+// colours at a time with SSE or AVX2.
+
+#include <algorithm>
+#include <vector>
+
+// The SIMD search needs gcc or clang on x86, anything else just gets the plain loop
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PALETTE_X86
+#include <immintrin.h>
+#endif
+
+typedef unsigned char u8;
+
+class PaletteLUT
+{
+public:
+	// Each channel is split into 2^CELL_BITS ranges, so with 5 bits each box
+	// is 8x8x8 colours and there are 32x32x32 boxes
+	static const int CELL_BITS = 5;
+	static const int CELLS = 1 << CELL_BITS;
+	static const int CELL_SIZE = 256 / CELLS;
+
+	PaletteLUT() {}
+
+	// palette is `count` rgb triples
+	PaletteLUT( const u8* palette, int count ) : palette( palette, palette + count * 3 )
+	{
+		offsets.reserve( CELLS * CELLS * CELLS + 1 );
+
+		std::vector<int> nearest( count ), farthest( count );
+
+		for( int r = 0; r < CELLS; r++ )
+		for( int g = 0; g < CELLS; g++ )
+		for( int b = 0; b < CELLS; b++ )
+		{
+			offsets.push_back( (int)candidates.size() );
+
+			int lo[3] = { r * CELL_SIZE, g * CELL_SIZE, b * CELL_SIZE };
+			int hi[3] = { lo[0] + CELL_SIZE - 1, lo[1] + CELL_SIZE - 1, lo[2] + CELL_SIZE - 1 };
+
+			// For each colour, how close and how far can it be from anything in the box
+			int bestFarthest = -1;
+			for( int i = 0; i < count; i++ )
+			{
+				nearest[i] = 0;
+				farthest[i] = 0;
+				for( int c = 0; c < 3; c++ )
+				{
+					int p = palette[i * 3 + c];
+					int closeDist = p < lo[c] ? lo[c] - p : (p > hi[c] ? p - hi[c] : 0);
+					int farDist = std::max( p - lo[c], hi[c] - p );
+					nearest[i] += closeDist * closeDist;
+					farthest[i] += farDist * farDist;
+				}
+				if( bestFarthest < 0 || farthest[i] < bestFarthest )
+					bestFarthest = farthest[i];
+			}
+
+			// Everything in the box is within bestFarthest of some colour, so a colour
+			// that can't get that close can never win. Keep the rest in palette order
+			// so ties still go to the first one.
+			for( int i = 0; i < count; i++ )
+			{
+				if( nearest[i] <= bestFarthest )
+					candidates.push_back( (unsigned short)i );
+			}
+		}
+
+		offsets.push_back( (int)candidates.size() );
+	}
+
+	// Index of the closest palette colour
+	int closest( u8 r, u8 g, u8 b ) const
+	{
+		int cell = ((r / CELL_SIZE) * CELLS + (g / CELL_SIZE)) * CELLS + (b / CELL_SIZE);
+
+		int begin = offsets[cell];
+		int end = offsets[cell + 1];
+
+		if( end - begin == 1 )
+			return candidates[begin];
+
+		int result = candidates[begin];
+		int closest = -1;
+		for( int i = begin; i < end; i++ )
+		{
+			const u8* p = &palette[candidates[i] * 3];
+			int dist_r = r - p[0];
+			int dist_g = g - p[1];
+			int dist_b = b - p[2];
+
+			int dist_squared = dist_r * dist_r + dist_g * dist_g + dist_b * dist_b;
+			if( closest < 0 || dist_squared < closest )
+			{
+				result = candidates[i];
+				closest = dist_squared;
+			}
+		}
+		return result;
+	}
+
+	// Average number of colours left to check per box, handy to see how well it's working
+	float averageCandidates() const
+	{
+		return candidates.size() / float(offsets.size() - 1);
+	}
+
+private:
+	std::vector<u8> palette;
+	std::vector<int> offsets;
+	std::vector<unsigned short> candidates;
+};
+
+// Checks every palette colour, several at a time.
+//
+// The palette is stored as separate arrays of r, g and b (rather than rgb triples)
+// so a single instruction can load the same channel for 8 colours. It's padded
+// out to a multiple of 8 with colours so far away they can never win.
+//
+// Which version runs is picked when it's built, based on what the CPU supports,
+// so the same program still works on machines without AVX2.
+class PaletteSearch
+{
+public:
+	PaletteSearch() {}
+
+	PaletteSearch( const u8* palette, int count ) : count( count )
+	{
+		int padded = (count + 7) / 8 * 8;
+		r.assign( padded, 1e6f );
+		g.assign( padded, 1e6f );
+		b.assign( padded, 1e6f );
+
+		for( int i = 0; i < count; i++ )
+		{
+			r[i] = palette[i * 3];
+			g[i] = palette[i * 3 + 1];
+			b[i] = palette[i * 3 + 2];
+		}
+
+		search = &PaletteSearch::closestScalar;
+		name = "scalar";
+
+#ifdef PALETTE_X86
+		__builtin_cpu_init();
+		if( __builtin_cpu_supports( "avx2" ) )
+		{
+			search = &PaletteSearch::closestAVX2;
+			name = "avx2";
+		}
+		else if( __builtin_cpu_supports( "sse2" ) )
+		{
+			search = &PaletteSearch::closestSSE2;
+			name = "sse2";
+		}
+#endif
+	}
+
+	// Index of the closest palette colour
+	int closest( int red, int green, int blue ) const
+	{
+		return (this->*search)( red, green, blue );
+	}
+
+	// Which version got picked
+	const char* instructionSet() const { return name; }
+
+	// Use the plain loop no matter what the CPU supports, to compare
+	void forceScalar()
+	{
+		search = &PaletteSearch::closestScalar;
+		name = "scalar";
+	}
+
+private:
+	int closestScalar( int red, int green, int blue ) const
+	{
+		int result = 0;
+		float closest = -1;
+		for( int i = 0; i < count; i++ )
+		{
+			float dist_r = red - r[i];
+			float dist_g = green - g[i];
+			float dist_b = blue - b[i];
+
+			float dist_squared = dist_r * dist_r + dist_g * dist_g + dist_b * dist_b;
+			if( closest < 0 || dist_squared < closest )
+			{
+				result = i;
+				closest = dist_squared;
+			}
+		}
+		return result;
+	}
+
+	// Every lane keeps the best colour it has seen. Each lane sees its colours in
+	// palette order and only takes strictly closer ones, so at the end the lowest
+	// index among the lanes with the smallest distance is the same answer the
+	// plain loop gives. Distances are whole numbers below 2^24 so floats are exact.
+	static int bestOfLanes( const float* dist, const int* index, int lanes )
+	{
+		int best = 0;
+		for( int i = 1; i < lanes; i++ )
+		{
+			if( dist[i] < dist[best] || (dist[i] == dist[best] && index[i] < index[best]) )
+				best = i;
+		}
+		return index[best];
+	}
+
+#ifdef PALETTE_X86
+	__attribute__((target("sse2")))
+	int closestSSE2( int red, int green, int blue ) const
+	{
+		__m128 pr = _mm_set1_ps( (float)red );
+		__m128 pg = _mm_set1_ps( (float)green );
+		__m128 pb = _mm_set1_ps( (float)blue );
+
+		__m128 bestDist = _mm_set1_ps( 1e30f );
+		__m128i bestIndex = _mm_setzero_si128();
+		__m128i index = _mm_setr_epi32( 0, 1, 2, 3 );
+		const __m128i step = _mm_set1_epi32( 4 );
+
+		for( size_t i = 0; i < r.size(); i += 4 )
+		{
+			__m128 dr = _mm_sub_ps( _mm_loadu_ps( &r[i] ), pr );
+			__m128 dg = _mm_sub_ps( _mm_loadu_ps( &g[i] ), pg );
+			__m128 db = _mm_sub_ps( _mm_loadu_ps( &b[i] ), pb );
+			__m128 dist = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dr, dr ), _mm_mul_ps( dg, dg ) ), _mm_mul_ps( db, db ) );
+
+			// No blend instruction in SSE2, so pick with and / andnot / or
+			__m128 closer = _mm_cmplt_ps( dist, bestDist );
+			__m128i closerInt = _mm_castps_si128( closer );
+			bestDist = _mm_or_ps( _mm_and_ps( closer, dist ), _mm_andnot_ps( closer, bestDist ) );
+			bestIndex = _mm_or_si128( _mm_and_si128( closerInt, index ), _mm_andnot_si128( closerInt, bestIndex ) );
+
+			index = _mm_add_epi32( index, step );
+		}
+
+		float dist[4];
+		int indices[4];
+		_mm_storeu_ps( dist, bestDist );
+		_mm_storeu_si128( (__m128i*)indices, bestIndex );
+		return bestOfLanes( dist, indices, 4 );
+	}
+
+	__attribute__((target("avx2")))
+	int closestAVX2( int red, int green, int blue ) const
+	{
+		__m256 pr = _mm256_set1_ps( (float)red );
+		__m256 pg = _mm256_set1_ps( (float)green );
+		__m256 pb = _mm256_set1_ps( (float)blue );
+
+		__m256 bestDist = _mm256_set1_ps( 1e30f );
+		__m256i bestIndex = _mm256_setzero_si256();
+		__m256i index = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+		const __m256i step = _mm256_set1_epi32( 8 );
+
+		for( size_t i = 0; i < r.size(); i += 8 )
+		{
+			__m256 dr = _mm256_sub_ps( _mm256_loadu_ps( &r[i] ), pr );
+			__m256 dg = _mm256_sub_ps( _mm256_loadu_ps( &g[i] ), pg );
+			__m256 db = _mm256_sub_ps( _mm256_loadu_ps( &b[i] ), pb );
+			__m256 dist = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( dr, dr ), _mm256_mul_ps( dg, dg ) ), _mm256_mul_ps( db, db ) );
+
+			__m256 closer = _mm256_cmp_ps( dist, bestDist, _CMP_LT_OQ );
+			bestDist = _mm256_blendv_ps( bestDist, dist, closer );
+			bestIndex = _mm256_castps_si256( _mm256_blendv_ps(
+				_mm256_castsi256_ps( bestIndex ), _mm256_castsi256_ps( index ), closer ) );
+
+			index = _mm256_add_epi32( index, step );
+		}
+
+		float dist[8];
+		int indices[8];
+		_mm256_storeu_ps( dist, bestDist );
+		_mm256_storeu_si256( (__m256i*)indices, bestIndex );
+		return bestOfLanes( dist, indices, 8 );
+	}
+#endif
+
+	int count = 0;
+	std::vector<float> r, g, b;
+	int (PaletteSearch::*search)( int, int, int ) const = &PaletteSearch::closestScalar;
+	const char* name = "scalar";
+};
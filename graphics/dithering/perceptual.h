@@ -0,0 +1,277 @@
+#pragma once
+
+// Finding the closest palette colour by how different colours look, not by rgb.
+//
+// Distance in rgb treats every channel the same, but our eyes are far more
+// sensitive to some differences than others, so the "closest" colour can look
+// obviously wrong. OKLab (Björn Ottosson, 2020) is a colour space built so that
+// plain distance matches how different two colours look.
+//
+// Converting a pixel to OKLab is: sRGB to linear light (a 256 entry table, since
+// pixels are 8 bits per channel), a 3x3 matrix, a cube root and another 3x3 matrix.
+// The matrices and cube roots are done for all three channels at once with SSE.
+//
+// PerceptualLUT is PaletteLUT again: the same 32x32x32 boxes of rgb with a short
+// list of palette colours that could be closest to something in each box, only
+// with the distances measured in OKLab. With small palettes most boxes end up
+// with one candidate, and then the pixel doesn't even need converting. Boxes are
+// looser in OKLab than in rgb, so there are more candidates than PaletteLUT has,
+// and they're kept sorted by how close they could possibly get so the search
+// can usually stop after the first few. The answers are exactly the
+// same as checking every palette colour in OKLab, ties going to the first one.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef unsigned char u8;
+
+namespace oklab
+{
+	// sRGB levels to linear light, 0 to 1
+	inline const float* linearTable()
+	{
+		struct Table
+		{
+			float v[256];
+			Table()
+			{
+				for( int i = 0; i < 256; i++ )
+				{
+					float c = i / 255.0f;
+					v[i] = c <= 0.04045f ? c / 12.92f : std::pow( (c + 0.055f) / 1.055f, 2.4f );
+				}
+			}
+		};
+		static const Table table;
+		return table.v;
+	}
+
+	// Linear rgb to the cone responses, every weight is positive
+	const float M1[3][3] =
+	{
+		{ 0.4122214708f, 0.5363325363f, 0.0514459929f },
+		{ 0.2119034982f, 0.6806995451f, 0.1073969566f },
+		{ 0.0883024619f, 0.2817188376f, 0.6299787005f }
+	};
+
+	// Cube rooted cone responses to L, a and b
+	const float M2[3][3] =
+	{
+		{ 0.2104542553f,  0.7936177850f, -0.0040720468f },
+		{ 1.9779984951f, -2.4285922050f,  0.4505937099f },
+		{ 0.0259040371f,  0.7827717662f, -0.8086757660f }
+	};
+
+	// 8 bit rgb to cube rooted cone responses (lms, with a spare 4th value).
+	// Each of them only goes up when r, g or b goes up.
+	inline void toLMS( int r, int g, int b, float* lms )
+	{
+		const float* linear = linearTable();
+		float lr = linear[r], lg = linear[g], lb = linear[b];
+
+#ifdef __SSE2__
+		__m128 v = _mm_add_ps( _mm_add_ps(
+			_mm_mul_ps( _mm_set1_ps( lr ), _mm_setr_ps( M1[0][0], M1[1][0], M1[2][0], 0 ) ),
+			_mm_mul_ps( _mm_set1_ps( lg ), _mm_setr_ps( M1[0][1], M1[1][1], M1[2][1], 0 ) ) ),
+			_mm_mul_ps( _mm_set1_ps( lb ), _mm_setr_ps( M1[0][2], M1[1][2], M1[2][2], 0 ) ) );
+
+		// Cube root: a first guess from the float's bits (dividing the exponent by 3),
+		// then Newton's method, y = (2y + x / y^2) / 3. Each step roughly squares the
+		// error, so two steps take a guess that's a few percent out to within 1e-5.
+		__m128 y = _mm_castsi128_ps( _mm_add_epi32(
+			_mm_cvttps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( _mm_castps_si128( v ) ), _mm_set1_ps( 1.0f / 3 ) ) ),
+			_mm_set1_epi32( 709921077 ) ) );
+		const __m128 third = _mm_set1_ps( 1.0f / 3 );
+		for( int i = 0; i < 2; i++ )
+			y = _mm_mul_ps( third, _mm_add_ps( _mm_add_ps( y, y ), _mm_div_ps( v, _mm_mul_ps( y, y ) ) ) );
+
+		// Black has no cube root guess to start from, it's just 0
+		y = _mm_and_ps( y, _mm_cmpgt_ps( v, _mm_setzero_ps() ) );
+		_mm_storeu_ps( lms, y );
+#else
+		for( int i = 0; i < 3; i++ )
+			lms[i] = std::cbrt( M1[i][0] * lr + M1[i][1] * lg + M1[i][2] * lb );
+		lms[3] = 0;
+#endif
+	}
+
+	inline void lmsToLab( const float* lms, float* lab )
+	{
+		for( int i = 0; i < 3; i++ )
+			lab[i] = M2[i][0] * lms[0] + M2[i][1] * lms[1] + M2[i][2] * lms[2];
+	}
+
+	// 8 bit rgb to OKLab, L from 0 to 1
+	inline void toLab( int r, int g, int b, float* lab )
+	{
+		float lms[4];
+		toLMS( r, g, b, lms );
+		lmsToLab( lms, lab );
+	}
+}
+
+// How much bigger each box is made in OKLab, to be safe from float rounding
+const float PERCEPTUAL_SLACK = 1e-4f;
+
+class PerceptualLUT
+{
+public:
+	static const int CELL_BITS = 5;
+	static const int CELLS = 1 << CELL_BITS;
+	static const int CELL_SIZE = 256 / CELLS;
+
+	PerceptualLUT() {}
+
+	// palette is `count` rgb triples
+	PerceptualLUT( const u8* palette, int count ) : lab( count * 3 )
+	{
+		for( int i = 0; i < count; i++ )
+			oklab::toLab( palette[i * 3], palette[i * 3 + 1], palette[i * 3 + 2], &lab[i * 3] );
+
+		offsets.reserve( CELLS * CELLS * CELLS + 1 );
+		std::vector<float> nearest( count );
+
+		for( int r = 0; r < CELLS; r++ )
+		for( int g = 0; g < CELLS; g++ )
+		for( int b = 0; b < CELLS; b++ )
+		{
+			offsets.push_back( (int)candidates.size() );
+
+			// The box's darkest and brightest corners give the smallest and largest
+			// lms of anything in it. Every Lab value is a sum of those, so its range
+			// comes from picking the low or high end of each depending on the sign.
+			float lmsLo[4], lmsHi[4];
+			oklab::toLMS( r * CELL_SIZE, g * CELL_SIZE, b * CELL_SIZE, lmsLo );
+			oklab::toLMS( r * CELL_SIZE + CELL_SIZE - 1, g * CELL_SIZE + CELL_SIZE - 1, b * CELL_SIZE + CELL_SIZE - 1, lmsHi );
+
+			float lo[3], hi[3];
+			for( int c = 0; c < 3; c++ )
+			{
+				lo[c] = hi[c] = 0;
+				for( int k = 0; k < 3; k++ )
+				{
+					float w = oklab::M2[c][k];
+					lo[c] += w * (w > 0 ? lmsLo[k] : lmsHi[k]);
+					hi[c] += w * (w > 0 ? lmsHi[k] : lmsLo[k]);
+				}
+
+				// A little slack for float rounding, a bigger box only costs a few candidates
+				lo[c] -= PERCEPTUAL_SLACK;
+				hi[c] += PERCEPTUAL_SLACK;
+			}
+
+			float bestFarthest = -1;
+			for( int i = 0; i < count; i++ )
+			{
+				float closeDist = 0, farDist = 0;
+				for( int c = 0; c < 3; c++ )
+				{
+					float p = lab[i * 3 + c];
+					float d = p < lo[c] ? lo[c] - p : (p > hi[c] ? p - hi[c] : 0);
+					float f = std::max( p - lo[c], hi[c] - p );
+					closeDist += d * d;
+					farDist += f * f;
+				}
+				nearest[i] = closeDist;
+				if( bestFarthest < 0 || farDist < bestFarthest )
+					bestFarthest = farDist;
+			}
+
+			size_t first = candidates.size();
+			for( int i = 0; i < count; i++ )
+			{
+				if( nearest[i] <= bestFarthest )
+					candidates.push_back( { nearest[i], (unsigned short)i } );
+			}
+
+			// Closest possible first, so the search can stop early
+			std::stable_sort( candidates.begin() + first, candidates.end(),
+				[]( const Candidate& a, const Candidate& b ) { return a.bound < b.bound; } );
+		}
+
+		offsets.push_back( (int)candidates.size() );
+	}
+
+	// Index of the closest palette colour
+	int closest( u8 r, u8 g, u8 b ) const
+	{
+		int cell = ((r / CELL_SIZE) * CELLS + (g / CELL_SIZE)) * CELLS + (b / CELL_SIZE);
+
+		int begin = offsets[cell];
+		int end = offsets[cell + 1];
+
+		if( end - begin == 1 )
+			return candidates[begin].index;
+
+		float p[3];
+		oklab::toLab( r, g, b, p );
+
+		// Candidates are sorted by how close they could possibly be, so once that's
+		// further than the best so far none of the rest can win. They're not in
+		// palette order any more, so ties have to check the index.
+		int result = candidates[begin].index;
+		float closest = distance( p, result );
+		for( int i = begin + 1; i < end && candidates[i].bound <= closest; i++ )
+		{
+			int index = candidates[i].index;
+			float dist = distance( p, index );
+			if( dist < closest || (dist == closest && index < result) )
+			{
+				result = index;
+				closest = dist;
+			}
+		}
+		return result;
+	}
+
+	// Checks every colour, to compare against
+	int closestBruteForce( u8 r, u8 g, u8 b ) const
+	{
+		float p[3];
+		oklab::toLab( r, g, b, p );
+
+		int result = 0;
+		float closest = -1;
+		for( int i = 0; i < (int)lab.size() / 3; i++ )
+		{
+			float dist = distance( p, i );
+			if( closest < 0 || dist < closest )
+			{
+				result = i;
+				closest = dist;
+			}
+		}
+		return result;
+	}
+
+	float averageCandidates() const
+	{
+		return candidates.size() / float(offsets.size() - 1);
+	}
+
+private:
+	float distance( const float* p, int i ) const
+	{
+		float dl = p[0] - lab[i * 3];
+		float da = p[1] - lab[i * 3 + 1];
+		float db = p[2] - lab[i * 3 + 2];
+		return dl * dl + da * da + db * db;
+	}
+
+	// A palette colour that might be closest to something in a box,
+	// and the closest anything in the box could be to it
+	struct Candidate
+	{
+		float bound;
+		unsigned short index;
+	};
+
+	std::vector<float> lab;
+	std::vector<int> offsets;
+	std::vector<Candidate> candidates;
+};
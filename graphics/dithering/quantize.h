@@ -0,0 +1,303 @@
+#pragma once
+
+// Making a palette out of the image itself.
+//
+// First every pixel goes into a histogram, 32 levels per channel. Each bin keeps
+// a count and the sum of the pixels that landed in it, so nothing is lost by
+// binning: a bin's colour is the average of its actual pixels. After that we
+// never look at the pixels again, at most 32768 weighted colours instead of
+// millions of pixels. The histogram is filled in parallel, each thread with
+// its own histogram for its share of the pixels, all added together at the end.
+//
+// Then either:
+// - median cut (Heckbert): start with one box around every colour, keep splitting
+//   the biggest box in half (by pixel count) across its longest side, and use the
+//   average of each box as a palette colour
+// - k-means: start from median cut, then move each palette colour to the average
+//   of the colours closest to it, and repeat. Finding the closest palette colour
+//   for every histogram colour is the slow part, so that's split into blocks and
+//   shared between the threads.
+
+#include "wavefront.h"
+
+#include <algorithm>
+#include <vector>
+
+typedef unsigned char u8;
+
+// A colour from the histogram, and how many pixels it stands for
+struct WeightedColour
+{
+	float r, g, b;
+	double weight;
+};
+
+class ColourHistogram
+{
+public:
+	static const int BITS = 5;
+	static const int SIDE = 1 << BITS;
+	static const int SIZE = SIDE * SIDE * SIDE;
+
+	ColourHistogram() : bins( SIZE ) {}
+
+	// Adds `pixels` rgb pixels, split between `threads` threads
+	void add( const u8* rgb, size_t pixels, int threads )
+	{
+		if( threads <= 1 || pixels < (size_t)threads * 4096 )
+		{
+			addPixels( rgb, pixels );
+			return;
+		}
+
+		std::vector<ColourHistogram> parts( threads );
+		size_t share = (pixels + threads - 1) / threads;
+		parallelFor( threads, threads, [&]( int i )
+		{
+			size_t start = std::min( pixels, share * i );
+			size_t end = std::min( pixels, start + share );
+			parts[i].addPixels( rgb + start * 3, end - start );
+		});
+
+		for( const ColourHistogram& part : parts )
+			merge( part );
+	}
+
+	void merge( const ColourHistogram& other )
+	{
+		for( int i = 0; i < SIZE; i++ )
+		{
+			bins[i].count += other.bins[i].count;
+			bins[i].r += other.bins[i].r;
+			bins[i].g += other.bins[i].g;
+			bins[i].b += other.bins[i].b;
+		}
+	}
+
+	// Every bin that has any pixels in it, as the average of those pixels
+	std::vector<WeightedColour> colours() const
+	{
+		std::vector<WeightedColour> result;
+		for( const Bin& bin : bins )
+		{
+			if( bin.count == 0 ) continue;
+			double n = (double)bin.count;
+			result.push_back( { (float)(bin.r / n), (float)(bin.g / n), (float)(bin.b / n), n } );
+		}
+		return result;
+	}
+
+private:
+	void addPixels( const u8* rgb, size_t pixels )
+	{
+		for( size_t i = 0; i < pixels; i++, rgb += 3 )
+		{
+			Bin& bin = bins[((rgb[0] >> (8 - BITS)) << (BITS * 2)) | ((rgb[1] >> (8 - BITS)) << BITS) | (rgb[2] >> (8 - BITS))];
+			bin.count++;
+			bin.r += rgb[0];
+			bin.g += rgb[1];
+			bin.b += rgb[2];
+		}
+	}
+
+	// 64 bit sums, a few 4K images would overflow 32 bits
+	struct Bin
+	{
+		unsigned long long count = 0;
+		unsigned long long r = 0, g = 0, b = 0;
+	};
+
+	std::vector<Bin> bins;
+};
+
+inline u8 roundChannel( float v )
+{
+	int i = (int)(v + 0.5f);
+	return (u8)(i < 0 ? 0 : (i > 255 ? 255 : i));
+}
+
+// Up to `count` colours as rgb triples, fewer if the image doesn't have that many
+inline std::vector<u8> medianCut( std::vector<WeightedColour> colours, int count )
+{
+	struct Box
+	{
+		int begin, end;    // range of colours in it
+		double weight;
+		int axis;          // longest side, 0 1 or 2 for r g b
+		float length;      // and how long it is
+	};
+
+	auto channel = []( const WeightedColour& c, int axis ) { return axis == 0 ? c.r : (axis == 1 ? c.g : c.b); };
+
+	auto makeBox = [&]( int begin, int end )
+	{
+		Box box = { begin, end, 0, 0, 0 };
+		float lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+		for( int i = begin; i < end; i++ )
+		{
+			box.weight += colours[i].weight;
+			for( int a = 0; a < 3; a++ )
+			{
+				lo[a] = std::min( lo[a], channel( colours[i], a ) );
+				hi[a] = std::max( hi[a], channel( colours[i], a ) );
+			}
+		}
+		for( int a = 0; a < 3; a++ )
+		{
+			if( hi[a] - lo[a] > box.length )
+			{
+				box.length = hi[a] - lo[a];
+				box.axis = a;
+			}
+		}
+		return box;
+	};
+
+	std::vector<Box> boxes;
+	if( !colours.empty() )
+		boxes.push_back( makeBox( 0, (int)colours.size() ) );
+
+	while( (int)boxes.size() < count )
+	{
+		// Split whichever box has the most pixels times the longest side, so big
+		// boxes and busy boxes both get split, and single colours never do
+		int split = -1;
+		double bestScore = 0;
+		for( int i = 0; i < (int)boxes.size(); i++ )
+		{
+			double score = boxes[i].weight * boxes[i].length;
+			if( boxes[i].end - boxes[i].begin > 1 && score > bestScore )
+			{
+				bestScore = score;
+				split = i;
+			}
+		}
+		if( split < 0 ) break;
+
+		Box box = boxes[split];
+		std::sort( colours.begin() + box.begin, colours.begin() + box.end,
+			[&]( const WeightedColour& a, const WeightedColour& b ) { return channel( a, box.axis ) < channel( b, box.axis ); } );
+
+		// First colour past half the pixels, leaving at least one colour on each side
+		int middle = box.begin + 1;
+		double below = colours[box.begin].weight;
+		while( middle < box.end - 1 && below + colours[middle].weight <= box.weight / 2 )
+			below += colours[middle++].weight;
+
+		boxes[split] = makeBox( box.begin, middle );
+		boxes.push_back( makeBox( middle, box.end ) );
+	}
+
+	std::vector<u8> palette;
+	for( const Box& box : boxes )
+	{
+		double r = 0, g = 0, b = 0;
+		for( int i = box.begin; i < box.end; i++ )
+		{
+			r += colours[i].r * colours[i].weight;
+			g += colours[i].g * colours[i].weight;
+			b += colours[i].b * colours[i].weight;
+		}
+		palette.push_back( roundChannel( (float)(r / box.weight) ) );
+		palette.push_back( roundChannel( (float)(g / box.weight) ) );
+		palette.push_back( roundChannel( (float)(b / box.weight) ) );
+	}
+	return palette;
+}
+
+// How many histogram colours each k-means work item looks at
+const int KMEANS_BLOCK = 1024;
+
+// Stop once no palette colour moves more than this (squared, in rgb levels)
+const float KMEANS_SETTLED = 0.25f;
+
+// Improves a palette (rgb triples) by k-means, with the histogram colours
+// shared out between `threads` threads a block at a time
+inline std::vector<u8> kMeans( const std::vector<WeightedColour>& colours, const std::vector<u8>& start,
+	int threads, int maxIterations = 16 )
+{
+	int k = (int)start.size() / 3;
+	int n = (int)colours.size();
+	if( k == 0 || n == 0 ) return start;
+
+	// Centres kept separately per channel so the distance loop vectorises
+	std::vector<float> cr( k ), cg( k ), cb( k );
+	for( int j = 0; j < k; j++ )
+	{
+		cr[j] = start[j * 3];
+		cg[j] = start[j * 3 + 1];
+		cb[j] = start[j * 3 + 2];
+	}
+
+	// Each block adds up its colours per centre on its own, no locking
+	struct Sums
+	{
+		std::vector<double> r, g, b, weight;
+	};
+
+	int blocks = (n + KMEANS_BLOCK - 1) / KMEANS_BLOCK;
+	std::vector<Sums> sums( blocks );
+
+	for( int iteration = 0; iteration < maxIterations; iteration++ )
+	{
+		parallelFor( blocks, threads, [&]( int block )
+		{
+			Sums& s = sums[block];
+			s.r.assign( k, 0 );
+			s.g.assign( k, 0 );
+			s.b.assign( k, 0 );
+			s.weight.assign( k, 0 );
+
+			std::vector<float> d( k );
+			int end = std::min( n, (block + 1) * KMEANS_BLOCK );
+			for( int i = block * KMEANS_BLOCK; i < end; i++ )
+			{
+				const WeightedColour& c = colours[i];
+				for( int j = 0; j < k; j++ )
+				{
+					float dr = c.r - cr[j], dg = c.g - cg[j], db = c.b - cb[j];
+					d[j] = dr * dr + dg * dg + db * db;
+				}
+
+				int best = (int)(std::min_element( d.begin(), d.end() ) - d.begin());
+				s.r[best] += c.r * c.weight;
+				s.g[best] += c.g * c.weight;
+				s.b[best] += c.b * c.weight;
+				s.weight[best] += c.weight;
+			}
+		});
+
+		float moved = 0;
+		for( int j = 0; j < k; j++ )
+		{
+			double r = 0, g = 0, b = 0, weight = 0;
+			for( const Sums& s : sums )
+			{
+				r += s.r[j];
+				g += s.g[j];
+				b += s.b[j];
+				weight += s.weight[j];
+			}
+
+			// Nothing is closest to it, leave it where it is
+			if( weight == 0 ) continue;
+
+			float nr = (float)(r / weight), ng = (float)(g / weight), nb = (float)(b / weight);
+			moved = std::max( moved, (nr - cr[j]) * (nr - cr[j]) + (ng - cg[j]) * (ng - cg[j]) + (nb - cb[j]) * (nb - cb[j]) );
+			cr[j] = nr;
+			cg[j] = ng;
+			cb[j] = nb;
+		}
+
+		if( moved < KMEANS_SETTLED ) break;
+	}
+
+	std::vector<u8> palette( k * 3 );
+	for( int j = 0; j < k; j++ )
+	{
+		palette[j * 3    ] = roundChannel( cr[j] );
+		palette[j * 3 + 1] = roundChannel( cg[j] );
+		palette[j * 3 + 2] = roundChannel( cb[j] );
+	}
+	return palette;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+// Runs an error diffusion pass over an image on several threads at once.
+//
+// Error diffusion is sequential, every pixel depends on the pixels before it.
+// But a pixel only receives error from the row directly above it, and only from
+// a couple of columns either side. So row N+1 can start as soon as row N has
+// got a few pixels ahead of it, and all the rows run together in a diagonal
+// "wavefront" down the image.
+//
+// Each row publishes how many of its pixels are finished, and before touching a
+// pixel a row waits until the row above has finished enough of its own.
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// How often (in pixels) a row tells the row below how far it has got
+const int PUBLISH_EVERY = 16;
+
+// Calls func( i ) for every i from 0 to count - 1 using `threads` workers.
+// Work is handed out in order from a shared counter, and the calling thread
+// does its share too.
+template<typename Func>
+void parallelFor( int count, int threads, Func func )
+{
+	std::atomic<int> next( 0 );
+
+	auto worker = [&]()
+	{
+		for( int i = next++; i < count; i = next++ )
+			func( i );
+	};
+
+	std::vector<std::thread> pool;
+	for( int i = 1; i < threads; i++ )
+		pool.emplace_back( worker );
+
+	worker();
+
+	for( auto& t : pool )
+		t.join();
+}
+
+class Wavefront
+{
+public:
+	Wavefront( int rows ) : progress( rows )
+	{
+		for( int i = 0; i < rows; i++ )
+			progress[i].store( 0, std::memory_order_relaxed );
+	}
+
+	// Tell everyone waiting on `row` that its first `done` pixels are finished
+	void publish( int row, int done )
+	{
+		progress[row].store( done, std::memory_order_release );
+	}
+
+	// Block until the first `done` pixels of `row` are finished.
+	// `known` caches the last value we saw, so most calls don't touch the atomic at all.
+	void waitFor( int row, int done, int& known )
+	{
+		if( row < 0 || known >= done ) return;
+
+		while( (known = progress[row].load( std::memory_order_acquire )) < done )
+			std::this_thread::yield();
+	}
+
+	// Calls rowFunc( y ) for every row using `threads` workers.
+	//
+	// Rows are handed out in order, so whenever a row is waiting on the one
+	// above it, that row has already been picked up by some other worker and
+	// can't be stuck behind us. No deadlocks.
+	template<typename RowFunc>
+	void run( int threads, RowFunc rowFunc )
+	{
+		parallelFor( (int)progress.size(), threads, rowFunc );
+	}
+
+private:
+	std::vector<std::atomic<int>> progress;
+};
@@ -1 +1 @@
-c++ main.cpp -lsdl2 -framework opengl -lglew -std=c++11
\ No newline at end of file
+c++ main.cpp -O2 -pthread -lsdl2 -framework opengl -lglew -std=c++11
\ No newline at end of file
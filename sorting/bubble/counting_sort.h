@@ -0,0 +1,161 @@
+#pragma once
+
+// Sorting bytes without comparing anything.
+//
+// A byte only has 256 values, so sorting them is just counting how many of
+// each there are and writing them back out in order: one pass to read, one to
+// write, no matter how the data starts out.
+//
+// The counting is the slow part. Adding one to counts[byte] for every byte
+// stalls whenever two bytes in a row are the same, because the second add has
+// to wait for the first to land. So the bytes are read 8 at a time and shared
+// between 4 tables of counts, and neighbouring bytes never hit the same table.
+//
+// x86 can't add into 256 different buckets at once, so SSE2 does the other
+// thing it's good at: checking 16 bytes at a time for being all the same value.
+// Long runs (already sorted data, or lots of one value) then cost one add per
+// 16 bytes, and random data only pays a compare. Writing the bytes out is a
+// memset per value.
+//
+// countingSortParallel() splits the counting between threads, each with its
+// own tables, then every thread writes its own slice of the output. Below
+// COUNTING_SORT_PARALLEL_BYTES it isn't worth starting the threads and it sorts
+// on the calling thread.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace sorting
+{
+	// Smaller than about this and everything is in cache anyway, one thread is quicker
+	const std::size_t COUNTING_SORT_PARALLEL_BYTES = 4 * 1024 * 1024;
+
+	// Adds how many of each byte value are in data to counts
+	inline void byteHistogram( const unsigned char* data, std::size_t length, std::size_t counts[256] )
+	{
+		uint32_t tables[4][256] = {};
+
+		// uint32_t counts can't overflow in a block this size
+		const std::size_t BLOCK = (std::size_t)1 << 30;
+
+		std::size_t i = 0;
+		while( i < length )
+		{
+			std::size_t blockEnd = std::min( length, i + BLOCK );
+			for( ; i + 16 <= blockEnd; i += 16 )
+			{
+#ifdef __SSE2__
+				__m128i v = _mm_loadu_si128( (const __m128i*)( data + i ) );
+				__m128i first = _mm_set1_epi8( (char)data[i] );
+				if( _mm_movemask_epi8( _mm_cmpeq_epi8( v, first ) ) == 0xffff )
+				{
+					tables[0][data[i]] += 16;
+					continue;
+				}
+#endif
+				for( int half = 0; half < 16; half += 8 )
+				{
+					uint64_t bytes;
+					memcpy( &bytes, data + i + half, 8 );
+					tables[0][bytes & 0xff]++;
+					tables[1][( bytes >> 8 ) & 0xff]++;
+					tables[2][( bytes >> 16 ) & 0xff]++;
+					tables[3][( bytes >> 24 ) & 0xff]++;
+					tables[0][( bytes >> 32 ) & 0xff]++;
+					tables[1][( bytes >> 40 ) & 0xff]++;
+					tables[2][( bytes >> 48 ) & 0xff]++;
+					tables[3][bytes >> 56]++;
+				}
+			}
+			for( ; i < blockEnd; i++ )
+				tables[0][data[i]]++;
+
+			for( int v = 0; v < 256; v++ )
+			{
+				counts[v] += (std::size_t)tables[0][v] + tables[1][v] + tables[2][v] + tables[3][v];
+				tables[0][v] = tables[1][v] = tables[2][v] = tables[3][v] = 0;
+			}
+		}
+	}
+
+	// Writes out the part of the sorted bytes from begin up to end, counts is for the whole array
+	inline void writeSortedRange( unsigned char* data, std::size_t begin, std::size_t end, const std::size_t counts[256] )
+	{
+		std::size_t start = 0;
+		for( int v = 0; v < 256 && start < end; v++ )
+		{
+			std::size_t stop = start + counts[v];
+			std::size_t from = std::max( start, begin );
+			std::size_t to = std::min( stop, end );
+			if( from < to ) memset( data + from, v, to - from );
+			start = stop;
+		}
+	}
+
+	inline void countingSort( unsigned char* data, std::size_t length )
+	{
+		std::size_t counts[256] = {};
+		byteHistogram( data, length, counts );
+		writeSortedRange( data, 0, length, counts );
+	}
+
+	// threads counts the calling thread, 0 means one per core
+	inline void countingSortParallel( unsigned char* data, std::size_t length, int threads = 0 )
+	{
+		if( threads <= 0 ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+		if( threads == 1 || length < COUNTING_SORT_PARALLEL_BYTES )
+		{
+			countingSort( data, length );
+			return;
+		}
+
+		// Each thread counts its own slice...
+		std::vector<std::size_t> partial( threads * 256, 0 );
+		auto slice = [&]( int t, std::size_t& begin, std::size_t& end )
+		{
+			begin = length / threads * t;
+			end = t == threads - 1 ? length : length / threads * ( t + 1 );
+		};
+
+		auto count = [&]( int t )
+		{
+			std::size_t begin, end;
+			slice( t, begin, end );
+			byteHistogram( data + begin, end - begin, &partial[t * 256] );
+		};
+
+		std::vector<std::thread> workers;
+		for( int t = 1; t < threads; t++ ) workers.emplace_back( count, t );
+		count( 0 );
+		for( auto& w : workers ) w.join();
+		workers.clear();
+
+		std::size_t counts[256] = {};
+		for( int t = 0; t < threads; t++ )
+		{
+			for( int v = 0; v < 256; v++ )
+				counts[v] += partial[t * 256 + v];
+		}
+
+		// ...then writes its own slice of the answer. Nobody reads the data
+		// any more, so it doesn't matter that the slices overwrite it.
+		auto write = [&]( int t )
+		{
+			std::size_t begin, end;
+			slice( t, begin, end );
+			writeSortedRange( data, begin, end, counts );
+		};
+
+		for( int t = 1; t < threads; t++ ) workers.emplace_back( write, t );
+		write( 0 );
+		for( auto& w : workers ) w.join();
+	}
+}
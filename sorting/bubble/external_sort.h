@@ -0,0 +1,386 @@
+#pragma once
+
+// Sorting a file that's too big to fit in memory.
+//
+// externalSort() sorts a binary file of fixed size keys (any trivially copyable
+// T) into another file, using about memoryBytes of memory however big the file is.
+//
+//  - runs: read as much of the input as fits in memory, sort it (radixSort()
+//    for integers in ascending order, pdqSort() for anything else) and write
+//    it out to a temporary file. Repeat until the input runs out.
+//  - merge: read every run at once and keep taking whichever run has the
+//    smallest key next. A loser tree picks it: each node of a tree over the
+//    runs remembers the run that lost the match played there, so after the
+//    winner moves on to its next key only its path back up to the root has to
+//    be replayed, one compare per level and no more.
+//
+// Every run being read has two buffers. While the merge works through one, the
+// other is being filled on an I/O thread, and the output is written the same
+// way, so the disk and the merge aren't waiting on each other. Buffers are
+// never smaller than EXTERNAL_MIN_BUFFER_BYTES, since small reads from lots of
+// places at once is what disks are worst at. If there are too many runs for
+// that, they're merged in groups into fewer, longer runs first.
+//
+// Temporary files go in tempDir, or wherever tmpfile() puts them if that's
+// null, and are deleted when they're closed. The output can be the input.
+
+#include "sort.h"
+#include "task_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifndef _WIN32
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+namespace sorting
+{
+	// Smallest buffer a merge reads or writes with
+	const std::size_t EXTERNAL_MIN_BUFFER_BYTES = 1 << 20;
+
+	struct ExternalSortStats
+	{
+		std::size_t runs = 0;           // sorted runs the input was cut into
+		int passes = 0;                 // merge passes over the data
+		double runTime = 0;             // milliseconds making the runs
+		double mergeTime = 0;           // and merging them
+		const char* error = nullptr;    // what went wrong, if it returned false
+	};
+
+	// A new temporary file in dir that deletes itself when it's closed.
+	// Windows doesn't get a choice of where.
+	inline FILE* openTempFile( const char* dir )
+	{
+#ifndef _WIN32
+		if( dir )
+		{
+			std::string path = std::string( dir ) + "/sortXXXXXX";
+			int fd = mkstemp( &path[0] );
+			if( fd < 0 ) return nullptr;
+			unlink( path.c_str() );
+			FILE* file = fdopen( fd, "w+b" );
+			if( !file ) close( fd );
+			return file;
+		}
+#endif
+		(void)dir;
+		return tmpfile();
+	}
+
+	template<typename T, typename Compare>
+	void sortRun( T* data, std::size_t count, Compare comp )
+	{
+		pdqSort( data, data + count, comp );
+	}
+
+	// Integers in ascending order don't need comparing
+	template<typename T>
+	typename std::enable_if<std::is_integral<T>::value>::type sortRun( T* data, std::size_t count, std::less<T> )
+	{
+		radixSort( data, count );
+	}
+
+	// Reads a run from the front, filling one buffer on the pool while the
+	// other is read from
+	template<typename T>
+	class RunReader
+	{
+	public:
+		RunReader( FILE* file, std::size_t bufferCount, TaskPool& pool ) : file( file ), pool( pool )
+		{
+			buffers[0].resize( bufferCount );
+			buffers[1].resize( bufferCount );
+			load( 0 );
+			if( filled[0] == bufferCount ) loadLater( 1 );
+		}
+
+		~RunReader() { pool.wait( loading ); }
+
+		bool done() const { return position >= filled[front]; }
+		const T& current() const { return buffers[front][position]; }
+
+		void next()
+		{
+			if( ++position < filled[front] ) return;
+
+			// A buffer that wasn't filled was the end of the file
+			if( filled[front] < buffers[front].size() ) return;
+
+			pool.wait( loading );
+			front ^= 1;
+			position = 0;
+			if( filled[front] == buffers[front].size() ) loadLater( front ^ 1 );
+		}
+
+		bool failed() const { return error; }
+
+	private:
+		void load( int b )
+		{
+			filled[b] = fread( buffers[b].data(), sizeof( T ), buffers[b].size(), file );
+			if( ferror( file ) ) error = true;
+		}
+
+		void loadLater( int b )
+		{
+			pool.spawn( loading, [this, b]() { load( b ); } );
+		}
+
+		FILE* file;
+		TaskPool& pool;
+		TaskPool::TaskGroup loading;
+		std::vector<T> buffers[2];
+		std::size_t filled[2] = { 0, 0 };
+		std::size_t position = 0;
+		int front = 0;
+		bool error = false;
+	};
+
+	// Writes to the end of a file, one buffer on the pool while the other fills up
+	template<typename T>
+	class RunWriter
+	{
+	public:
+		RunWriter( FILE* file, std::size_t bufferCount, TaskPool& pool ) : file( file ), pool( pool )
+		{
+			buffers[0].resize( bufferCount );
+			buffers[1].resize( bufferCount );
+		}
+
+		~RunWriter() { pool.wait( writing ); }
+
+		void push( const T& value )
+		{
+			buffers[front][used++] = value;
+			if( used == buffers[front].size() ) flush();
+		}
+
+		// Writes whatever's left, false if anything couldn't be written
+		bool finish()
+		{
+			flush();
+			pool.wait( writing );
+			return !error && fflush( file ) == 0;
+		}
+
+	private:
+		void flush()
+		{
+			// The last write has to be done before the next one starts, and
+			// before its buffer gets filled again
+			pool.wait( writing );
+
+			int b = front;
+			std::size_t count = used;
+			if( count > 0 )
+			{
+				pool.spawn( writing, [this, b, count]()
+				{
+					if( fwrite( buffers[b].data(), sizeof( T ), count, file ) != count ) error = true;
+				});
+			}
+			front ^= 1;
+			used = 0;
+		}
+
+		FILE* file;
+		TaskPool& pool;
+		TaskPool::TaskGroup writing;
+		std::vector<T> buffers[2];
+		std::size_t used = 0;
+		int front = 0;
+		bool error = false;
+	};
+
+	// Merges count sorted runs into out, which is where the loser tree lives
+	template<typename T, typename Compare>
+	bool mergeRuns( FILE* const* runs, std::size_t count, FILE* out, std::size_t bufferCount, TaskPool& pool, Compare comp )
+	{
+		std::vector<std::unique_ptr<RunReader<T>>> readers;
+		for( std::size_t r = 0; r < count; r++ )
+			readers.emplace_back( new RunReader<T>( runs[r], bufferCount, pool ) );
+		RunWriter<T> writer( out, bufferCount, pool );
+
+		if( count == 0 ) return writer.finish();
+
+		// Each run's next key is copied out next to the others, so the matches
+		// don't have to go looking for them in the readers
+		std::vector<T> heads( count );
+		std::vector<char> finished( count );
+		for( std::size_t r = 0; r < count; r++ )
+		{
+			finished[r] = readers[r]->done();
+			if( !finished[r] ) heads[r] = readers[r]->current();
+		}
+
+		// Does run a's key come out before run b's? Finished runs lose to everything.
+		auto before = [&]( int a, int b )
+		{
+			if( finished[a] ) return false;
+			if( finished[b] ) return true;
+			return comp( heads[a], heads[b] );
+		};
+
+		// Node n's children are 2n and 2n + 1, the runs are the leaves count
+		// and up. tree[n] is the loser at n and tree[0] the overall winner.
+		std::vector<int> tree( count ), winners( 2 * count );
+		for( std::size_t r = 0; r < count; r++ )
+			winners[count + r] = (int)r;
+		for( std::size_t n = count; n-- > 1; )
+		{
+			int a = winners[2 * n];
+			int b = winners[2 * n + 1];
+			if( before( b, a ) ) std::swap( a, b );
+			winners[n] = a;
+			tree[n] = b;
+		}
+		tree[0] = count > 1 ? winners[1] : 0;
+
+		while( !finished[tree[0]] )
+		{
+			int winner = tree[0];
+			writer.push( heads[winner] );
+
+			RunReader<T>& reader = *readers[winner];
+			reader.next();
+			if( reader.done() ) finished[winner] = 1;
+			else heads[winner] = reader.current();
+
+			for( std::size_t n = ( winner + count ) / 2; n >= 1; n /= 2 )
+			{
+				if( before( tree[n], winner ) ) std::swap( tree[n], winner );
+			}
+			tree[0] = winner;
+		}
+
+		bool ok = writer.finish();
+		for( auto& reader : readers )
+			ok = ok && !reader->failed();
+		return ok;
+	}
+
+	template<typename T, typename Compare>
+	bool externalSort( const char* input, const char* output, std::size_t memoryBytes, const char* tempDir,
+		Compare comp, ExternalSortStats* stats = nullptr )
+	{
+		static_assert( std::is_trivially_copyable<T>::value, "externalSort() reads and writes keys as raw bytes" );
+
+		ExternalSortStats result;
+		std::vector<FILE*> runs, next;
+		auto fail = [&]( const char* error )
+		{
+			for( FILE* file : runs ) if( file ) fclose( file );
+			for( FILE* file : next ) if( file ) fclose( file );
+			result.error = error;
+			if( stats ) *stats = result;
+			return false;
+		};
+
+		// The calling thread merges, the other one reads and writes
+		TaskPool pool( 2 );
+		auto start = std::chrono::steady_clock::now();
+
+		FILE* in = fopen( input, "rb" );
+		if( !in ) return fail( "couldn't open the input" );
+		{
+			std::vector<T> chunk( std::max<std::size_t>( 1, memoryBytes / sizeof( T ) ) );
+			for( ;; )
+			{
+				std::size_t bytes = fread( chunk.data(), 1, chunk.size() * sizeof( T ), in );
+				std::size_t count = bytes / sizeof( T );
+				if( bytes % sizeof( T ) != 0 || ferror( in ) )
+				{
+					fclose( in );
+					return fail( bytes % sizeof( T ) ? "the input isn't a whole number of keys" : "couldn't read the input" );
+				}
+				if( count == 0 ) break;
+
+				sortRun( chunk.data(), count, comp );
+
+				FILE* run = openTempFile( tempDir );
+				if( !run )
+				{
+					fclose( in );
+					return fail( "couldn't make a temporary file" );
+				}
+				runs.push_back( run );
+				if( fwrite( chunk.data(), sizeof( T ), count, run ) != count || fflush( run ) != 0 )
+				{
+					fclose( in );
+					return fail( "couldn't write a run" );
+				}
+				rewind( run );
+
+				if( count < chunk.size() ) break;
+			}
+		}
+		fclose( in );
+
+		result.runs = runs.size();
+		auto merging = std::chrono::steady_clock::now();
+		result.runTime = std::chrono::duration<double, std::milli>( merging - start ).count();
+
+		// Two buffers per run and two for the output, all out of memoryBytes
+		auto bufferCount = [&]( std::size_t runCount )
+		{
+			return std::max<std::size_t>( 1, std::max( EXTERNAL_MIN_BUFFER_BYTES, memoryBytes / ( 2 * ( runCount + 1 ) ) ) / sizeof( T ) );
+		};
+		std::size_t maxRuns = memoryBytes / ( 2 * EXTERNAL_MIN_BUFFER_BYTES );
+		maxRuns = maxRuns > 3 ? maxRuns - 1 : 2;
+
+		while( runs.size() > maxRuns )
+		{
+			for( std::size_t r = 0; r < runs.size(); r += maxRuns )
+			{
+				std::size_t count = std::min( maxRuns, runs.size() - r );
+				FILE* merged = openTempFile( tempDir );
+				if( !merged ) return fail( "couldn't make a temporary file" );
+				next.push_back( merged );
+
+				if( !mergeRuns<T>( &runs[r], count, merged, bufferCount( count ), pool, comp ) )
+					return fail( "couldn't merge runs" );
+				rewind( merged );
+
+				for( std::size_t i = r; i < r + count; i++ )
+				{
+					fclose( runs[i] );
+					runs[i] = nullptr;
+				}
+			}
+			runs.swap( next );
+			next.clear();
+			result.passes++;
+		}
+
+		FILE* out = fopen( output, "wb" );
+		if( !out ) return fail( "couldn't open the output" );
+		bool merged = mergeRuns<T>( runs.data(), runs.size(), out, bufferCount( runs.size() ), pool, comp );
+		bool closed = fclose( out ) == 0;
+		if( !merged || !closed ) return fail( "couldn't write the output" );
+		result.passes++;
+
+		for( FILE* file : runs ) fclose( file );
+		runs.clear();
+
+		result.mergeTime = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - merging ).count();
+		if( stats ) *stats = result;
+		return true;
+	}
+
+	template<typename T>
+	bool externalSort( const char* input, const char* output, std::size_t memoryBytes, const char* tempDir = nullptr,
+		ExternalSortStats* stats = nullptr )
+	{
+		return externalSort<T>( input, output, memoryBytes, tempDir, std::less<T>(), stats );
+	}
+}
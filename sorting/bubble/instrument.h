@@ -0,0 +1,261 @@
+#pragma once
+
+// Watching a sort work, without slowing down the sorts nobody is watching.
+//
+// traced( data, tracer ) gives an iterator over data that tells tracer about
+// everything the sort does through it, and tracedCompare( comp, tracer ) does
+// the same for comparisons. Hand both to any sort in sort.h:
+//
+//   RingTrace<int> trace( 1 << 16 );
+//   auto first = traced( data, trace );
+//   pdqSort( first, first + n, tracedCompare( std::less<int>(), trace ) );
+//
+// The tracer is a template parameter, not a flag checked at run time. A tracer
+// only needs three functions:
+//   compare( a, b )                     a and b were compared
+//   swap( a, b )                        a and b were swapped
+//   write( index, from, before, after ) data[index] went from before to after,
+//                                       copied from data[from]
+// Indices are -1 for values the sort is holding on to (a pivot, say) rather
+// than anything in the array. With NoTrace they're all empty and the iterator
+// compiles down to a plain pointer, so it costs nothing.
+//
+// RingTrace counts everything and keeps the most recent events in a buffer
+// allocated up front, overwriting the oldest when it's full. Writes keep the
+// value they replaced as well, so the array can be wound back from how it ended
+// up to how it was at the oldest event still in the buffer, and replayed from there.
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace sorting
+{
+	struct NoTrace
+	{
+		void compare( int, int ) {}
+		void swap( int, int ) {}
+		template<typename T> void write( int, int, const T&, const T& ) {}
+	};
+
+	enum TraceOp : uint8_t
+	{
+		TRACE_COMPARE,
+		TRACE_SWAP,
+		TRACE_WRITE
+	};
+
+	template<typename T>
+	struct TraceEvent
+	{
+		TraceOp op;
+		int32_t a, b;       // the two compared or swapped, or written to and from
+		T before, after;    // writes only
+	};
+
+	template<typename T>
+	class RingTrace
+	{
+	public:
+		// capacity 0 just counts
+		explicit RingTrace( std::size_t capacity ) : events( capacity ) {}
+
+		void compare( int a, int b )
+		{
+			compares++;
+			record( TRACE_COMPARE, a, b, T(), T() );
+		}
+
+		void swap( int a, int b )
+		{
+			swaps++;
+			record( TRACE_SWAP, a, b, T(), T() );
+		}
+
+		void write( int index, int from, const T& before, const T& after )
+		{
+			writes++;
+			record( TRACE_WRITE, index, from, before, after );
+		}
+
+		void clear()
+		{
+			compares = swaps = writes = 0;
+			total = 0;
+		}
+
+		// Events still in the buffer, oldest first
+		std::size_t size() const { return total < events.size() ? (std::size_t)total : events.size(); }
+		const TraceEvent<T>& operator[]( std::size_t i ) const
+		{
+			return events[( ( total - size() ) + i ) % events.size()];
+		}
+
+		// Events that were overwritten before anyone looked at them
+		uint64_t dropped() const { return total - size(); }
+
+		// Undoes every event still in the buffer, newest first, turning the array
+		// the sort finished with into what it was when the oldest one happened
+		void rewind( T* data ) const
+		{
+			for( std::size_t i = size(); i-- > 0; )
+			{
+				const TraceEvent<T>& e = ( *this )[i];
+				if( e.op == TRACE_SWAP ) std::swap( data[e.a], data[e.b] );
+				else if( e.op == TRACE_WRITE && e.a >= 0 ) data[e.a] = e.before;
+			}
+		}
+
+		// Does one event to the array, for replaying
+		static void apply( const TraceEvent<T>& e, T* data )
+		{
+			if( e.op == TRACE_SWAP ) std::swap( data[e.a], data[e.b] );
+			else if( e.op == TRACE_WRITE && e.a >= 0 ) data[e.a] = e.after;
+		}
+
+		uint64_t compares = 0, swaps = 0, writes = 0;
+
+	private:
+		void record( TraceOp op, int a, int b, const T& before, const T& after )
+		{
+			if( !events.empty() )
+			{
+				TraceEvent<T>& e = events[total % events.size()];
+				e.op = op;
+				e.a = a;
+				e.b = b;
+				e.before = before;
+				e.after = after;
+			}
+			total++;
+		}
+
+		std::vector<TraceEvent<T>> events;
+		uint64_t total = 0;
+	};
+
+	// What dereferencing a TracedIterator gives you. It reads like a T, and
+	// writing through it tells the tracer.
+	template<typename T, typename Tracer>
+	class TracedRef
+	{
+	public:
+		TracedRef( T* base, std::ptrdiff_t index, Tracer* tracer ) : base( base ), index( index ), tracer( tracer ) {}
+		TracedRef( const TracedRef& ) = default;
+
+		operator const T&() const { return base[index]; }
+		const T& value() const { return base[index]; }
+		int position() const { return (int)index; }
+
+		TracedRef& operator=( const TracedRef& other )
+		{
+			tracer->write( (int)index, (int)other.index, base[index], other.base[other.index] );
+			base[index] = other.base[other.index];
+			return *this;
+		}
+
+		TracedRef& operator=( const T& value )
+		{
+			tracer->write( (int)index, -1, base[index], value );
+			base[index] = value;
+			return *this;
+		}
+
+		friend void swap( TracedRef a, TracedRef b )
+		{
+			a.tracer->swap( (int)a.index, (int)b.index );
+			std::swap( a.base[a.index], b.base[b.index] );
+		}
+
+	private:
+		T* base;
+		std::ptrdiff_t index;
+		Tracer* tracer;
+	};
+
+	template<typename T, typename Tracer>
+	class TracedIterator
+	{
+	public:
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef TracedRef<T, Tracer> reference;
+		typedef void pointer;
+
+		TracedIterator() : base( nullptr ), index( 0 ), tracer( nullptr ) {}
+		TracedIterator( T* base, std::ptrdiff_t index, Tracer* tracer ) : base( base ), index( index ), tracer( tracer ) {}
+
+		reference operator*() const { return reference( base, index, tracer ); }
+		reference operator[]( std::ptrdiff_t n ) const { return reference( base, index + n, tracer ); }
+
+		TracedIterator& operator++() { ++index; return *this; }
+		TracedIterator& operator--() { --index; return *this; }
+		TracedIterator operator++( int ) { TracedIterator old = *this; ++index; return old; }
+		TracedIterator operator--( int ) { TracedIterator old = *this; --index; return old; }
+		TracedIterator& operator+=( std::ptrdiff_t n ) { index += n; return *this; }
+		TracedIterator& operator-=( std::ptrdiff_t n ) { index -= n; return *this; }
+
+		friend TracedIterator operator+( TracedIterator it, std::ptrdiff_t n ) { return it += n; }
+		friend TracedIterator operator+( std::ptrdiff_t n, TracedIterator it ) { return it += n; }
+		friend TracedIterator operator-( TracedIterator it, std::ptrdiff_t n ) { return it -= n; }
+		friend std::ptrdiff_t operator-( const TracedIterator& a, const TracedIterator& b ) { return a.index - b.index; }
+
+		friend bool operator==( const TracedIterator& a, const TracedIterator& b ) { return a.index == b.index; }
+		friend bool operator!=( const TracedIterator& a, const TracedIterator& b ) { return a.index != b.index; }
+		friend bool operator<( const TracedIterator& a, const TracedIterator& b ) { return a.index < b.index; }
+		friend bool operator>( const TracedIterator& a, const TracedIterator& b ) { return a.index > b.index; }
+		friend bool operator<=( const TracedIterator& a, const TracedIterator& b ) { return a.index <= b.index; }
+		friend bool operator>=( const TracedIterator& a, const TracedIterator& b ) { return a.index >= b.index; }
+
+	private:
+		T* base;
+		std::ptrdiff_t index;
+		Tracer* tracer;
+	};
+
+	// An iterator at the start of data, the tracer hears about positions from there
+	template<typename T, typename Tracer>
+	TracedIterator<T, Tracer> traced( T* data, Tracer& tracer )
+	{
+		return TracedIterator<T, Tracer>( data, 0, &tracer );
+	}
+
+	// Tells the tracer about every comparison, with the positions of whatever
+	// was in the array
+	template<typename Compare, typename Tracer>
+	class TracedCompare
+	{
+	public:
+		TracedCompare( Compare comp, Tracer& tracer ) : comp( comp ), tracer( &tracer ) {}
+
+		template<typename A, typename B>
+		bool operator()( const A& a, const B& b ) const
+		{
+			tracer->compare( positionOf( a ), positionOf( b ) );
+			return comp( valueOf( a ), valueOf( b ) );
+		}
+
+	private:
+		template<typename T, typename Tr>
+		static int positionOf( const TracedRef<T, Tr>& r ) { return r.position(); }
+		template<typename T>
+		static int positionOf( const T& ) { return -1; }
+
+		template<typename T, typename Tr>
+		static const T& valueOf( const TracedRef<T, Tr>& r ) { return r.value(); }
+		template<typename T>
+		static const T& valueOf( const T& value ) { return value; }
+
+		Compare comp;
+		Tracer* tracer;
+	};
+
+	template<typename Compare, typename Tracer>
+	TracedCompare<Compare, Tracer> tracedCompare( Compare comp, Tracer& tracer )
+	{
+		return TracedCompare<Compare, Tracer>( comp, tracer );
+	}
+}
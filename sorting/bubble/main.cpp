@@ -1,11 +1,68 @@
 #define TJH_DRAW_IMPLEMENTATION
 #include "tjh_draw.h"
 
+#include "sort.h"
+#include "counting_sort.h"
+#include "parallel_sort.h"
+#include "instrument.h"
+#include "sort_by_key.h"
+#include "external_sort.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
 const int MAX_DATA = 100;
 
 unsigned char data[MAX_DATA] = {};
 
-void bubblePass( unsigned char* data, int endIndex )
+// Which sort puts the data in order while it's drawn, see sort.h
+enum Algorithm
+{
+	ALGORITHM_BUBBLE,
+	ALGORITHM_INTRO,
+	ALGORITHM_PDQ,
+	ALGORITHM_RADIX,
+	ALGORITHM_COUNTING,
+	ALGORITHM_COUNT
+};
+
+const char* algorithmNames[] = { "bubble", "intro", "pdq", "radix", "counting" };
+
+// -bench goes up to this many elements unless it's given a number
+const long long DEFAULT_BENCH_MAX = 10000000;
+
+// -bytes goes up to this many bytes unless it's given a number
+const long long DEFAULT_BYTES_MAX = 100000000;
+
+// How many 64 bit keys -parallel sorts unless it's given a number
+const long long DEFAULT_PARALLEL_COUNT = 100000000;
+
+// How many records of each size -records sorts unless it's given a number
+const long long DEFAULT_RECORDS_COUNT = 1000000;
+
+// How many megabytes of 64 bit keys -external writes out and sorts, and with
+// how much memory, unless it's given numbers
+const long long DEFAULT_EXTERNAL_MEGABYTES = 2048;
+const long long DEFAULT_EXTERNAL_MEMORY_MEGABYTES = 256;
+
+// Bubble sort takes seconds past this, -bytes skips it
+const long long BUBBLE_SORT_MAX = 10000;
+
+// Everything the sort does is recorded here and played back a few steps a frame
+// (space starts it again). Big enough for bubble sort on MAX_DATA values.
+sorting::RingTrace<unsigned char> trace( 1 << 16 );
+const int REPLAY_STEPS_PER_FRAME = 4;
+
+// How many elements -report sorts unless it's given a number
+const int DEFAULT_REPORT_COUNT = 1000;
+
+// Any iterator and compare, so it can be traced like the sorts in sort.h
+template<typename Iter, typename Compare>
+void bubblePass( Iter data, int endIndex, Compare comp )
 {
 	// Run over the data up to the given end index
 
@@ -13,19 +70,20 @@ void bubblePass( unsigned char* data, int endIndex )
 	{
 		// Compare each element
 
-		if( data[i] > data[i+1])
+		if( comp(data[i+1], data[i]) )
 		{
 			// If they are not in the correct order already, swap them
 			// so the larger element comes after the smaller element.
 
-			unsigned char temp = data[i];
+			typename std::iterator_traits<Iter>::value_type temp = data[i];
 			data[i] = data[i+1];
 			data[i+1] = temp;
 		}
 	}
 }
 
-void bubbleSort( unsigned char* data, int length )
+template<typename Iter, typename Compare>
+void bubbleSort( Iter data, int length, Compare comp )
 {
 	// Run over the entire array repeatedly
 
@@ -40,12 +98,541 @@ void bubbleSort( unsigned char* data, int length )
 
 	for( int i = length; i > 0; i-- )
 	{
-		bubblePass(data, i);
+		bubblePass(data, i, comp);
+	}
+}
+
+void bubbleSort( unsigned char* data, int length )
+{
+	bubbleSort(data, length, std::less<unsigned char>());
+}
+
+// Runs one of the comparison sorts, radix and counting sort don't compare
+// anything so they can't go through here
+template<typename Iter, typename Compare>
+void compareSort( Algorithm algorithm, Iter first, int length, Compare comp )
+{
+	switch( algorithm )
+	{
+	case ALGORITHM_BUBBLE: bubbleSort( first, length, comp ); break;
+	case ALGORITHM_INTRO:  sorting::introSort( first, first + length, comp ); break;
+	case ALGORITHM_PDQ:    sorting::pdqSort( first, first + length, comp ); break;
+	default: break;
+	}
+}
+
+// The ways benchmark() fills the array
+enum Distribution
+{
+	DISTRIBUTION_RANDOM,
+	DISTRIBUTION_SORTED,
+	DISTRIBUTION_REVERSED,
+	DISTRIBUTION_DUPLICATES,
+	DISTRIBUTION_COUNT
+};
+
+const char* distributionNames[] = { "random", "sorted", "reversed", "duplicates" };
+
+// xorshift, so every algorithm gets exactly the same numbers
+void fillData( std::vector<unsigned int>& values, Distribution distribution )
+{
+	unsigned long long seed = 88172645463325252ull;
+	size_t count = values.size();
+	for( size_t i = 0; i < count; i++ )
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+
+		switch( distribution )
+		{
+		case DISTRIBUTION_RANDOM:     values[i] = (unsigned int)seed; break;
+		case DISTRIBUTION_SORTED:     values[i] = (unsigned int)i; break;
+		case DISTRIBUTION_REVERSED:   values[i] = (unsigned int)( count - i ); break;
+		case DISTRIBUTION_DUPLICATES: values[i] = (unsigned int)( seed % 16 ); break;
+		default: break;
+		}
+	}
+}
+
+double millisecondsSince( std::chrono::steady_clock::time_point start )
+{
+	return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Times std::sort and everything in sort.h on 1e3, 1e4 and so on up to
+// maxCount elements, for each distribution. 1e9 needs 4GB.
+int benchmark( long long maxCount )
+{
+	const char* sortNames[] = { "std::sort", "introsort", "pdqsort", "radix" };
+	bool allSorted = true;
+
+	printf( "%12s %-11s %12s %12s %12s %12s   (ms)\n", "elements", "data",
+		sortNames[0], sortNames[1], sortNames[2], sortNames[3] );
+
+	std::vector<unsigned int> values;
+	for( long long count = 1000; count <= maxCount; count *= 10 )
+	{
+		values.resize( count );
+		for( int d = 0; d < DISTRIBUTION_COUNT; d++ )
+		{
+			printf( "%12lld %-11s", count, distributionNames[d] );
+			fflush( stdout );
+
+			for( int s = 0; s < 4; s++ )
+			{
+				// Fastest of a few runs while that's cheap
+				double best = -1;
+				int runs = count <= 1000000 ? 5 : 1;
+				for( int run = 0; run < runs; run++ )
+				{
+					fillData( values, Distribution( d ) );
+
+					auto start = std::chrono::steady_clock::now();
+					switch( s )
+					{
+					case 0: std::sort( values.begin(), values.end() ); break;
+					case 1: sorting::introSort( values.begin(), values.end() ); break;
+					case 2: sorting::pdqSort( values.begin(), values.end() ); break;
+					case 3: sorting::radixSort( values.data(), values.size() ); break;
+					}
+					double time = millisecondsSince( start );
+					if( best < 0 || time < best ) best = time;
+				}
+
+				bool sorted = std::is_sorted( values.begin(), values.end() );
+				allSorted = allSorted && sorted;
+				printf( " %12.3f%s", best, sorted ? "" : "!" );
+				fflush( stdout );
+			}
+			printf( "\n" );
+		}
+	}
+
+	if( !allSorted ) printf( "! marks a sort that got it wrong\n" );
+	return allSorted ? 0 : 1;
+}
+
+// Times bubbleSort(), std::sort and counting sort on one and every core,
+// sorting random bytes and bytes that are mostly one value
+int benchmarkBytes( long long maxCount )
+{
+	const char* sortNames[] = { "bubble", "std::sort", "counting", "counting mt" };
+	bool allSorted = true;
+
+	printf( "%d cores\n", (int)std::max( 1u, std::thread::hardware_concurrency() ) );
+	printf( "%12s %-11s %12s %12s %12s %12s   (ms)\n", "bytes", "data",
+		sortNames[0], sortNames[1], sortNames[2], sortNames[3] );
+
+	std::vector<unsigned char> bytes;
+	for( long long count = 1000; count <= maxCount; count *= 10 )
+	{
+		bytes.resize( count );
+		for( int d = 0; d < 2; d++ )
+		{
+			printf( "%12lld %-11s", count, d == 0 ? "random" : "duplicates" );
+			fflush( stdout );
+
+			for( int s = 0; s < 4; s++ )
+			{
+				if( s == 0 && count > BUBBLE_SORT_MAX )
+				{
+					printf( " %12s", "-" );
+					continue;
+				}
+
+				double best = -1;
+				int runs = count <= 1000000 ? 5 : 1;
+				for( int run = 0; run < runs; run++ )
+				{
+					// Random bytes, or 1 in 16 random and the rest zero
+					unsigned long long seed = 88172645463325252ull;
+					for( long long i = 0; i < count; i++ )
+					{
+						seed ^= seed << 13;
+						seed ^= seed >> 7;
+						seed ^= seed << 17;
+						bytes[i] = d == 0 || seed % 16 == 0 ? (unsigned char)( seed >> 32 ) : 0;
+					}
+
+					auto start = std::chrono::steady_clock::now();
+					switch( s )
+					{
+					case 0: bubbleSort( bytes.data(), (int)count ); break;
+					case 1: std::sort( bytes.begin(), bytes.end() ); break;
+					case 2: sorting::countingSort( bytes.data(), bytes.size() ); break;
+					case 3: sorting::countingSortParallel( bytes.data(), bytes.size() ); break;
+					}
+					double time = millisecondsSince( start );
+					if( best < 0 || time < best ) best = time;
+				}
+
+				bool sorted = std::is_sorted( bytes.begin(), bytes.end() );
+				allSorted = allSorted && sorted;
+				printf( " %12.3f%s", best, sorted ? "" : "!" );
+				fflush( stdout );
+			}
+			printf( "\n" );
+		}
 	}
+
+	if( !allSorted ) printf( "! marks a sort that got it wrong\n" );
+	return allSorted ? 0 : 1;
 }
 
-int main()
+// Sorts the same 64 bit keys with std::sort, then with sample sort and merge
+// sort on 1, 2, 4... threads up to maxThreads, with the time for each phase.
+// Once for random keys and once for only 16 different ones.
+int benchmarkParallel( long long count, int maxThreads )
 {
+	std::vector<unsigned long long> keys( count );
+	auto fill = [&]( Distribution distribution )
+	{
+		unsigned long long seed = 88172645463325252ull;
+		for( long long i = 0; i < count; i++ )
+		{
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			keys[i] = distribution == DISTRIBUTION_DUPLICATES ? seed % 16 : seed;
+		}
+	};
+
+	// 1, 2, 4 and so on, and maxThreads itself
+	std::vector<int> threadCounts;
+	for( int threads = 1; threads < maxThreads; threads *= 2 )
+		threadCounts.push_back( threads );
+	threadCounts.push_back( maxThreads );
+
+	bool allSorted = true;
+	const Distribution distributions[] = { DISTRIBUTION_RANDOM, DISTRIBUTION_DUPLICATES };
+	for( Distribution distribution : distributions )
+	{
+		fill( distribution );
+		auto start = std::chrono::steady_clock::now();
+		std::sort( keys.begin(), keys.end() );
+		double stdTime = millisecondsSince( start );
+		allSorted = allSorted && std::is_sorted( keys.begin(), keys.end() );
+
+		printf( "%lld %s keys, %d cores, std::sort %.1f ms\n", count, distributionNames[distribution],
+			(int)std::max( 1u, std::thread::hardware_concurrency() ), stdTime );
+		printf( "%7s %-7s %10s %8s %12s %12s %10s   (ms)\n", "threads", "sort", "total", "speedup", "partition", "local sort", "merge" );
+
+		double base[2] = { 0, 0 };
+		for( int threads : threadCounts )
+		{
+			TaskPool pool( threads );
+			for( int s = 0; s < 2; s++ )
+			{
+				fill( distribution );
+				sorting::SortTimes times;
+				start = std::chrono::steady_clock::now();
+				if( s == 0 ) sorting::parallelSampleSort( keys.begin(), keys.end(), pool, &times );
+				else sorting::parallelMergeSort( keys.begin(), keys.end(), pool, &times );
+				double time = millisecondsSince( start );
+				if( threads == 1 ) base[s] = time;
+
+				bool sorted = std::is_sorted( keys.begin(), keys.end() );
+				allSorted = allSorted && sorted;
+				printf( "%7d %-7s %10.1f %7.2fx %12.1f %12.1f %10.1f%s\n", threads, s == 0 ? "sample" : "merge",
+					time, base[s] / time, times.partition, times.localSort, times.merge, sorted ? "" : "  not sorted!" );
+				fflush( stdout );
+			}
+		}
+		printf( "\n" );
+	}
+
+	return allSorted ? 0 : 1;
+}
+
+// Something the size of the records that get sorted for real, a key and a
+// payload that starts with where it came from so stability can be checked
+template<int SIZE>
+struct Record
+{
+	unsigned int key;
+	unsigned int original;
+	unsigned char payload[SIZE - 2 * sizeof( unsigned int )];
+};
+
+// Sorts count records of SIZE bytes by key, moving the records themselves with
+// pdqSort() and std::sort(), then with argsort() and permute(), radix sorting
+// the keys and sorting (key, index) pairs. The permute() buffer is reused, as
+// it would be by something sorting records over and over. Returns whether
+// every sort got it right.
+template<int SIZE>
+bool benchmarkRecordSize( long long count )
+{
+	typedef Record<SIZE> R;
+	std::vector<R> records( count );
+	auto fill = [&]()
+	{
+		unsigned long long seed = 88172645463325252ull;
+		for( long long i = 0; i < count; i++ )
+		{
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			records[i].key = (unsigned int)( ( seed >> 32 ) % count );
+			records[i].original = (unsigned int)i;
+			memset( records[i].payload, (int)i, sizeof( records[i].payload ) );
+		}
+	};
+	auto byKey = []( const R& a, const R& b ) { return a.key < b.key; };
+	auto getKey = []( const R& r ) { return r.key; };
+
+	std::vector<R> buffer( count );
+
+	bool allSorted = true;
+	auto check = [&]( bool stable )
+	{
+		bool sorted = true;
+		for( long long i = 1; i < count; i++ )
+		{
+			const R& a = records[i - 1];
+			const R& b = records[i];
+			if( b.key < a.key || ( stable && b.key == a.key && b.original < a.original ) ) sorted = false;
+		}
+		allSorted = allSorted && sorted;
+		return sorted ? "" : "!";
+	};
+
+	printf( "%4d", SIZE );
+
+	fill();
+	auto start = std::chrono::steady_clock::now();
+	sorting::pdqSort( records.begin(), records.end(), byKey );
+	printf( " %10.1f%s", millisecondsSince( start ), check( false ) );
+
+	fill();
+	start = std::chrono::steady_clock::now();
+	std::sort( records.begin(), records.end(), byKey );
+	printf( " %10.1f%s", millisecondsSince( start ), check( false ) );
+
+	for( int k = 0; k < 2; k++ )
+	{
+		fill();
+		start = std::chrono::steady_clock::now();
+		std::vector<uint32_t> order = k == 0
+			? sorting::argsort( records.begin(), records.end(), getKey )
+			: sorting::argsort( records.begin(), records.end(), getKey, std::less<unsigned int>() );
+		double keys = millisecondsSince( start );
+
+		auto gathered = std::chrono::steady_clock::now();
+		sorting::permute( records.begin(), order, buffer );
+		double gather = millisecondsSince( gathered );
+		printf( " %10.1f %10.1f %10.1f%s", keys, gather, keys + gather, check( true ) );
+	}
+	printf( "\n" );
+	fflush( stdout );
+
+	return allSorted;
+}
+
+int benchmarkRecords( long long count )
+{
+	printf( "%lld records, sorting by a 32 bit key\n", count );
+	printf( "%4s %11s %11s %10s %10s %10s %10s %10s %10s   (ms)\n", "size", "pdq", "std::sort",
+		"radix keys", "permute", "total", "pair keys", "permute", "total" );
+
+	bool allSorted = true;
+	allSorted = benchmarkRecordSize<64>( count ) && allSorted;
+	allSorted = benchmarkRecordSize<128>( count ) && allSorted;
+	allSorted = benchmarkRecordSize<256>( count ) && allSorted;
+
+	if( !allSorted ) printf( "! marks a sort that got it wrong\n" );
+	return allSorted ? 0 : 1;
+}
+
+// Writes a file of random 64 bit keys, sorts it with externalSort() and then
+// reads it back to check it's in order and has the same keys in it
+int benchmarkExternal( long long megabytes, long long memoryMegabytes )
+{
+	const char* input = "external_input.bin";
+	const char* output = "external_output.bin";
+	const std::size_t BLOCK = 1 << 20;
+	long long count = megabytes * 1024 * 1024 / sizeof( unsigned long long );
+
+	FILE* file = fopen( input, "wb" );
+	if( !file )
+	{
+		printf( "couldn't write %s\n", input );
+		return 1;
+	}
+
+	// The keys are added up going in and coming out, so a lost or changed key shows up
+	std::vector<unsigned long long> block( BLOCK );
+	unsigned long long seed = 88172645463325252ull;
+	unsigned long long sumIn = 0;
+	for( long long i = 0; i < count; i += BLOCK )
+	{
+		std::size_t n = (std::size_t)std::min<long long>( BLOCK, count - i );
+		for( std::size_t j = 0; j < n; j++ )
+		{
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			block[j] = seed;
+			sumIn += seed;
+		}
+		fwrite( block.data(), sizeof( unsigned long long ), n, file );
+	}
+	bool written = fclose( file ) == 0;
+
+	printf( "%lld MB of 64 bit keys, %lld MB of memory\n", megabytes, memoryMegabytes );
+	fflush( stdout );
+
+	sorting::ExternalSortStats stats;
+	bool ok = written && sorting::externalSort<unsigned long long>( input, output,
+		(std::size_t)memoryMegabytes * 1024 * 1024, nullptr, &stats );
+	remove( input );
+	if( !ok )
+	{
+		printf( "external sort failed: %s\n", stats.error ? stats.error : "couldn't write the input" );
+		remove( output );
+		return 1;
+	}
+
+	bool sorted = true;
+	long long countOut = 0;
+	unsigned long long sumOut = 0, last = 0;
+	file = fopen( output, "rb" );
+	for( std::size_t n; file && ( n = fread( block.data(), sizeof( unsigned long long ), BLOCK, file ) ) > 0; )
+	{
+		for( std::size_t j = 0; j < n; j++ )
+		{
+			if( countOut + (long long)j > 0 && block[j] < last ) sorted = false;
+			last = block[j];
+			sumOut += block[j];
+		}
+		countOut += n;
+	}
+	if( file ) fclose( file );
+	remove( output );
+
+	double total = stats.runTime + stats.mergeTime;
+	printf( "%zu runs, %d merge passes\n", stats.runs, stats.passes );
+	printf( "runs %.1f ms, merge %.1f ms, total %.1f ms (%.1f MB/s)\n", stats.runTime, stats.mergeTime,
+		total, megabytes / ( total / 1000 ) );
+
+	bool right = sorted && countOut == count && sumOut == sumIn;
+	if( !right ) printf( "not sorted!\n" );
+	return right ? 0 : 1;
+}
+
+// Counts what each comparison sort does on each distribution, then times
+// pdqSort() with and without tracing to show what tracing costs
+int report( int count )
+{
+	printf( "%d elements\n", count );
+	printf( "%-8s %-11s %12s %12s %12s\n", "sort", "data", "compares", "swaps", "writes" );
+
+	std::vector<unsigned int> values( count );
+	for( int a = ALGORITHM_BUBBLE; a <= ALGORITHM_PDQ; a++ )
+	{
+		for( int d = 0; d < DISTRIBUTION_COUNT; d++ )
+		{
+			fillData( values, Distribution( d ) );
+
+			// Counting only, nothing to replay
+			sorting::RingTrace<unsigned int> counts( 0 );
+			compareSort( Algorithm( a ), sorting::traced( values.data(), counts ), count,
+				sorting::tracedCompare( std::less<unsigned int>(), counts ) );
+
+			printf( "%-8s %-11s %12llu %12llu %12llu\n", algorithmNames[a], distributionNames[d],
+				(unsigned long long)counts.compares, (unsigned long long)counts.swaps, (unsigned long long)counts.writes );
+		}
+	}
+
+	const int TIMED_COUNT = 1000000;
+	values.resize( TIMED_COUNT );
+	double times[3];
+	for( int t = 0; t < 3; t++ )
+	{
+		fillData( values, DISTRIBUTION_RANDOM );
+		sorting::NoTrace nothing;
+		sorting::RingTrace<unsigned int> counts( 0 );
+
+		auto start = std::chrono::steady_clock::now();
+		if( t == 0 )
+			sorting::pdqSort( values.begin(), values.end() );
+		else if( t == 1 )
+			compareSort( ALGORITHM_PDQ, sorting::traced( values.data(), nothing ), TIMED_COUNT,
+				sorting::tracedCompare( std::less<unsigned int>(), nothing ) );
+		else
+			compareSort( ALGORITHM_PDQ, sorting::traced( values.data(), counts ), TIMED_COUNT,
+				sorting::tracedCompare( std::less<unsigned int>(), counts ) );
+		times[t] = millisecondsSince( start );
+	}
+
+	printf( "pdqsort on %d: %.1f ms untraced, %.1f ms with NoTrace, %.1f ms counting\n",
+		TIMED_COUNT, times[0], times[1], times[2] );
+	return 0;
+}
+
+int main( int argc, char* argv[] )
+{
+	Algorithm algorithm = ALGORITHM_BUBBLE;
+
+	// -j sets the most threads -parallel tries, 0 or nothing means one per core
+	int threads = 0;
+	for( int i = 1; i + 1 < argc; i++ )
+	{
+		if( strcmp( argv[i], "-j" ) == 0 ) threads = atoi( argv[i + 1] );
+	}
+	if( threads <= 0 ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+	for( int i = 1; i < argc; i++ )
+	{
+		if( strcmp( argv[i], "-bench" ) == 0 )
+		{
+			// Up to DEFAULT_BENCH_MAX elements, unless a number comes next
+			long long maxCount = DEFAULT_BENCH_MAX;
+			if( i + 1 < argc && atoll( argv[i + 1] ) > 0 ) maxCount = atoll( argv[++i] );
+			return benchmark( maxCount );
+		}
+		else if( strcmp( argv[i], "-bytes" ) == 0 )
+		{
+			long long maxCount = DEFAULT_BYTES_MAX;
+			if( i + 1 < argc && atoll( argv[i + 1] ) > 0 ) maxCount = atoll( argv[++i] );
+			return benchmarkBytes( maxCount );
+		}
+		else if( strcmp( argv[i], "-parallel" ) == 0 )
+		{
+			long long count = DEFAULT_PARALLEL_COUNT;
+			if( i + 1 < argc && atoll( argv[i + 1] ) > 0 ) count = atoll( argv[++i] );
+			return benchmarkParallel( count, threads );
+		}
+		else if( strcmp( argv[i], "-records" ) == 0 )
+		{
+			long long count = DEFAULT_RECORDS_COUNT;
+			if( i + 1 < argc && atoll( argv[i + 1] ) > 0 ) count = atoll( argv[++i] );
+			return benchmarkRecords( count );
+		}
+		else if( strcmp( argv[i], "-external" ) == 0 )
+		{
+			long long megabytes = DEFAULT_EXTERNAL_MEGABYTES;
+			long long memory = DEFAULT_EXTERNAL_MEMORY_MEGABYTES;
+			if( i + 1 < argc && atoll( argv[i + 1] ) > 0 ) megabytes = atoll( argv[++i] );
+			if( i + 1 < argc && atoll( argv[i + 1] ) > 0 ) memory = atoll( argv[++i] );
+			return benchmarkExternal( megabytes, memory );
+		}
+		else if( strcmp( argv[i], "-report" ) == 0 )
+		{
+			int count = DEFAULT_REPORT_COUNT;
+			if( i + 1 < argc && atoi( argv[i + 1] ) > 0 ) count = atoi( argv[++i] );
+			return report( count );
+		}
+		else if( strcmp( argv[i], "-sort" ) == 0 && i + 1 < argc )
+		{
+			i++;
+			for( int a = 0; a < ALGORITHM_COUNT; a++ )
+			{
+				if( strcmp( argv[i], algorithmNames[a] ) == 0 ) algorithm = Algorithm( a );
+			}
+		}
+	}
+
 	// Make up some random data to sort
 
 	for( int i = 0; i < MAX_DATA; i++ )
@@ -53,9 +640,23 @@ int main()
 		data[i] = rand() % 256;
 	}
 
-	// Do the bubble sort
+	// Do the sort, bubble sort unless -sort says otherwise, recording what it does
+
+	switch( algorithm )
+	{
+	case ALGORITHM_RADIX:  sorting::radixSort(data, MAX_DATA); break;
+	case ALGORITHM_COUNTING: sorting::countingSort(data, MAX_DATA); break;
+	default:
+		compareSort( algorithm, sorting::traced( data, trace ), MAX_DATA,
+			sorting::tracedCompare( std::less<unsigned char>(), trace ) );
+		break;
+	}
 
-	bubbleSort(data, MAX_DATA);
+	// Wind a copy back to how it started, to replay the sort on
+	unsigned char shown[MAX_DATA];
+	memcpy( shown, data, MAX_DATA );
+	trace.rewind( shown );
+	size_t step = 0;
 
 	// Everything below here just draws the data
 
@@ -69,13 +670,36 @@ int main()
 			if( event.type == SDL_QUIT ) done = true;
 			else if( event.type == SDL_KEYDOWN
 				&& event.key.keysym.scancode == SDL_SCANCODE_ESCAPE ) done = true;
+			else if( event.type == SDL_KEYDOWN
+				&& event.key.keysym.scancode == SDL_SCANCODE_SPACE ) {
+				memcpy( shown, data, MAX_DATA );
+				trace.rewind( shown );
+				step = 0;
+			}
+		}
+
+		// The last event this frame gets highlighted, green for a compare, red for a swap or write
+		int highlight[2] = { -1, -1 };
+		bool compared = false;
+		for( int s = 0; s < REPLAY_STEPS_PER_FRAME && step < trace.size(); s++, step++ ) {
+			const sorting::TraceEvent<unsigned char>& e = trace[step];
+			sorting::RingTrace<unsigned char>::apply( e, shown );
+			highlight[0] = e.a;
+			highlight[1] = e.b;
+			compared = e.op == sorting::TRACE_COMPARE;
 		}
 
 		draw::clear(0,0,0);
-		draw::setColor(1);
 
-		for( int i = 0; i < 100; i++ ) {
-			draw::rect( i * 4, 256, 4, -data[i] );
+		for( int i = 0; i < MAX_DATA; i++ ) {
+			if( i == highlight[0] || i == highlight[1] ) {
+				if( compared ) draw::setColor(0, 1, 0);
+				else draw::setColor(1, 0, 0);
+			}
+			else {
+				draw::setColor(1);
+			}
+			draw::rect( i * 4, 256, 4, -shown[i] );
 		}
 
 		draw::present();
@@ -0,0 +1,336 @@
+#pragma once
+
+// Sorting on every core, with the work shared out on a TaskPool.
+//
+// parallelMergeSort()
+//  - local sort: cut the array into a few pieces per thread and pdqSort() each
+//  - merge: merge pairs of sorted runs, then pairs of those and so on, bouncing
+//    between the array and a buffer. A single merge of two huge runs would be
+//    one thread's job, so each merge is cut into pieces that can be done at the
+//    same time: for where a piece of the output starts, a binary search finds
+//    how much of each run comes before it.
+//
+// parallelSampleSort()
+//  - partition: sort a random sample to pick splitters that cut the data into
+//    buckets of about the same size, then every block of the array works out
+//    which bucket each of its elements goes in and they're all copied to their
+//    bucket in the buffer. Keys common enough to be picked as a splitter more
+//    than once get buckets of their own, so lots of duplicates still spread out.
+//  - local sort: pdqSort() each bucket and copy it back
+//  There's no merge, the buckets are already in order. Everything is read and
+//  written about twice, where merge sort goes through it once per merge round.
+//
+// Both can say how long each phase took through SortTimes.
+
+#include "sort.h"
+#include "task_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+namespace sorting
+{
+	// Milliseconds spent on each part of a parallel sort, 0 if it doesn't have one
+	struct SortTimes
+	{
+		double partition = 0;
+		double localSort = 0;
+		double merge = 0;
+	};
+
+	// Pieces per thread for the local sorts, more than one so threads that
+	// finish early can steal some
+	const int PIECES_PER_THREAD = 4;
+
+	// Below this many elements a merge isn't split up any further
+	const std::size_t MERGE_PIECE = 1 << 16;
+
+	// Buckets per thread for sample sort, and samples taken per bucket
+	const int BUCKETS_PER_THREAD = 8;
+	const int SAMPLES_PER_BUCKET = 64;
+
+	// Not worth starting any threads below this
+	const std::size_t PARALLEL_SORT_MIN = 1 << 14;
+
+	inline double millisecondsBetween( std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b )
+	{
+		return std::chrono::duration<double, std::milli>( b - a ).count();
+	}
+
+	// How many of the first k elements of the merge of a and b come from a.
+	// Ties go to a, like std::merge.
+	template<typename InA, typename InB, typename Compare>
+	std::size_t mergeSplit( InA a, std::size_t countA, InB b, std::size_t countB, std::size_t k, Compare comp )
+	{
+		std::size_t low = k > countB ? k - countB : 0;
+		std::size_t high = std::min( k, countA );
+		while( low < high )
+		{
+			// Take i from a and k - i from b. Too few from a if a[i] should
+			// still come before the last one we took from b.
+			std::size_t i = low + ( high - low ) / 2;
+			if( !comp( b[k - i - 1], a[i] ) ) low = i + 1;
+			else high = i;
+		}
+		return low;
+	}
+
+	// Merges a and b into out, in MERGE_PIECE sized pieces spread over the pool
+	template<typename InA, typename InB, typename Out, typename Compare>
+	void parallelMerge( TaskPool& pool, TaskPool::TaskGroup& group, InA a, std::size_t countA,
+		InB b, std::size_t countB, Out out, Compare comp )
+	{
+		std::size_t total = countA + countB;
+		for( std::size_t start = 0; start < total; start += MERGE_PIECE )
+		{
+			pool.spawn( group, [=]()
+			{
+				std::size_t end = std::min( total, start + MERGE_PIECE );
+				std::size_t a0 = mergeSplit( a, countA, b, countB, start, comp );
+				std::size_t a1 = mergeSplit( a, countA, b, countB, end, comp );
+				std::merge( std::make_move_iterator( a + a0 ), std::make_move_iterator( a + a1 ),
+					std::make_move_iterator( b + ( start - a0 ) ), std::make_move_iterator( b + ( end - a1 ) ),
+					out + start, comp );
+			});
+		}
+	}
+
+	// One round: runs 0 and 1 merge together, 2 and 3 and so on, and an odd one
+	// out is just moved across. runStarts gets the runs for the next round.
+	template<typename In, typename Out, typename Compare>
+	void mergeRound( TaskPool& pool, In in, Out out, std::vector<std::size_t>& runStarts, Compare comp )
+	{
+		TaskPool::TaskGroup group;
+		std::vector<std::size_t> next;
+		std::size_t runs = runStarts.size() - 1;
+
+		for( std::size_t r = 0; r < runs; r += 2 )
+		{
+			std::size_t start = runStarts[r];
+			std::size_t middle = runStarts[r + 1];
+			std::size_t end = r + 2 <= runs ? runStarts[r + 2] : middle;
+			next.push_back( start );
+
+			parallelMerge( pool, group, in + start, middle - start, in + middle, end - middle, out + start, comp );
+		}
+		next.push_back( runStarts.back() );
+
+		pool.wait( group );
+		runStarts.swap( next );
+	}
+
+	template<typename Iter, typename Compare>
+	void parallelMergeSort( Iter first, Iter last, TaskPool& pool, Compare comp, SortTimes* times = nullptr )
+	{
+		typedef typename std::iterator_traits<Iter>::value_type T;
+		std::size_t count = last - first;
+		if( pool.size() == 1 || count < PARALLEL_SORT_MIN )
+		{
+			auto start = std::chrono::steady_clock::now();
+			pdqSort( first, last, comp );
+			if( times )
+			{
+				*times = SortTimes();
+				times->localSort = millisecondsBetween( start, std::chrono::steady_clock::now() );
+			}
+			return;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		// Sort the pieces
+		std::size_t pieces = std::min( count, (std::size_t)pool.size() * PIECES_PER_THREAD );
+		std::vector<std::size_t> runStarts;
+		for( std::size_t p = 0; p <= pieces; p++ )
+			runStarts.push_back( count * p / pieces );
+
+		TaskPool::TaskGroup group;
+		for( std::size_t p = 0; p < pieces; p++ )
+		{
+			Iter a = first + runStarts[p];
+			Iter b = first + runStarts[p + 1];
+			pool.spawn( group, [=]() { pdqSort( a, b, comp ); } );
+		}
+		pool.wait( group );
+		auto sorted = std::chrono::steady_clock::now();
+
+		// Merge them back and forth until there's one run left
+		std::vector<T> buffer( count );
+		bool inBuffer = false;
+		while( runStarts.size() > 2 )
+		{
+			if( inBuffer ) mergeRound( pool, buffer.begin(), first, runStarts, comp );
+			else mergeRound( pool, first, buffer.begin(), runStarts, comp );
+			inBuffer = !inBuffer;
+		}
+
+		if( inBuffer )
+		{
+			TaskPool::TaskGroup copies;
+			for( std::size_t s = 0; s < count; s += MERGE_PIECE )
+			{
+				pool.spawn( copies, [&, s]()
+				{
+					std::size_t e = std::min( count, s + MERGE_PIECE );
+					std::move( buffer.begin() + s, buffer.begin() + e, first + s );
+				});
+			}
+			pool.wait( copies );
+		}
+		auto merged = std::chrono::steady_clock::now();
+
+		if( times )
+		{
+			*times = SortTimes();
+			times->localSort = millisecondsBetween( start, sorted );
+			times->merge = millisecondsBetween( sorted, merged );
+		}
+	}
+
+	template<typename Iter, typename Compare>
+	void parallelSampleSort( Iter first, Iter last, TaskPool& pool, Compare comp, SortTimes* times = nullptr )
+	{
+		typedef typename std::iterator_traits<Iter>::value_type T;
+		std::size_t count = last - first;
+		if( pool.size() == 1 || count < PARALLEL_SORT_MIN )
+		{
+			auto start = std::chrono::steady_clock::now();
+			pdqSort( first, last, comp );
+			if( times )
+			{
+				*times = SortTimes();
+				times->localSort = millisecondsBetween( start, std::chrono::steady_clock::now() );
+			}
+			return;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		// Pick splitters from a sorted random sample. Bucket b gets everything
+		// after splitter b - 1, up to and including splitter b.
+		int wanted = std::min( 32767, pool.size() * BUCKETS_PER_THREAD );
+		std::vector<T> sample;
+		uint64_t seed = 88172645463325252ull;
+		for( int i = 0; i < wanted * SAMPLES_PER_BUCKET; i++ )
+		{
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			sample.push_back( first[seed % count] );
+		}
+		pdqSort( sample.begin(), sample.end(), comp );
+
+		// A splitter picked twice means that key is at least a bucket's worth of
+		// the data, and every copy of it would land in the same bucket. So then
+		// each splitter gets a bucket of its own for the keys equal to it, which
+		// needs no sorting: bucket 2s is what comes before splitter s and 2s + 1
+		// is splitter s itself.
+		std::vector<T> splitters;
+		bool repeats = false;
+		for( int b = 1; b < wanted; b++ )
+		{
+			const T& splitter = sample[b * SAMPLES_PER_BUCKET];
+			if( !splitters.empty() && !comp( splitters.back(), splitter ) ) repeats = true;
+			else splitters.push_back( splitter );
+		}
+		int splitterCount = (int)splitters.size();
+		int buckets = repeats ? 2 * splitterCount + 1 : splitterCount + 1;
+
+		// Each block counts how many of its elements go in each bucket,
+		// remembering the bucket so it doesn't have to search again
+		std::size_t blocks = std::min( count, (std::size_t)pool.size() * PIECES_PER_THREAD );
+		std::vector<uint16_t> bucketOf( count );
+		std::vector<std::size_t> counts( blocks * buckets, 0 );
+
+		TaskPool::TaskGroup group;
+		for( std::size_t k = 0; k < blocks; k++ )
+		{
+			pool.spawn( group, [&, k]()
+			{
+				std::size_t* blockCounts = &counts[k * buckets];
+				for( std::size_t i = count * k / blocks; i < count * ( k + 1 ) / blocks; i++ )
+				{
+					int b = (int)( std::lower_bound( splitters.begin(), splitters.end(), first[i], comp ) - splitters.begin() );
+					if( repeats ) b = 2 * b + ( b < splitterCount && !comp( first[i], splitters[b] ) );
+					bucketOf[i] = (uint16_t)b;
+					blockCounts[b]++;
+				}
+			});
+		}
+		pool.wait( group );
+
+		// Each bucket's elements go together, block 0's first
+		std::vector<std::size_t> offsets( blocks * buckets );
+		std::vector<std::size_t> bucketStart( buckets + 1 );
+		std::size_t total = 0;
+		for( int b = 0; b < buckets; b++ )
+		{
+			bucketStart[b] = total;
+			for( std::size_t k = 0; k < blocks; k++ )
+			{
+				offsets[k * buckets + b] = total;
+				total += counts[k * buckets + b];
+			}
+		}
+		bucketStart[buckets] = total;
+
+		std::vector<T> buffer( count );
+		for( std::size_t k = 0; k < blocks; k++ )
+		{
+			pool.spawn( group, [&, k]()
+			{
+				std::size_t* next = &offsets[k * buckets];
+				for( std::size_t i = count * k / blocks; i < count * ( k + 1 ) / blocks; i++ )
+					buffer[next[bucketOf[i]]++] = std::move( first[i] );
+			});
+		}
+		pool.wait( group );
+		auto partitioned = std::chrono::steady_clock::now();
+
+		// Sort each bucket and put it back, biggest first so one big bucket
+		// doesn't start last and hold everyone up. Buckets of equal keys only
+		// need putting back.
+		std::vector<int> order( buckets );
+		for( int b = 0; b < buckets; b++ ) order[b] = b;
+		std::sort( order.begin(), order.end(), [&]( int a, int b )
+		{
+			return bucketStart[a + 1] - bucketStart[a] > bucketStart[b + 1] - bucketStart[b];
+		});
+
+		for( int b : order )
+		{
+			pool.spawn( group, [&, b]()
+			{
+				auto begin = buffer.begin() + bucketStart[b];
+				auto end = buffer.begin() + bucketStart[b + 1];
+				if( !repeats || b % 2 == 0 ) pdqSort( begin, end, comp );
+				std::move( begin, end, first + bucketStart[b] );
+			});
+		}
+		pool.wait( group );
+		auto sorted = std::chrono::steady_clock::now();
+
+		if( times )
+		{
+			*times = SortTimes();
+			times->partition = millisecondsBetween( start, partitioned );
+			times->localSort = millisecondsBetween( partitioned, sorted );
+		}
+	}
+
+	template<typename Iter>
+	void parallelMergeSort( Iter first, Iter last, TaskPool& pool, SortTimes* times = nullptr )
+	{
+		parallelMergeSort( first, last, pool, std::less<typename std::iterator_traits<Iter>::value_type>(), times );
+	}
+
+	template<typename Iter>
+	void parallelSampleSort( Iter first, Iter last, TaskPool& pool, SortTimes* times = nullptr )
+	{
+		parallelSampleSort( first, last, pool, std::less<typename std::iterator_traits<Iter>::value_type>(), times );
+	}
+}
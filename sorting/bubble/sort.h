@@ -0,0 +1,466 @@
+#pragma once
+
+// Sorting things quicker than bubble sort does.
+//
+// Everything takes a range of random access iterators (pointers are fine) and
+// an optional compare, like std::sort.
+//
+// introSort()
+//  Quicksort with the median of three as the pivot. If the partitions keep
+//  coming out lopsided and it recurses too deep it gives up and heap sorts
+//  that part, so it's never worse than n log n. Small bits are left for one
+//  insertion sort at the end.
+//
+// pdqSort()
+//  "Pattern defeating" quicksort, after Orson Peters' pdqsort. Same idea, but
+//  it notices things quicksort is bad at:
+//  - already sorted stretches: if a partition didn't have to move anything it
+//    tries an insertion sort that gives up after a few moves, which finishes
+//    sorted or nearly sorted data in one pass
+//  - lots of the same value: if the pivot is equal to the element before the
+//    range, everything equal to it goes left in one go and is never looked at again
+//  - bad pivots: after a lopsided partition it shuffles a few elements about so
+//    the same pattern can't keep happening, and heap sorts if it still does
+//
+// radixSort()
+//  Integers only, sorted a byte at a time from the top byte down without any
+//  extra memory (American flag sort). Each pass counts how many values go in
+//  each of the 256 buckets, then swaps every value straight into its bucket.
+//  Buckets too small to be worth it are finished with pdqSort().
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace sorting
+{
+	// Ranges smaller than this get an insertion sort
+	const int INSERTION_SORT_THRESHOLD = 24;
+
+	// pdqSort() uses the median of 3 medians of 3 above this size
+	const int NINTHER_THRESHOLD = 128;
+
+	// How many moves pdqSort()'s hopeful insertion sort does before giving up
+	const int PARTIAL_INSERTION_LIMIT = 8;
+
+	// radixSort() buckets smaller than this go to pdqSort()
+	const int RADIX_SMALL_BUCKET = 64;
+
+	template<typename Iter, typename Compare>
+	void insertionSort( Iter first, Iter last, Compare comp )
+	{
+		typedef typename std::iterator_traits<Iter>::value_type T;
+		if( first == last ) return;
+
+		for( Iter cur = first + 1; cur != last; ++cur )
+		{
+			if( !comp( *cur, *( cur - 1 ) ) ) continue;
+
+			T value = std::move( *cur );
+			Iter hole = cur;
+			do
+			{
+				*hole = std::move( *( hole - 1 ) );
+				--hole;
+			} while( hole != first && comp( value, *( hole - 1 ) ) );
+			*hole = std::move( value );
+		}
+	}
+
+	// The same, but something no bigger than everything in the range sits just
+	// before first, so there's no need to check for the start
+	template<typename Iter, typename Compare>
+	void unguardedInsertionSort( Iter first, Iter last, Compare comp )
+	{
+		typedef typename std::iterator_traits<Iter>::value_type T;
+		if( first == last ) return;
+
+		for( Iter cur = first + 1; cur != last; ++cur )
+		{
+			if( !comp( *cur, *( cur - 1 ) ) ) continue;
+
+			T value = std::move( *cur );
+			Iter hole = cur;
+			do
+			{
+				*hole = std::move( *( hole - 1 ) );
+				--hole;
+			} while( comp( value, *( hole - 1 ) ) );
+			*hole = std::move( value );
+		}
+	}
+
+	template<typename Iter, typename Compare>
+	void heapSort( Iter first, Iter last, Compare comp )
+	{
+		std::make_heap( first, last, comp );
+		std::sort_heap( first, last, comp );
+	}
+
+	// log2 of n, rounded down
+	inline int floorLog2( std::size_t n )
+	{
+		int log = 0;
+		while( n >>= 1 ) log++;
+		return log;
+	}
+
+	template<typename Iter, typename Compare>
+	void sort2( Iter a, Iter b, Compare comp )
+	{
+		if( comp( *b, *a ) ) std::iter_swap( a, b );
+	}
+
+	// Leaves the median of a, b and c in b
+	template<typename Iter, typename Compare>
+	void sort3( Iter a, Iter b, Iter c, Compare comp )
+	{
+		sort2( a, b, comp );
+		sort2( b, c, comp );
+		sort2( a, b, comp );
+	}
+
+	////// Introsort ///////////////////////////////////////////////////////////
+
+	// Hoare partition around *pivot, which is just before first
+	template<typename Iter, typename Compare>
+	Iter unguardedPartition( Iter first, Iter last, Iter pivot, Compare comp )
+	{
+		for( ;; )
+		{
+			while( comp( *first, *pivot ) ) ++first;
+			--last;
+			while( comp( *pivot, *last ) ) --last;
+			if( !( first < last ) ) return first;
+			std::iter_swap( first, last );
+			++first;
+		}
+	}
+
+	template<typename Iter, typename Compare>
+	void introSortLoop( Iter first, Iter last, int depth, Compare comp )
+	{
+		while( last - first > INSERTION_SORT_THRESHOLD )
+		{
+			if( depth == 0 )
+			{
+				heapSort( first, last, comp );
+				return;
+			}
+			depth--;
+
+			// Median of three goes first and is the pivot. The other two stop
+			// the partition loops running off either end.
+			Iter mid = first + ( last - first ) / 2;
+			sort3( first + 1, mid, last - 1, comp );
+			std::iter_swap( first, mid );
+			Iter cut = unguardedPartition( first + 1, last, first, comp );
+
+			// Recurse into the right, loop round for the left
+			introSortLoop( cut, last, depth, comp );
+			last = cut;
+		}
+	}
+
+	template<typename Iter, typename Compare>
+	void introSort( Iter first, Iter last, Compare comp )
+	{
+		if( last - first < 2 ) return;
+		introSortLoop( first, last, 2 * floorLog2( last - first ), comp );
+
+		// Everything is within INSERTION_SORT_THRESHOLD of where it should be now
+		insertionSort( first, last, comp );
+	}
+
+	template<typename Iter>
+	void introSort( Iter first, Iter last )
+	{
+		introSort( first, last, std::less<typename std::iterator_traits<Iter>::value_type>() );
+	}
+
+	////// Pattern defeating quicksort /////////////////////////////////////////
+
+	// Insertion sort that gives up (returning false) once it has moved more than
+	// PARTIAL_INSERTION_LIMIT elements, for ranges we think are already sorted
+	template<typename Iter, typename Compare>
+	bool partialInsertionSort( Iter first, Iter last, Compare comp )
+	{
+		typedef typename std::iterator_traits<Iter>::value_type T;
+		if( first == last ) return true;
+
+		std::size_t moved = 0;
+		for( Iter cur = first + 1; cur != last; ++cur )
+		{
+			if( !comp( *cur, *( cur - 1 ) ) ) continue;
+
+			T value = std::move( *cur );
+			Iter hole = cur;
+			do
+			{
+				*hole = std::move( *( hole - 1 ) );
+				--hole;
+			} while( hole != first && comp( value, *( hole - 1 ) ) );
+			*hole = std::move( value );
+
+			moved += cur - hole;
+			if( moved > PARTIAL_INSERTION_LIMIT ) return false;
+		}
+		return true;
+	}
+
+	// Partitions around *first, anything equal to the pivot goes right.
+	// Returns where the pivot ended up, and whether nothing had to move.
+	template<typename Iter, typename Compare>
+	std::pair<Iter, bool> partitionRight( Iter begin, Iter end, Compare comp )
+	{
+		typedef typename std::iterator_traits<Iter>::value_type T;
+		T pivot( std::move( *begin ) );
+
+		Iter first = begin;
+		Iter last = end;
+
+		// The median of 3 left something at least as big as the pivot on the right,
+		// so the first loop can't run off. The second can if nothing moved.
+		while( comp( *++first, pivot ) );
+		if( first - 1 == begin )
+			while( first < last && !comp( *--last, pivot ) );
+		else
+			while( !comp( *--last, pivot ) );
+
+		bool alreadyPartitioned = first >= last;
+
+		while( first < last )
+		{
+			std::iter_swap( first, last );
+			while( comp( *++first, pivot ) );
+			while( !comp( *--last, pivot ) );
+		}
+
+		Iter pivotPos = first - 1;
+		*begin = std::move( *pivotPos );
+		*pivotPos = std::move( pivot );
+		return std::make_pair( pivotPos, alreadyPartitioned );
+	}
+
+	// Partitions around *first with anything equal to the pivot going left. Used
+	// when the element before the range equals the pivot, so nothing in the range
+	// is smaller than it and the left side ends up all equal, already sorted.
+	template<typename Iter, typename Compare>
+	Iter partitionLeft( Iter begin, Iter end, Compare comp )
+	{
+		typedef typename std::iterator_traits<Iter>::value_type T;
+		T pivot( std::move( *begin ) );
+
+		Iter first = begin;
+		Iter last = end;
+
+		while( comp( pivot, *--last ) );
+		if( last + 1 == end )
+			while( first < last && !comp( pivot, *++first ) );
+		else
+			while( !comp( pivot, *++first ) );
+
+		while( first < last )
+		{
+			std::iter_swap( first, last );
+			while( comp( pivot, *--last ) );
+			while( !comp( pivot, *++first ) );
+		}
+
+		Iter pivotPos = last;
+		*begin = std::move( *pivotPos );
+		*pivotPos = std::move( pivot );
+		return pivotPos;
+	}
+
+	// badAllowed is how many lopsided partitions we put up with before heap
+	// sorting. leftmost is false when there's an element just before begin that
+	// is no bigger than anything in the range.
+	template<typename Iter, typename Compare>
+	void pdqSortLoop( Iter begin, Iter end, Compare comp, int badAllowed, bool leftmost )
+	{
+		typedef typename std::iterator_traits<Iter>::difference_type Diff;
+
+		for( ;; )
+		{
+			Diff size = end - begin;
+			if( size < INSERTION_SORT_THRESHOLD )
+			{
+				if( leftmost ) insertionSort( begin, end, comp );
+				else unguardedInsertionSort( begin, end, comp );
+				return;
+			}
+
+			// Pivot goes to begin
+			Diff half = size / 2;
+			if( size > NINTHER_THRESHOLD )
+			{
+				sort3( begin, begin + half, end - 1, comp );
+				sort3( begin + 1, begin + ( half - 1 ), end - 2, comp );
+				sort3( begin + 2, begin + ( half + 1 ), end - 3, comp );
+				sort3( begin + ( half - 1 ), begin + half, begin + ( half + 1 ), comp );
+				std::iter_swap( begin, begin + half );
+			}
+			else
+			{
+				sort3( begin + half, begin, end - 1, comp );
+			}
+
+			// The element before us equals the pivot, so does everything that would go
+			// left of it. Put them there and carry on with the rest.
+			if( !leftmost && !comp( *( begin - 1 ), *begin ) )
+			{
+				begin = partitionLeft( begin, end, comp ) + 1;
+				continue;
+			}
+
+			std::pair<Iter, bool> partition = partitionRight( begin, end, comp );
+			Iter pivotPos = partition.first;
+			Diff leftSize = pivotPos - begin;
+			Diff rightSize = end - ( pivotPos + 1 );
+
+			if( leftSize < size / 8 || rightSize < size / 8 )
+			{
+				if( --badAllowed == 0 )
+				{
+					heapSort( begin, end, comp );
+					return;
+				}
+
+				// Swap a few elements from a quarter of the way in to the ends
+				// so next time's pivot comes from somewhere else
+				if( leftSize >= INSERTION_SORT_THRESHOLD )
+				{
+					std::iter_swap( begin, begin + leftSize / 4 );
+					std::iter_swap( pivotPos - 1, pivotPos - leftSize / 4 );
+					if( leftSize > NINTHER_THRESHOLD )
+					{
+						std::iter_swap( begin + 1, begin + ( leftSize / 4 + 1 ) );
+						std::iter_swap( begin + 2, begin + ( leftSize / 4 + 2 ) );
+						std::iter_swap( pivotPos - 2, pivotPos - ( leftSize / 4 + 1 ) );
+						std::iter_swap( pivotPos - 3, pivotPos - ( leftSize / 4 + 2 ) );
+					}
+				}
+				if( rightSize >= INSERTION_SORT_THRESHOLD )
+				{
+					std::iter_swap( pivotPos + 1, pivotPos + ( 1 + rightSize / 4 ) );
+					std::iter_swap( end - 1, end - rightSize / 4 );
+					if( rightSize > NINTHER_THRESHOLD )
+					{
+						std::iter_swap( pivotPos + 2, pivotPos + ( 2 + rightSize / 4 ) );
+						std::iter_swap( pivotPos + 3, pivotPos + ( 3 + rightSize / 4 ) );
+						std::iter_swap( end - 2, end - ( 1 + rightSize / 4 ) );
+						std::iter_swap( end - 3, end - ( 2 + rightSize / 4 ) );
+					}
+				}
+			}
+			else if( partition.second && partialInsertionSort( begin, pivotPos, comp )
+				&& partialInsertionSort( pivotPos + 1, end, comp ) )
+			{
+				// Nothing moved and both sides were as good as sorted, so they are now
+				return;
+			}
+
+			// Recurse into the left, loop round for the right
+			pdqSortLoop( begin, pivotPos, comp, badAllowed, leftmost );
+			begin = pivotPos + 1;
+			leftmost = false;
+		}
+	}
+
+	template<typename Iter, typename Compare>
+	void pdqSort( Iter first, Iter last, Compare comp )
+	{
+		if( last - first < 2 ) return;
+		pdqSortLoop( first, last, comp, floorLog2( last - first ), true );
+	}
+
+	template<typename Iter>
+	void pdqSort( Iter first, Iter last )
+	{
+		pdqSort( first, last, std::less<typename std::iterator_traits<Iter>::value_type>() );
+	}
+
+	////// In-place radix sort /////////////////////////////////////////////////
+
+	// The byte of value that sorts at shift, with the sign bit flipped for signed
+	// types so negative numbers come first
+	template<typename T>
+	unsigned int radixDigit( T value, int shift )
+	{
+		typedef typename std::make_unsigned<T>::type U;
+		U key = (U)value;
+		if( std::is_signed<T>::value ) key ^= (U)1 << ( sizeof( T ) * 8 - 1 );
+		return (unsigned int)( key >> shift ) & 0xff;
+	}
+
+	template<typename T>
+	void americanFlagSort( T* data, std::size_t count, int shift )
+	{
+		if( count < (std::size_t)RADIX_SMALL_BUCKET )
+		{
+			pdqSort( data, data + count );
+			return;
+		}
+
+		std::size_t counts[256] = {};
+		for( std::size_t i = 0; i < count; i++ )
+			counts[radixDigit( data[i], shift )]++;
+
+		// Where each bucket starts (next) and ends
+		std::size_t next[256], end[256];
+		std::size_t total = 0;
+		for( int b = 0; b < 256; b++ )
+		{
+			next[b] = total;
+			total += counts[b];
+			end[b] = total;
+		}
+
+		// Everything has the same byte here, nothing to move
+		bool oneBucket = false;
+		for( int b = 0; b < 256; b++ )
+		{
+			if( counts[b] == count ) oneBucket = true;
+		}
+
+		if( !oneBucket )
+		{
+			// Take the next value that isn't in the right bucket yet and keep
+			// swapping it into place until something for this bucket comes back
+			for( int b = 0; b < 256; b++ )
+			{
+				while( next[b] < end[b] )
+				{
+					T value = data[next[b]];
+					unsigned int digit = radixDigit( value, shift );
+					while( digit != (unsigned int)b )
+					{
+						std::swap( value, data[next[digit]++] );
+						digit = radixDigit( value, shift );
+					}
+					data[next[b]++] = value;
+				}
+			}
+		}
+
+		if( shift == 0 ) return;
+
+		std::size_t start = 0;
+		for( int b = 0; b < 256; b++ )
+		{
+			if( counts[b] > 1 ) americanFlagSort( data + start, counts[b], shift - 8 );
+			start += counts[b];
+		}
+	}
+
+	template<typename T>
+	void radixSort( T* data, std::size_t count )
+	{
+		static_assert( std::is_integral<T>::value, "radixSort() only sorts integers" );
+		americanFlagSort( data, count, (int)( sizeof( T ) - 1 ) * 8 );
+	}
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+// Sorting big records without dragging them around.
+//
+// Sorting an array of 64-256 byte records swaps whole records every time the
+// sort moves something, and that's a lot of memory traffic to move one key. So
+// instead:
+//
+// argsort()
+//  Pulls each record's key out into a compact (key, index) pair and sorts
+//  those. What comes back is the index of each record in sorted order. Ties are
+//  broken on the index, so it's stable. Integer keys of 32 bits or less are
+//  packed into a 64 bit integer with the index under them and radixSort()ed.
+//
+// gather()
+//  Moves the records into the order argsort() gave, once each. Reading them in
+//  that order is random access, so while it moves one record it asks for the
+//  one GATHER_PREFETCH_BYTES further on to be fetched. Fetching a whole block of
+//  records at once was slower: the CPU can only have so many lines on the way
+//  and drops the rest.
+//
+// permute()
+//  gather() into a buffer the size of the array and move them all back. Pass
+//  the same buffer in each time if you can, new memory is slow the first time
+//  it's written to (that's about as long as the gather takes for big records).
+//
+// sortByKey()
+//  argsort() then permute().
+//
+// getKey is anything that takes a record and returns its key by value.
+// Indices are 32 bits, so no more than 4 billion records.
+
+#include "sort.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace sorting
+{
+	// How far ahead gather() asks for records, in bytes
+	const std::size_t GATHER_PREFETCH_BYTES = 4096;
+
+	template<typename Key>
+	struct KeyIndex
+	{
+		Key key;
+		uint32_t index;
+	};
+
+	// Asks for the cache lines of a record without waiting for them
+	template<typename T>
+	inline void prefetchRecord( const T* record )
+	{
+#if defined( __GNUC__ )
+		for( std::size_t offset = 0; offset < sizeof( T ); offset += 64 )
+			__builtin_prefetch( (const char*)record + offset );
+#else
+		(void)record;
+#endif
+	}
+
+	// Any key with any compare: sort the pairs
+	template<typename Iter, typename GetKey, typename Compare>
+	std::vector<uint32_t> argsortPairs( Iter first, Iter last, GetKey getKey, Compare comp )
+	{
+		typedef typename std::decay<decltype( getKey( *first ) )>::type Key;
+		std::size_t count = last - first;
+
+		std::vector<KeyIndex<Key>> pairs( count );
+		for( std::size_t i = 0; i < count; i++ )
+		{
+			pairs[i].key = getKey( first[i] );
+			pairs[i].index = (uint32_t)i;
+		}
+
+		pdqSort( pairs.begin(), pairs.end(), [&]( const KeyIndex<Key>& a, const KeyIndex<Key>& b )
+		{
+			if( comp( a.key, b.key ) ) return true;
+			if( comp( b.key, a.key ) ) return false;
+			return a.index < b.index;
+		});
+
+		std::vector<uint32_t> order( count );
+		for( std::size_t i = 0; i < count; i++ )
+			order[i] = pairs[i].index;
+		return order;
+	}
+
+	// Small integer keys in ascending order: the key goes in the top half of a
+	// 64 bit integer and the index in the bottom, so one radix sort does both
+	template<typename Iter, typename GetKey>
+	std::vector<uint32_t> argsortPacked( Iter first, Iter last, GetKey getKey )
+	{
+		typedef typename std::decay<decltype( getKey( *first ) )>::type Key;
+		typedef typename std::make_unsigned<Key>::type U;
+		std::size_t count = last - first;
+
+		std::vector<uint64_t> packed( count );
+		for( std::size_t i = 0; i < count; i++ )
+		{
+			// Flip the sign bit so negative keys come first
+			U key = (U)getKey( first[i] );
+			if( std::is_signed<Key>::value ) key ^= (U)1 << ( sizeof( Key ) * 8 - 1 );
+			packed[i] = (uint64_t)key << 32 | (uint32_t)i;
+		}
+
+		radixSort( packed.data(), count );
+
+		std::vector<uint32_t> order( count );
+		for( std::size_t i = 0; i < count; i++ )
+			order[i] = (uint32_t)packed[i];
+		return order;
+	}
+
+	template<typename Iter, typename GetKey>
+	std::vector<uint32_t> argsortDefault( Iter first, Iter last, GetKey getKey, std::true_type )
+	{
+		return argsortPacked( first, last, getKey );
+	}
+
+	template<typename Iter, typename GetKey>
+	std::vector<uint32_t> argsortDefault( Iter first, Iter last, GetKey getKey, std::false_type )
+	{
+		typedef typename std::decay<decltype( getKey( *first ) )>::type Key;
+		return argsortPairs( first, last, getKey, std::less<Key>() );
+	}
+
+	template<typename Iter, typename GetKey, typename Compare>
+	std::vector<uint32_t> argsort( Iter first, Iter last, GetKey getKey, Compare comp )
+	{
+		return argsortPairs( first, last, getKey, comp );
+	}
+
+	template<typename Iter, typename GetKey>
+	std::vector<uint32_t> argsort( Iter first, Iter last, GetKey getKey )
+	{
+		typedef typename std::decay<decltype( getKey( *first ) )>::type Key;
+		return argsortDefault( first, last, getKey, std::integral_constant<bool,
+			std::is_integral<Key>::value && !std::is_same<Key, bool>::value && sizeof( Key ) <= 4>() );
+	}
+
+	// *out++ = first[order[i]] for every i, moving the records
+	template<typename Iter, typename Out>
+	void gather( Iter first, const std::vector<uint32_t>& order, Out out )
+	{
+		typedef typename std::iterator_traits<Iter>::value_type T;
+		const std::size_t ahead = std::max<std::size_t>( 1, GATHER_PREFETCH_BYTES / sizeof( T ) );
+		std::size_t count = order.size();
+
+		for( std::size_t i = 0; i < count && i < ahead; i++ )
+			prefetchRecord( &*( first + order[i] ) );
+
+		for( std::size_t i = 0; i < count; i++ )
+		{
+			if( i + ahead < count ) prefetchRecord( &*( first + order[i + ahead] ) );
+			*out++ = std::move( first[order[i]] );
+		}
+	}
+
+	// Puts the records in first into the given order. buffer is resized to fit
+	// if it isn't big enough already, so T needs a default constructor.
+	template<typename Iter>
+	void permute( Iter first, const std::vector<uint32_t>& order, std::vector<typename std::iterator_traits<Iter>::value_type>& buffer )
+	{
+		if( buffer.size() < order.size() ) buffer.resize( order.size() );
+		gather( first, order, buffer.begin() );
+		std::move( buffer.begin(), buffer.begin() + order.size(), first );
+	}
+
+	template<typename Iter>
+	void permute( Iter first, const std::vector<uint32_t>& order )
+	{
+		std::vector<typename std::iterator_traits<Iter>::value_type> buffer;
+		permute( first, order, buffer );
+	}
+
+	template<typename Iter, typename GetKey, typename Compare>
+	void sortByKey( Iter first, Iter last, GetKey getKey, Compare comp )
+	{
+		permute( first, argsort( first, last, getKey, comp ) );
+	}
+
+	template<typename Iter, typename GetKey>
+	void sortByKey( Iter first, Iter last, GetKey getKey )
+	{
+		permute( first, argsort( first, last, getKey ) );
+	}
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+// Threads that share out tasks by stealing them from each other.
+//
+// Every thread has its own queue. Tasks a thread spawns go on the back of its
+// own queue and it takes them back off the back, so it keeps working on what it
+// just split up (still in cache). A thread with nothing to do steals from the
+// front of someone else's queue, which is where the oldest and usually biggest
+// tasks are. Nobody hands work out, so a thread that finishes early just goes
+// and takes some.
+//
+// Tasks belong to a TaskGroup, and wait( group ) doesn't return until every
+// task in it (and anything they spawned into it) has run. The waiting thread
+// runs tasks too rather than sitting there, which also means tasks can spawn
+// and wait on groups of their own without running out of threads.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskPool
+{
+public:
+	class TaskGroup
+	{
+		friend class TaskPool;
+		std::atomic<int> pending{ 0 };
+	};
+
+	// threads counts the calling thread, so 1 means no extra threads at all
+	explicit TaskPool( int threads )
+	{
+		threads = std::max( 1, threads );
+		for( int i = 0; i < threads; i++ )
+			queues.emplace_back( new Queue );
+		for( int i = 1; i < threads; i++ )
+			workers.emplace_back( &TaskPool::work, this, i );
+	}
+
+	~TaskPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock( sleepMutex );
+			quit = true;
+		}
+		wake.notify_all();
+		for( auto& t : workers )
+			t.join();
+	}
+
+	int size() const { return (int)queues.size(); }
+
+	void spawn( TaskGroup& group, std::function<void()> func )
+	{
+		group.pending++;
+
+		Queue& queue = *queues[myQueue()];
+		{
+			std::lock_guard<std::mutex> lock( queue.mutex );
+			queue.tasks.push_back( Task{ std::move( func ), &group } );
+		}
+
+		// Only bother the lock if someone might be asleep
+		queued++;
+		if( sleeping > 0 )
+		{
+			std::lock_guard<std::mutex> lock( sleepMutex );
+			wake.notify_one();
+		}
+	}
+
+	// Runs tasks until everything in group is done
+	void wait( TaskGroup& group )
+	{
+		int me = myQueue();
+		while( group.pending > 0 )
+		{
+			if( !runOne( me ) )
+				std::this_thread::yield();
+		}
+	}
+
+private:
+	struct Task
+	{
+		std::function<void()> func;
+		TaskGroup* group;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	// Which queue the calling thread uses, threads from outside share the first one
+	int myQueue() const
+	{
+		return threadPool() == this ? threadIndex() : 0;
+	}
+
+	// Runs one task, our own newest or else someone else's oldest
+	bool runOne( int me )
+	{
+		Task task;
+		bool found = false;
+		{
+			Queue& own = *queues[me];
+			std::lock_guard<std::mutex> lock( own.mutex );
+			if( !own.tasks.empty() )
+			{
+				task = std::move( own.tasks.back() );
+				own.tasks.pop_back();
+				found = true;
+			}
+		}
+
+		for( int i = 1; !found && i < size(); i++ )
+		{
+			Queue& other = *queues[( me + i ) % size()];
+			std::lock_guard<std::mutex> lock( other.mutex );
+			if( !other.tasks.empty() )
+			{
+				task = std::move( other.tasks.front() );
+				other.tasks.pop_front();
+				found = true;
+			}
+		}
+
+		if( !found ) return false;
+
+		queued--;
+		task.func();
+		task.group->pending--;
+		return true;
+	}
+
+	void work( int index )
+	{
+		threadPool() = this;
+		threadIndex() = index;
+
+		for( ;; )
+		{
+			if( runOne( index ) ) continue;
+
+			std::unique_lock<std::mutex> lock( sleepMutex );
+			sleeping++;
+			wake.wait( lock, [this]() { return quit || queued > 0; } );
+			sleeping--;
+			if( quit ) return;
+		}
+	}
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+
+	// Tasks sitting in queues, and threads waiting for one
+	std::atomic<int> queued{ 0 };
+	std::atomic<int> sleeping{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool quit = false;
+
+	// The pool and queue of the thread we're on
+	static TaskPool*& threadPool() { static thread_local TaskPool* pool = nullptr; return pool; }
+	static int& threadIndex() { static thread_local int index = 0; return index; }
+};
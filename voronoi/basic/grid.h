@@ -0,0 +1,152 @@
+#pragma once
+
+// Finding the closest site to a pixel without checking every site.
+//
+// The sites are dropped into a uniform grid of buckets, about two sites per cell.
+// To find the closest site to a pixel we look at the pixel's own cell, then the
+// ring of cells around it, then the ring around that and so on. Every site we
+// haven't looked at yet is outside the square of cells we've searched, so it's
+// at least as far away as the nearest edge of that square. Once that's further
+// than the best site so far, nothing left can beat it and we stop.
+//
+// That's a handful of cells per pixel no matter how many sites there are, so
+// 100k sites cost about the same per pixel as 100.
+//
+// The distances are worked out exactly like the brute force loop in main.cpp
+// (same floats, same order of operations) and ties go to the lowest site index
+// like they do there, so every pixel ends up in exactly the same cell.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class SiteGrid
+{
+public:
+    // Sites per cell we aim for
+    static constexpr float SITES_PER_CELL = 2.0f;
+
+    // points is anything with x and y, width and height are the area pixels will be in
+    template<typename P>
+    void build( const std::vector<P>& points, float width, float height )
+    {
+        // Cover the screen and every site, so the edges of the grid are real edges
+        minX = 0;
+        minY = 0;
+        float maxX = width;
+        float maxY = height;
+        for( const P& p : points )
+        {
+            minX = std::min( minX, p.x );
+            minY = std::min( minY, p.y );
+            maxX = std::max( maxX, p.x );
+            maxY = std::max( maxY, p.y );
+        }
+
+        float area = ( maxX - minX ) * ( maxY - minY );
+        float cells = std::max( 1.0f, points.size() / SITES_PER_CELL );
+        cellSize = std::max( 1.0f, std::sqrt( area / cells ) );
+        invCellSize = 1.0f / cellSize;
+        cols = std::max( 1, (int)std::ceil( ( maxX - minX ) * invCellSize ) );
+        rows = std::max( 1, (int)std::ceil( ( maxY - minY ) * invCellSize ) );
+
+        // Counting sort the sites by cell, so each cell's sites sit next to each other
+        std::vector<int> cellOf( points.size() );
+        cellStart.assign( cols * rows + 1, 0 );
+        for( size_t i = 0; i < points.size(); i++ )
+        {
+            cellOf[i] = cellIndex( cellX( points[i].x ), cellY( points[i].y ) );
+            cellStart[cellOf[i] + 1]++;
+        }
+        for( int c = 0; c < cols * rows; c++ )
+            cellStart[c + 1] += cellStart[c];
+
+        siteX.resize( points.size() );
+        siteY.resize( points.size() );
+        siteIndex.resize( points.size() );
+        std::vector<int> next( cellStart.begin(), cellStart.end() - 1 );
+        for( size_t i = 0; i < points.size(); i++ )
+        {
+            int slot = next[cellOf[i]]++;
+            siteX[slot] = points[i].x;
+            siteY[slot] = points[i].y;
+            siteIndex[slot] = (int)i;
+        }
+    }
+
+    // Index of the closest site to pixel (x, y), the lowest index if there's a tie
+    int closest( int x, int y ) const
+    {
+        float px = x;
+        float py = y;
+        int cx = cellX( px );
+        int cy = cellY( py );
+
+        float best = INFINITY;
+        int bestIndex = 0;
+
+        for( int ring = 0; ; ring++ )
+        {
+            int x0 = cx - ring, x1 = cx + ring;
+            int y0 = cy - ring, y1 = cy + ring;
+
+            for( int gy = std::max( y0, 0 ); gy <= std::min( y1, rows - 1 ); gy++ )
+            {
+                // Only the edge of the square is new, the inside was done by earlier rings
+                bool edgeRow = gy == y0 || gy == y1;
+                int step = edgeRow ? 1 : x1 - x0;
+                for( int gx = x0; gx <= x1; gx += std::max( step, 1 ) )
+                {
+                    if( gx < 0 || gx >= cols ) continue;
+                    searchCell( cellIndex( gx, gy ), px, py, best, bestIndex );
+                }
+            }
+
+            // How far it is to the nearest side of the square we've searched
+            // that isn't the edge of the grid
+            float reach = INFINITY;
+            if( x0 > 0 )        reach = std::min( reach, px - ( minX + x0 * cellSize ) );
+            if( x1 < cols - 1 ) reach = std::min( reach, ( minX + ( x1 + 1 ) * cellSize ) - px );
+            if( y0 > 0 )        reach = std::min( reach, py - ( minY + y0 * cellSize ) );
+            if( y1 < rows - 1 ) reach = std::min( reach, ( minY + ( y1 + 1 ) * cellSize ) - py );
+
+            if( reach == INFINITY )
+                return bestIndex;
+
+            // A little slack so float rounding can't stop us a ring too early
+            if( reach > 0 && reach * reach > best * 1.0001f + 1e-3f )
+                return bestIndex;
+        }
+    }
+
+private:
+    void searchCell( int cell, float px, float py, float& best, int& bestIndex ) const
+    {
+        for( int i = cellStart[cell]; i < cellStart[cell + 1]; i++ )
+        {
+            // The same sums as the brute force loop
+            float x_dist = siteX[i] - px;
+            float y_dist = siteY[i] - py;
+            float dist_squared = x_dist * x_dist + y_dist * y_dist;
+
+            if( dist_squared < best || ( dist_squared == best && siteIndex[i] < bestIndex ) )
+            {
+                best = dist_squared;
+                bestIndex = siteIndex[i];
+            }
+        }
+    }
+
+    int cellX( float x ) const { return std::min( cols - 1, std::max( 0, (int)( ( x - minX ) * invCellSize ) ) ); }
+    int cellY( float y ) const { return std::min( rows - 1, std::max( 0, (int)( ( y - minY ) * invCellSize ) ) ); }
+    int cellIndex( int x, int y ) const { return y * cols + x; }
+
+    float minX = 0, minY = 0;
+    float cellSize = 1, invCellSize = 1;
+    int cols = 1, rows = 1;
+
+    // Sites sorted by cell, cellStart[c] is where cell c's sites begin
+    std::vector<int> cellStart;
+    std::vector<float> siteX, siteY;
+    std::vector<int> siteIndex;
+};
@@ -0,0 +1,363 @@
+#pragma once
+
+// Keeping the cells up to date while a few sites move, without redoing every pixel.
+//
+// The screen is cut into tiles, and every tile remembers which sites own pixels
+// in it (and every site remembers its tiles). When a site moves, only two kinds
+// of pixel can change:
+// - pixels the site owned before. They go to whichever site is closest now,
+//   found with a grid of buckets like grid.h, but one a site can move between.
+// - pixels the site is now closer to than their current owner. Those are all in
+//   its new cell, which is convex, so they're found by flooding out from the
+//   tile the site is in and stopping at tiles it can't possibly win anything in.
+//
+// For the second part, every tile keeps how far its furthest pixel is from the
+// site that owns it. If the moved site is further than that (plus a pixel, so
+// the space between pixels counts too) from every point of the tile, it can't
+// take any of them, and the flood doesn't go past it.
+//
+// So a move costs about the size of the old cell plus the new one, not the
+// screen. Distances and ties work exactly like the brute force loop in main.cpp,
+// so the answer is the same as doing the whole screen again.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class IncrementalVoronoi
+{
+public:
+    // Pixels along each side of a tile
+    static const int TILE_SIZE = 16;
+
+    // Sites per bucket we aim for, like SiteGrid
+    static constexpr float SITES_PER_BUCKET = 2.0f;
+
+    // points is anything with x and y, every pixel in width x height gets an owner
+    template<typename P>
+    void build( const std::vector<P>& points, int w, int h )
+    {
+        width = w;
+        height = h;
+        int n = (int)points.size();
+        siteX.resize( n );
+        siteY.resize( n );
+        for( int i = 0; i < n; i++ )
+        {
+            siteX[i] = points[i].x;
+            siteY[i] = points[i].y;
+        }
+
+        // Buckets to find the closest site
+        float cells = std::max( 1.0f, n / SITES_PER_BUCKET );
+        bucketSize = std::max( 1.0f, std::sqrt( width * (float)height / cells ) );
+        invBucketSize = 1.0f / bucketSize;
+        bucketCols = std::max( 1, (int)std::ceil( width * invBucketSize ) );
+        bucketRows = std::max( 1, (int)std::ceil( height * invBucketSize ) );
+        buckets.assign( bucketCols * bucketRows, std::vector<int>() );
+        bucketOf.resize( n );
+        for( int i = 0; i < n; i++ )
+        {
+            bucketOf[i] = bucketIndex( siteX[i], siteY[i] );
+            buckets[bucketOf[i]].push_back( i );
+        }
+
+        // Every pixel from scratch
+        ownerOf.resize( width * height );
+        distance.resize( width * height );
+        for( int y = 0; y < height; y++ )
+        {
+            for( int x = 0; x < width; x++ )
+            {
+                int i = y * width + x;
+                ownerOf[i] = closest( x, y, distance[i] );
+            }
+        }
+
+        // Then what every tile has in it
+        tileCols = ( width + TILE_SIZE - 1 ) / TILE_SIZE;
+        tileRows = ( height + TILE_SIZE - 1 ) / TILE_SIZE;
+        tileOwners.assign( tileCols * tileRows, std::vector<int>() );
+        tileReach.assign( tileCols * tileRows, 0.0f );
+        tileSeen.assign( tileCols * tileRows, 0 );
+        tileTouched.assign( tileCols * tileRows, 0 );
+        tileDirty.assign( tileCols * tileRows, 0 );
+        siteTiles.assign( n, std::vector<int>() );
+        siteMark.assign( n, 0 );
+        dirty.clear();
+        for( int t = 0; t < tileCols * tileRows; t++ )
+            refreshTile( t );
+    }
+
+    // Moves a site and fixes up the pixels that changed hands.
+    // Returns how many tiles had to be looked at.
+    int move( int site, float x, float y )
+    {
+        seen++;
+        touched.clear();
+
+        // Out of its old bucket and into the new one
+        std::vector<int>& old = buckets[bucketOf[site]];
+        old.erase( std::find( old.begin(), old.end(), site ) );
+        siteX[site] = x;
+        siteY[site] = y;
+        bucketOf[site] = bucketIndex( x, y );
+        buckets[bucketOf[site]].push_back( site );
+
+        // Everything it owned goes to whoever is closest now, which might still be it
+        std::vector<int> oldTiles = siteTiles[site];
+        for( int t : oldTiles )
+        {
+            touch( t );
+            int x0, y0, x1, y1;
+            tileRect( t, x0, y0, x1, y1 );
+            for( int py = y0; py < y1; py++ )
+            {
+                for( int px = x0; px < x1; px++ )
+                {
+                    int i = py * width + px;
+                    if( ownerOf[i] == site )
+                        ownerOf[i] = closest( px, py, distance[i] );
+                }
+            }
+        }
+
+        // Those pixels might be further from their owners now, which the flood needs to know
+        for( int t : oldTiles )
+            refreshTile( t );
+
+        // Then flood out from where it is now, taking any pixel it's closer to
+        int cx = std::min( tileCols - 1, std::max( 0, (int)( x / TILE_SIZE ) ) );
+        int cy = std::min( tileRows - 1, std::max( 0, (int)( y / TILE_SIZE ) ) );
+        flood.clear();
+        won.clear();
+        flood.push_back( cy * tileCols + cx );
+        tileSeen[flood[0]] = seen;
+        for( size_t f = 0; f < flood.size(); f++ )
+        {
+            int t = flood[f];
+            if( !canWin( t, x, y ) ) continue;
+
+            touch( t );
+            take( t, site );
+            won.push_back( t );
+
+            // Its cell is convex, so the tiles it wins are all joined up
+            // (corners count, a cell can cross from one tile to the next there)
+            int tx = t % tileCols, ty = t / tileCols;
+            for( int ny = std::max( 0, ty - 1 ); ny <= std::min( tileRows - 1, ty + 1 ); ny++ )
+            {
+                for( int nx = std::max( 0, tx - 1 ); nx <= std::min( tileCols - 1, tx + 1 ); nx++ )
+                {
+                    int n = ny * tileCols + nx;
+                    if( tileSeen[n] == seen ) continue;
+                    tileSeen[n] = seen;
+                    flood.push_back( n );
+                }
+            }
+        }
+
+        for( int t : won )
+            refreshTile( t );
+
+        return (int)touched.size();
+    }
+
+    // The site each pixel belongs to, owners()[y * width + x]
+    const std::vector<int>& owners() const { return ownerOf; }
+
+    // Sites owning at least one pixel in tile t
+    const std::vector<int>& sitesIn( int t ) const { return tileOwners[t]; }
+
+    // Tiles changed since the last clearDirty(), in no particular order
+    const std::vector<int>& dirtyTiles() const { return dirty; }
+    void clearDirty()
+    {
+        for( int t : dirty ) tileDirty[t] = 0;
+        dirty.clear();
+    }
+
+    int tileCount() const { return tileCols * tileRows; }
+
+    // Pixels x0 <= x < x1, y0 <= y < y1 make up tile t
+    void tileRect( int t, int& x0, int& y0, int& x1, int& y1 ) const
+    {
+        x0 = t % tileCols * TILE_SIZE;
+        y0 = t / tileCols * TILE_SIZE;
+        x1 = std::min( width, x0 + TILE_SIZE );
+        y1 = std::min( height, y0 + TILE_SIZE );
+    }
+
+private:
+    // The same search as SiteGrid::closest(), rings of buckets until nothing
+    // further out could be closer. dist gets the distance (squared) to the winner.
+    int closest( int x, int y, float& dist ) const
+    {
+        float px = x;
+        float py = y;
+        int cx = bucketX( px );
+        int cy = bucketY( py );
+
+        float best = INFINITY;
+        int bestIndex = 0;
+
+        for( int ring = 0; ; ring++ )
+        {
+            int x0 = cx - ring, x1 = cx + ring;
+            int y0 = cy - ring, y1 = cy + ring;
+
+            for( int gy = std::max( y0, 0 ); gy <= std::min( y1, bucketRows - 1 ); gy++ )
+            {
+                bool edgeRow = gy == y0 || gy == y1;
+                int step = edgeRow ? 1 : x1 - x0;
+                for( int gx = x0; gx <= x1; gx += std::max( step, 1 ) )
+                {
+                    if( gx < 0 || gx >= bucketCols ) continue;
+                    for( int i : buckets[gy * bucketCols + gx] )
+                    {
+                        float x_dist = siteX[i] - px;
+                        float y_dist = siteY[i] - py;
+                        float dist_squared = x_dist * x_dist + y_dist * y_dist;
+
+                        if( dist_squared < best || ( dist_squared == best && i < bestIndex ) )
+                        {
+                            best = dist_squared;
+                            bestIndex = i;
+                        }
+                    }
+                }
+            }
+
+            // Sites off the screen sit in the edge buckets, so only inside edges count
+            float reach = INFINITY;
+            if( x0 > 0 )              reach = std::min( reach, px - x0 * bucketSize );
+            if( x1 < bucketCols - 1 ) reach = std::min( reach, ( x1 + 1 ) * bucketSize - px );
+            if( y0 > 0 )              reach = std::min( reach, py - y0 * bucketSize );
+            if( y1 < bucketRows - 1 ) reach = std::min( reach, ( y1 + 1 ) * bucketSize - py );
+
+            if( reach == INFINITY || ( reach > 0 && reach * reach > best * 1.0001f + 1e-3f ) )
+            {
+                dist = best;
+                return bestIndex;
+            }
+        }
+    }
+
+    // Could a site at (x, y) be closest to anything in tile t? The tile counts
+    // as the square reaching half a pixel past its outside pixels, so together
+    // the tiles cover every point on the screen.
+    bool canWin( int t, float x, float y ) const
+    {
+        int x0, y0, x1, y1;
+        tileRect( t, x0, y0, x1, y1 );
+        float dx = std::max( 0.0f, std::max( ( x0 - 0.5f ) - x, x - ( x1 - 0.5f ) ) );
+        float dy = std::max( 0.0f, std::max( ( y0 - 0.5f ) - y, y - ( y1 - 0.5f ) ) );
+        float reach = std::sqrt( tileReach[t] ) + 1.0f;
+        return dx * dx + dy * dy <= reach * reach;
+    }
+
+    // Gives site every pixel in tile t that it's closer to than its owner
+    void take( int t, int site )
+    {
+        float sx = siteX[site], sy = siteY[site];
+        int x0, y0, x1, y1;
+        tileRect( t, x0, y0, x1, y1 );
+        for( int py = y0; py < y1; py++ )
+        {
+            float y_dist = sy - py;
+            for( int px = x0; px < x1; px++ )
+            {
+                int i = py * width + px;
+                float x_dist = sx - px;
+                float dist_squared = x_dist * x_dist + y_dist * y_dist;
+                if( dist_squared < distance[i] || ( dist_squared == distance[i] && site < ownerOf[i] ) )
+                {
+                    ownerOf[i] = site;
+                    distance[i] = dist_squared;
+                }
+            }
+        }
+    }
+
+    void touch( int t )
+    {
+        if( tileTouched[t] != seen )
+        {
+            tileTouched[t] = seen;
+            touched.push_back( t );
+        }
+        if( !tileDirty[t] )
+        {
+            tileDirty[t] = 1;
+            dirty.push_back( t );
+        }
+    }
+
+    // Works out which sites own tile t and its furthest pixel again
+    void refreshTile( int t )
+    {
+        std::vector<int>& owners = tileOwners[t];
+
+        // Mark who owned it before
+        mark++;
+        for( int s : owners ) siteMark[s] = mark;
+        previous.swap( owners );
+        owners.clear();
+
+        int x0, y0, x1, y1;
+        tileRect( t, x0, y0, x1, y1 );
+        float furthest = 0;
+        unsigned int stillThere = ++mark;
+        for( int py = y0; py < y1; py++ )
+        {
+            for( int px = x0; px < x1; px++ )
+            {
+                int i = py * width + px;
+                furthest = std::max( furthest, distance[i] );
+
+                int s = ownerOf[i];
+                if( siteMark[s] == stillThere ) continue;
+                if( siteMark[s] != stillThere - 1 ) siteTiles[s].push_back( t );    // new here
+                siteMark[s] = stillThere;
+                owners.push_back( s );
+            }
+        }
+        tileReach[t] = furthest;
+
+        // Anyone not seen this time has lost the tile
+        for( int s : previous )
+        {
+            if( siteMark[s] == stillThere ) continue;
+            std::vector<int>& tiles = siteTiles[s];
+            tiles.erase( std::find( tiles.begin(), tiles.end(), t ) );
+        }
+    }
+
+    int bucketX( float x ) const { return std::min( bucketCols - 1, std::max( 0, (int)( x * invBucketSize ) ) ); }
+    int bucketY( float y ) const { return std::min( bucketRows - 1, std::max( 0, (int)( y * invBucketSize ) ) ); }
+    int bucketIndex( float x, float y ) const { return bucketY( y ) * bucketCols + bucketX( x ); }
+
+    int width = 0, height = 0;
+    std::vector<float> siteX, siteY;
+
+    // Closest site to every pixel and how far away it is (squared)
+    std::vector<int> ownerOf;
+    std::vector<float> distance;
+
+    float bucketSize = 1, invBucketSize = 1;
+    int bucketCols = 1, bucketRows = 1;
+    std::vector<std::vector<int>> buckets;
+    std::vector<int> bucketOf;
+
+    int tileCols = 0, tileRows = 0;
+    std::vector<std::vector<int>> tileOwners;    // sites with pixels in each tile
+    std::vector<std::vector<int>> siteTiles;     // tiles each site has pixels in
+    std::vector<float> tileReach;                // furthest pixel from its owner, squared
+
+    // Scratch space for move() and refreshTile()
+    std::vector<unsigned int> tileSeen, tileTouched, siteMark;
+    unsigned int seen = 0, mark = 0;
+    std::vector<int> touched, flood, won, previous;
+    std::vector<char> tileDirty;
+    std::vector<int> dirty;
+};
@@ -2,9 +2,20 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "grid.h"
+#include "incremental.h"
+#include "metrics.h"
+#include "simd_search.h"
+#include "thread_pool.h"
 
 SDL_Window* win = NULL;
 SDL_Renderer* ren = NULL;
+SDL_Texture* tex = NULL;
 const int WIDTH = 800;
 const int HEIGHT = 600;
 bool redraw = true;
@@ -15,15 +26,157 @@ struct Point
     ~Point() {}
     float x, y;
     Uint8 r, g, b;
+    float weight;    // a radius, only the weighted metrics use it
 };
 
 std::vector<Point> points;
 
+// Biggest radius a site can get
+const float MAX_WEIGHT = 30.0f;
+
+// How many sites to scatter, can be changed on the command line
+int siteCount = 100;
+
+// How to find the closest site to each pixel (press G to go through them)
+enum Search
+{
+    SEARCH_GRID,    // SiteGrid, see grid.h
+    SEARCH_SIMD,    // SIMDSearch, every site but 8 at a time
+    SEARCH_BRUTE    // closestBruteForce(), every site one at a time
+};
+
+const char* searchNames[] = { "grid", "simd", "brute force" };
+
+Search search = SEARCH_GRID;
+
+// How to measure closest (press M to go through them), see metrics.h.
+// Anything but plain distance checks every site with MetricSearch.
+enum Distance
+{
+    DISTANCE_EUCLIDEAN,
+    DISTANCE_ADDITIVE,
+    DISTANCE_POWER,
+    DISTANCE_MANHATTAN,
+    DISTANCE_CHEBYSHEV,
+    DISTANCE_COUNT
+};
+
+const char* distanceNames[] = { "euclidean", "additive", "power", "manhattan", "chebyshev" };
+
+Distance distance = DISTANCE_EUCLIDEAN;
+
+// Rows are shared out between these, set with -j
+ThreadPool* pool = NULL;
+
+// Which site each pixel belongs to
+std::vector<int> owner( WIDTH * HEIGHT );
+
+// The picture as ARGB, filled on the CPU and copied to the texture in one go.
+// Press T to go back to drawing each pixel with SDL_RenderDrawPoint instead.
+std::vector<Uint32> framebuffer( WIDTH * HEIGHT );
+bool useTexture = true;
+
+// How many frames -headless times
+const int HEADLESS_FRAMES = 10;
+
+// Press A to keep a few sites moving about. Only the tiles they pass through
+// get worked out again, see incremental.h.
+bool animate = false;
+IncrementalVoronoi incremental;
+const int MOVING_SITES = 5;
+
+// Pixels per frame for the moving sites
+struct Velocity
+{
+    float x, y;
+};
+std::vector<Velocity> velocities;
+
+// How many frames -incremental times
+const int INCREMENTAL_FRAMES = 200;
+
 void init();
 void draw();
+void fill();
+bool writePPM( const char* filename );
+int headless( const char* filename );
+void randomPoints();
+int closestBruteForce( int x, int y );
+void assignBruteForce();
+void assignGrid();
+void assignSIMD();
+void assign();
+void assignMetric( Distance d );
+int check();
+int metrics();
+int scaling( int maxThreads );
+void startAnimation();
+int moveSites();
+void fillTile( int t );
+void animateFrame();
+int incrementalBench();
 
-int main()
+int main( int argc, char* argv[] )
 {
+    bool checkOnly = false;
+    bool scalingOnly = false;
+    bool incrementalOnly = false;
+    bool metricsOnly = false;
+    int threads = 1;
+    const char* headlessFile = NULL;
+    for( int i = 1; i < argc; i++ )
+    {
+        if( strcmp( argv[i], "-brute" ) == 0 ) search = SEARCH_BRUTE;
+        else if( strcmp( argv[i], "-simd" ) == 0 ) search = SEARCH_SIMD;
+        else if( strcmp( argv[i], "-check" ) == 0 ) checkOnly = true;
+        else if( strcmp( argv[i], "-scaling" ) == 0 ) scalingOnly = true;
+        else if( strcmp( argv[i], "-incremental" ) == 0 ) incrementalOnly = true;
+        else if( strcmp( argv[i], "-metrics" ) == 0 ) metricsOnly = true;
+        else if( strcmp( argv[i], "-metric" ) == 0 && i + 1 < argc )
+        {
+            i++;
+            int d = 0;
+            while( d < DISTANCE_COUNT && strcmp( argv[i], distanceNames[d] ) != 0 ) d++;
+            if( d == DISTANCE_COUNT )
+            {
+                std::cout << "unknown metric " << argv[i] << ", use euclidean, additive, power, manhattan or chebyshev" << std::endl;
+                return 1;
+            }
+            distance = Distance( d );
+        }
+        else if( strcmp( argv[i], "-j" ) == 0 && i + 1 < argc )
+        {
+            // 0 means every core
+            threads = atoi( argv[++i] );
+            if( threads <= 0 ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+        }
+        else if( strcmp( argv[i], "-headless" ) == 0 )
+        {
+            // Saves to voronoi.ppm unless a .ppm name comes next
+            headlessFile = "voronoi.ppm";
+            if( i + 1 < argc && strstr( argv[i + 1], ".ppm" ) ) headlessFile = argv[++i];
+        }
+        else siteCount = std::max( 1, atoi( argv[i] ) );
+    }
+
+    if( scalingOnly )
+        return scaling( threads > 1 ? threads : std::max( 1u, std::thread::hardware_concurrency() ) );
+
+    ThreadPool threadPool( threads );
+    pool = &threadPool;
+
+    if( checkOnly )
+        return check();
+
+    if( incrementalOnly )
+        return incrementalBench();
+
+    if( metricsOnly )
+        return metrics();
+
+    if( headlessFile )
+        return headless( headlessFile );
+
     init();
         
     SDL_Event event;
@@ -39,6 +192,30 @@ int main()
                 {
                    done = true;
                 }
+                else if( event.key.keysym.scancode == SDL_SCANCODE_T )
+                {
+                    useTexture = !useTexture;
+                    std::cout << ( useTexture ? "drawing with a texture" : "drawing a point at a time" ) << std::endl;
+                    redraw = true;
+                }
+                else if( event.key.keysym.scancode == SDL_SCANCODE_A )
+                {
+                    animate = !animate;
+                    if( animate ) startAnimation();
+                    std::cout << ( animate ? "moving " : "not moving " ) << MOVING_SITES << " sites" << std::endl;
+                }
+                else if( event.key.keysym.scancode == SDL_SCANCODE_M )
+                {
+                    distance = Distance( ( distance + 1 ) % DISTANCE_COUNT );
+                    std::cout << "measuring " << distanceNames[distance] << " distance" << std::endl;
+                    redraw = true;
+                }
+                else if( event.key.keysym.scancode == SDL_SCANCODE_G )
+                {
+                    search = Search( ( search + 1 ) % 3 );
+                    std::cout << "using " << searchNames[search] << std::endl;
+                    redraw = true;
+                }
                 else
                 {
                 redraw = true;
@@ -49,10 +226,16 @@ int main()
         if( redraw )
         {
            draw();
+           if( animate ) startAnimation();
            redraw = false;
         }
+        else if( animate )
+        {
+            animateFrame();
+        }
     }
 
+    SDL_DestroyTexture( tex );
     SDL_Quit();
     return 0;
 }
@@ -62,21 +245,19 @@ void init()
     SDL_Init( SDL_INIT_EVERYTHING );
     win = SDL_CreateWindow( "Voronoi Basic", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT, SDL_WINDOW_SHOWN );
     ren = SDL_CreateRenderer( win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+    tex = SDL_CreateTexture( ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT );
 
     SDL_SetRenderDrawColor( ren, 0, 0, 0, 0 );
     SDL_RenderClear( ren );
     SDL_RenderPresent( ren );
 }
 
-void draw()
+void randomPoints()
 {
-    SDL_SetRenderDrawColor( ren, 0, 0, 0, 0 );
-    SDL_RenderClear( ren );
-
     // Ensure the vector is empty
     points.clear();    
 
-    for( int i = 0; i < 100; i++ )
+    for( int i = 0; i < siteCount; i++ )
     {
         points.push_back(Point());
         points.back().x = ( rand()/float(RAND_MAX) ) * WIDTH;
@@ -84,46 +265,378 @@ void draw()
         points.back().r = rand() % 256;
         points.back().g = rand() % 256;
         points.back().b = rand() % 256;
+        points.back().weight = ( rand()/float(RAND_MAX) ) * MAX_WEIGHT;
     }
+}
 
-    // For every pixel
-    // Find the closest point to each pixel
-    for( int y = 0; y < HEIGHT; y++ )
+// Find the closest point to a pixel by checking every one
+int closestBruteForce( int x, int y )
+{
+    // This version requires `-std=c++14`
+    // It's also really slow unless you enable optimisations with `-O3`
+    /*
+    const auto p = std::min_element( begin(points), end(points),
+             [x, y](const auto& a, const auto& b)
+             { return pow(a.x - x, 2) + pow(a.y - y, 2) < pow(b.x - x, 2) + pow(b.y - y, 2); } );
+
+    return p - begin(points);
+    //*/
+
+    //*
+    float dist_squared = WIDTH * WIDTH + HEIGHT * HEIGHT;
+    int closest_point = 0;
+
+    for( int i = 0; i < points.size(); i++ )
+    {
+        float x_dist = points[i].x - x;
+        float y_dist = points[i].y - y;
+
+        if( x_dist * x_dist + y_dist * y_dist < dist_squared )
+        {
+            closest_point = i;
+            dist_squared = x_dist * x_dist + y_dist * y_dist;
+        }
+    }
+
+    return closest_point;
+    //*/
+}
+
+// For every pixel
+// Find the closest point to each pixel
+// Every row is independent, so they're shared out between the threads
+void assignBruteForce()
+{
+    pool->parallelFor( HEIGHT, [&]( int y )
     {
         for( int x = 0; x < WIDTH; x++ )
         {
-            
-            // This version requires `-std=c++14`
-            // It's also really slow unless you enable optimisations with `-O3`
-            /*
-            const auto p = std::min_element( begin(points), end(points),
-                     [x, y](const auto& a, const auto& b)
-                     { return pow(a.x - x, 2) + pow(a.y - y, 2) < pow(b.x - x, 2) + pow(b.y - y, 2); } );
+            owner[y * WIDTH + x] = closestBruteForce( x, y );
+        }
+    });
+}
 
-            SDL_SetRenderDrawColor( ren, p->r, p->g, p->b, 255 );
-            SDL_RenderDrawPoint( ren, x, y );
-            //*/
+// Same answer as assignBruteForce(), see grid.h
+void assignGrid()
+{
+    SiteGrid grid;
+    grid.build( points, WIDTH, HEIGHT );
 
-            //*
-            float dist_squared = WIDTH * WIDTH + HEIGHT * HEIGHT;
-            int closest_point = 0;
+    pool->parallelFor( HEIGHT, [&]( int y )
+    {
+        for( int x = 0; x < WIDTH; x++ )
+        {
+            owner[y * WIDTH + x] = grid.closest( x, y );
+        }
+    });
+}
+
+// Same answer as assignBruteForce(), see simd_search.h
+void assignSIMD()
+{
+    SIMDSearch simd;
+    simd.build( points, WIDTH * WIDTH + HEIGHT * HEIGHT );
+
+    pool->parallelFor( HEIGHT, [&]( int y )
+    {
+        simd.row( y, WIDTH, &owner[y * WIDTH] );
+    });
+}
 
-            for( int i = 0; i < points.size(); i++ )
+// Every site for every pixel, with the metric built into the loop
+template<typename Metric>
+void assignWith()
+{
+    MetricSearch<Metric> metricSearch;
+    metricSearch.build( points );
+
+    pool->parallelFor( HEIGHT, [&]( int y )
+    {
+        metricSearch.row( y, WIDTH, &owner[y * WIDTH] );
+    });
+}
+
+// Picking the metric once a frame, not once a pixel
+void assignMetric( Distance d )
+{
+    switch( d )
+    {
+    case DISTANCE_EUCLIDEAN: assignWith<Euclidean>(); break;
+    case DISTANCE_ADDITIVE:  assignWith<AdditiveWeighted>(); break;
+    case DISTANCE_POWER:     assignWith<Power>(); break;
+    case DISTANCE_MANHATTAN: assignWith<Manhattan>(); break;
+    case DISTANCE_CHEBYSHEV: assignWith<Chebyshev>(); break;
+    default: break;
+    }
+}
+
+// The same, but picking the metric for every pixel and site, to see what that costs
+void assignMetricSwitch( Distance d )
+{
+    pool->parallelFor( HEIGHT, [&]( int y )
+    {
+        for( int x = 0; x < WIDTH; x++ )
+        {
+            float best = INFINITY;
+            int closest = 0;
+            for( int i = 0; i < (int)points.size(); i++ )
             {
-                float x_dist = points[i].x - x;
-                float y_dist = points[i].y - y;
+                float dx = points[i].x - x;
+                float dy = points[i].y - y;
+                float w = points[i].weight;
+
+                float dist = 0;
+                switch( d )
+                {
+                case DISTANCE_EUCLIDEAN: dist = Euclidean::distance( dx, dy, w ); break;
+                case DISTANCE_ADDITIVE:  dist = AdditiveWeighted::distance( dx, dy, w ); break;
+                case DISTANCE_POWER:     dist = Power::distance( dx, dy, w ); break;
+                case DISTANCE_MANHATTAN: dist = Manhattan::distance( dx, dy, w ); break;
+                case DISTANCE_CHEBYSHEV: dist = Chebyshev::distance( dx, dy, w ); break;
+                default: break;
+                }
 
-                if( x_dist * x_dist + y_dist * y_dist < dist_squared )
+                if( dist < best )
                 {
-                    closest_point = i;
-                    dist_squared = x_dist * x_dist + y_dist * y_dist;
+                    best = dist;
+                    closest = i;
                 }
             }
+            owner[y * WIDTH + x] = closest;
+        }
+    });
+}
 
-            SDL_SetRenderDrawColor( ren, points[closest_point].r, points[closest_point].g, points[closest_point].b, 255 );
-            SDL_RenderDrawPoint( ren, x, y );
-            //*/
+void assign()
+{
+    if( distance != DISTANCE_EUCLIDEAN )
+    {
+        assignMetric( distance );
+        return;
+    }
+
+    switch( search )
+    {
+    case SEARCH_GRID:  assignGrid(); break;
+    case SEARCH_SIMD:  assignSIMD(); break;
+    case SEARCH_BRUTE: assignBruteForce(); break;
+    }
+}
+
+double millisecondsSince( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Runs every version on the same sites and makes sure every pixel agrees, no window needed
+int check()
+{
+    randomPoints();
+
+    // Other metrics only have the one search, so check it against a loop that works
+    // the distance out separately
+    if( distance != DISTANCE_EUCLIDEAN )
+    {
+        auto start = std::chrono::steady_clock::now();
+        assignMetricSwitch( distance );
+        double switchTime = millisecondsSince( start );
+        std::vector<int> switchOwner = owner;
+
+        start = std::chrono::steady_clock::now();
+        assignMetric( distance );
+        double time = millisecondsSince( start );
+
+        int different = 0;
+        for( int i = 0; i < WIDTH * HEIGHT; i++ )
+        {
+            if( owner[i] != switchOwner[i] ) different++;
+        }
+
+        std::cout << siteCount << " sites on " << pool->size() << " threads, " << distanceNames[distance]
+                  << ": brute force " << switchTime << " ms" << std::endl;
+        std::cout << "  metric search " << time << " ms, " << different << " pixels different" << std::endl;
+        return different == 0 ? 0 : 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    assignBruteForce();
+    double bruteTime = millisecondsSince( start );
+    std::vector<int> bruteOwner = owner;
+
+    std::cout << siteCount << " sites on " << pool->size() << " threads: brute force " << bruteTime << " ms" << std::endl;
+
+    bool same = true;
+    for( Search s : { SEARCH_GRID, SEARCH_SIMD } )
+    {
+        search = s;
+        start = std::chrono::steady_clock::now();
+        assign();
+        double time = millisecondsSince( start );
+
+        int different = 0;
+        for( int i = 0; i < WIDTH * HEIGHT; i++ )
+        {
+            if( owner[i] != bruteOwner[i] ) different++;
+        }
+        same = same && different == 0;
+
+        std::cout << "  " << searchNames[s] << " " << time << " ms, " << different << " pixels different" << std::endl;
+    }
 
+    return same ? 0 : 1;
+}
+
+// Times each version on 1 thread, 2 threads and so on up to maxThreads
+// (one per core, unless -j says otherwise)
+int scaling( int maxThreads )
+{
+    randomPoints();
+
+    SIMDSearch simd;
+    simd.build( points, WIDTH * WIDTH + HEIGHT * HEIGHT );
+    std::cout << siteCount << " sites, " << std::thread::hardware_concurrency() << " cores, simd uses "
+              << simd.instructionSet() << std::endl;
+    std::cout << "threads      grid ms   speedup      simd ms   speedup" << std::endl;
+
+    double base[2] = { 0, 0 };
+    for( int threads = 1; threads <= maxThreads; threads++ )
+    {
+        ThreadPool threadPool( threads );
+        pool = &threadPool;
+
+        double best[2];
+        for( int s = 0; s < 2; s++ )
+        {
+            search = s == 0 ? SEARCH_GRID : SEARCH_SIMD;
+
+            // Fastest of a few runs, the first one warms things up.
+            // Anything over a second is slow enough to only run once.
+            best[s] = -1;
+            for( int run = 0; run < 3 && best[s] < 1000; run++ )
+            {
+                auto start = std::chrono::steady_clock::now();
+                assign();
+                double time = millisecondsSince( start );
+                if( best[s] < 0 || time < best[s] ) best[s] = time;
+            }
+            if( threads == 1 ) base[s] = best[s];
+        }
+
+        printf( "%7d %12.2f %8.2fx %12.2f %8.2fx\n", threads,
+            best[0], base[0] / best[0], best[1], base[1] / best[1] );
+    }
+
+    pool = NULL;
+    return 0;
+}
+
+// Colours every pixel by its site, then puts the sites on top in white
+void fill()
+{
+    std::vector<Uint32> colours( points.size() );
+    for( size_t i = 0; i < points.size(); i++ )
+    {
+        colours[i] = 0xff000000u | ( points[i].r << 16 ) | ( points[i].g << 8 ) | points[i].b;
+    }
+
+    for( int i = 0; i < WIDTH * HEIGHT; i++ )
+    {
+        framebuffer[i] = colours[owner[i]];
+    }
+
+    for( size_t i = 0; i < points.size(); i++ )
+    {
+        int x = (int)points[i].x;
+        int y = (int)points[i].y;
+        if( x >= 0 && x < WIDTH && y >= 0 && y < HEIGHT )
+            framebuffer[y * WIDTH + x] = 0xffffffffu;
+    }
+}
+
+// Saves the framebuffer as a binary PPM
+bool writePPM( const char* filename )
+{
+    FILE* file = fopen( filename, "wb" );
+    if( !file ) return false;
+
+    fprintf( file, "P6\n%d %d\n255\n", WIDTH, HEIGHT );
+
+    std::vector<Uint8> row( WIDTH * 3 );
+    for( int y = 0; y < HEIGHT; y++ )
+    {
+        for( int x = 0; x < WIDTH; x++ )
+        {
+            Uint32 c = framebuffer[y * WIDTH + x];
+            row[x * 3] = c >> 16;
+            row[x * 3 + 1] = c >> 8;
+            row[x * 3 + 2] = c;
+        }
+        fwrite( row.data(), 1, row.size(), file );
+    }
+
+    bool ok = !ferror( file );
+    return fclose( file ) == 0 && ok;
+}
+
+// Same as draw() but without a window, times finding the cells and filling
+// the framebuffer over a few frames and saves the last one
+int headless( const char* filename )
+{
+    double assignTime = 0, fillTime = 0;
+
+    for( int frame = 0; frame < HEADLESS_FRAMES; frame++ )
+    {
+        randomPoints();
+
+        auto start = std::chrono::steady_clock::now();
+        assign();
+        assignTime += millisecondsSince( start );
+
+        start = std::chrono::steady_clock::now();
+        fill();
+        fillTime += millisecondsSince( start );
+    }
+
+    std::cout << siteCount << " sites, " << HEADLESS_FRAMES << " frames: " << assignTime / HEADLESS_FRAMES
+              << " ms finding cells, " << fillTime / HEADLESS_FRAMES << " ms filling, per frame" << std::endl;
+
+    if( !writePPM( filename ) )
+    {
+        std::cout << "could not write " << filename << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+void draw()
+{
+    randomPoints();
+
+    auto start = std::chrono::steady_clock::now();
+    assign();
+    std::cout << siteCount << " sites in " << millisecondsSince( start ) << " ms using "
+              << searchNames[search] << " on " << pool->size() << " thread" << ( pool->size() == 1 ? "" : "s" ) << std::endl;
+
+    if( useTexture )
+    {
+        // One upload and one copy for the whole frame
+        fill();
+        SDL_UpdateTexture( tex, NULL, framebuffer.data(), WIDTH * sizeof(Uint32) );
+        SDL_RenderCopy( ren, tex, NULL, NULL );
+        SDL_RenderPresent( ren );
+        return;
+    }
+
+    SDL_SetRenderDrawColor( ren, 0, 0, 0, 0 );
+    SDL_RenderClear( ren );
+
+    for( int y = 0; y < HEIGHT; y++ )
+    {
+        for( int x = 0; x < WIDTH; x++ )
+        {
+            const Point& p = points[owner[y * WIDTH + x]];
+            SDL_SetRenderDrawColor( ren, p.r, p.g, p.b, 255 );
+            SDL_RenderDrawPoint( ren, x, y );
         }
     }
 
@@ -136,3 +649,173 @@ void draw()
 
     SDL_RenderPresent( ren );
 }
+
+// Sets up the incremental cells for the sites we have, and gives the first few a direction.
+// They only know plain distance, other metrics do the whole screen every frame.
+void startAnimation()
+{
+    if( distance == DISTANCE_EUCLIDEAN )
+    {
+        incremental.build( points, WIDTH, HEIGHT );
+        incremental.clearDirty();
+    }
+
+    velocities.clear();
+    for( int i = 0; i < std::min( MOVING_SITES, (int)points.size() ); i++ )
+    {
+        velocities.push_back( { rand()/float(RAND_MAX) * 4 - 2, rand()/float(RAND_MAX) * 4 - 2 } );
+    }
+}
+
+// Moves the first few sites on a step, bouncing off the sides of the screen.
+// Returns how many tiles that took.
+int moveSites()
+{
+    int tiles = 0;
+    for( size_t i = 0; i < velocities.size(); i++ )
+    {
+        Point& p = points[i];
+        Velocity& v = velocities[i];
+        p.x += v.x;
+        p.y += v.y;
+        if( p.x < 0 || p.x >= WIDTH )  { v.x = -v.x; p.x = std::min( std::max( p.x, 0.0f ), WIDTH - 1.0f ); }
+        if( p.y < 0 || p.y >= HEIGHT ) { v.y = -v.y; p.y = std::min( std::max( p.y, 0.0f ), HEIGHT - 1.0f ); }
+
+        if( distance == DISTANCE_EUCLIDEAN ) tiles += incremental.move( (int)i, p.x, p.y );
+    }
+    return tiles;
+}
+
+// Like fill() but for one tile, the sites in it are the only ones that can be drawn in it
+void fillTile( int t )
+{
+    const std::vector<int>& owners = incremental.owners();
+    int x0, y0, x1, y1;
+    incremental.tileRect( t, x0, y0, x1, y1 );
+
+    for( int y = y0; y < y1; y++ )
+    {
+        for( int x = x0; x < x1; x++ )
+        {
+            int i = y * WIDTH + x;
+            const Point& p = points[owners[i]];
+            owner[i] = owners[i];
+            framebuffer[i] = 0xff000000u | ( p.r << 16 ) | ( p.g << 8 ) | p.b;
+        }
+    }
+
+    for( int s : incremental.sitesIn( t ) )
+    {
+        int x = (int)points[s].x;
+        int y = (int)points[s].y;
+        if( x >= x0 && x < x1 && y >= y0 && y < y1 )
+            framebuffer[y * WIDTH + x] = 0xffffffffu;
+    }
+}
+
+// One step of the animation, only the tiles that changed are filled again
+void animateFrame()
+{
+    moveSites();
+
+    if( distance == DISTANCE_EUCLIDEAN )
+    {
+        for( int t : incremental.dirtyTiles() )
+            fillTile( t );
+        incremental.clearDirty();
+    }
+    else
+    {
+        assign();
+        fill();
+    }
+
+    SDL_UpdateTexture( tex, NULL, framebuffer.data(), WIDTH * sizeof(Uint32) );
+    SDL_RenderCopy( ren, tex, NULL, NULL );
+    SDL_RenderPresent( ren );
+}
+
+// Times moving a few sites a frame, against doing the whole screen again every
+// frame, then checks the incremental cells against the brute force search
+int incrementalBench()
+{
+    // The incremental cells only know plain distance
+    if( distance != DISTANCE_EUCLIDEAN )
+    {
+        std::cout << "the incremental cells are euclidean only, measuring euclidean distance" << std::endl;
+        distance = DISTANCE_EUCLIDEAN;
+    }
+
+    randomPoints();
+
+    auto start = std::chrono::steady_clock::now();
+    startAnimation();
+    double buildTime = millisecondsSince( start );
+
+    double moveTime = 0, fullTime = 0;
+    long long tiles = 0;
+    for( int frame = 0; frame < INCREMENTAL_FRAMES; frame++ )
+    {
+        start = std::chrono::steady_clock::now();
+        tiles += moveSites();
+        moveTime += millisecondsSince( start );
+        incremental.clearDirty();
+
+        start = std::chrono::steady_clock::now();
+        assign();
+        fullTime += millisecondsSince( start );
+    }
+
+    assignBruteForce();
+    int different = 0;
+    for( int i = 0; i < WIDTH * HEIGHT; i++ )
+    {
+        if( incremental.owners()[i] != owner[i] ) different++;
+    }
+
+    std::cout << siteCount << " sites, moving " << velocities.size() << " a frame for " << INCREMENTAL_FRAMES
+              << " frames, build " << buildTime << " ms" << std::endl;
+    std::cout << "  incremental " << moveTime / INCREMENTAL_FRAMES << " ms and "
+              << (double)tiles / INCREMENTAL_FRAMES << " of " << incremental.tileCount() << " tiles a frame" << std::endl;
+    std::cout << "  " << searchNames[search] << " on " << pool->size() << " thread" << ( pool->size() == 1 ? "" : "s" )
+              << " " << fullTime / INCREMENTAL_FRAMES << " ms a frame" << std::endl;
+    std::cout << "  " << different << " pixels different from brute force" << std::endl;
+
+    return different == 0 ? 0 : 1;
+}
+
+// Times every metric on the same sites, with the metric in the loop and with
+// a switch inside it, and makes sure both agree
+int metrics()
+{
+    randomPoints();
+
+    std::cout << siteCount << " sites on " << pool->size() << " thread" << ( pool->size() == 1 ? "" : "s" ) << std::endl;
+    std::cout << "metric       template ms   switch ms   speedup" << std::endl;
+
+    bool same = true;
+    for( int d = 0; d < DISTANCE_COUNT; d++ )
+    {
+        // Fastest of a few runs, the first one warms things up
+        double best[2] = { -1, -1 };
+        std::vector<int> result[2];
+        for( int version = 0; version < 2; version++ )
+        {
+            for( int run = 0; run < 3 && best[version] < 1000; run++ )
+            {
+                auto start = std::chrono::steady_clock::now();
+                if( version == 0 ) assignMetric( Distance( d ) );
+                else assignMetricSwitch( Distance( d ) );
+                double time = millisecondsSince( start );
+                if( best[version] < 0 || time < best[version] ) best[version] = time;
+            }
+            result[version] = owner;
+        }
+        same = same && result[0] == result[1];
+
+        printf( "%-10s %12.2f %11.2f %8.2fx%s\n", distanceNames[d], best[0], best[1], best[1] / best[0],
+            result[0] == result[1] ? "" : "  different!" );
+    }
+
+    return same ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+// Other ways of measuring "closest".
+//
+// Every metric is a little struct with one static function, how far a pixel
+// is from a site dx, dy away that has a weight w. MetricSearch takes the metric
+// as a template parameter, so each one gets its own copy of the loop with the
+// sum written straight into it, instead of a switch or a function pointer for
+// every pixel and every site.
+//
+// The weight is a radius in pixels, which only the weighted metrics use:
+// - Euclidean: plain distance (squared, it picks the same site)
+// - AdditiveWeighted: distance minus the radius, like circles growing at the
+//   same speed from different sizes. The edges between cells are hyperbolas.
+// - Power: distance squared minus the radius squared. The edges are still
+//   straight lines but they move towards the smaller circle.
+// - Manhattan: dx + dy, how far it is walking along a grid
+// - Chebyshev: the bigger of dx and dy, how far a chess king has to go
+//
+// Ties go to the lowest site index, like the brute force loop in main.cpp.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+struct Euclidean
+{
+    static float distance( float dx, float dy, float ) { return dx * dx + dy * dy; }
+};
+
+struct AdditiveWeighted
+{
+    static float distance( float dx, float dy, float w ) { return std::sqrt( dx * dx + dy * dy ) - w; }
+};
+
+struct Power
+{
+    static float distance( float dx, float dy, float w ) { return dx * dx + dy * dy - w * w; }
+};
+
+struct Manhattan
+{
+    static float distance( float dx, float dy, float ) { return std::fabs( dx ) + std::fabs( dy ); }
+};
+
+struct Chebyshev
+{
+    static float distance( float dx, float dy, float ) { return std::max( std::fabs( dx ), std::fabs( dy ) ); }
+};
+
+// Checks every site, like closestBruteForce() but with any metric
+template<typename Metric>
+class MetricSearch
+{
+public:
+    // points is anything with x, y and weight
+    template<typename P>
+    void build( const std::vector<P>& points )
+    {
+        siteX.resize( points.size() );
+        siteY.resize( points.size() );
+        siteW.resize( points.size() );
+        for( size_t i = 0; i < points.size(); i++ )
+        {
+            siteX[i] = points[i].x;
+            siteY[i] = points[i].y;
+            siteW[i] = points[i].weight;
+        }
+    }
+
+    // Fills owner[0..width) with the closest site to each pixel in row y
+    void row( int y, int width, int* owner ) const
+    {
+        int count = (int)siteX.size();
+        for( int x = 0; x < width; x++ )
+        {
+            float best = INFINITY;
+            int closest = 0;
+
+            for( int i = 0; i < count; i++ )
+            {
+                float d = Metric::distance( siteX[i] - x, siteY[i] - y, siteW[i] );
+                if( d < best )
+                {
+                    best = d;
+                    closest = i;
+                }
+            }
+
+            owner[x] = closest;
+        }
+    }
+
+private:
+    std::vector<float> siteX, siteY, siteW;
+};
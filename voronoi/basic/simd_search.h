@@ -0,0 +1,147 @@
+#pragma once
+
+// Checking every site for the closest one, 8 sites at a time with AVX2.
+//
+// Point keeps x, y and the colour together, so loading the x of 8 sites means
+// gathering from 8 different places. Here the x and y of every site live in
+// their own arrays instead, and one instruction loads 8 of them. The arrays are
+// padded to a multiple of 8 with sites so far away they never win.
+//
+// The distances are the same sums as the brute force loop in main.cpp, and each
+// of the 8 lanes only takes a site that's strictly closer, like the loop does.
+// At the end the lane with the smallest distance wins, the lowest index if
+// there's a tie, so the answer is exactly the same.
+//
+// AVX2 is picked when the search is built if the CPU has it, otherwise it's the
+// same thing one site at a time.
+
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_SEARCH_X86
+#include <immintrin.h>
+#endif
+
+class SIMDSearch
+{
+public:
+    // points is anything with x and y, start is the distance (squared) the
+    // brute force loop starts from, nothing further away than that ever wins
+    template<typename P>
+    void build( const std::vector<P>& points, float start )
+    {
+        count = (int)points.size();
+        startDist = start;
+
+        int padded = ( count + 7 ) / 8 * 8;
+        siteX.assign( padded, 1e15f );
+        siteY.assign( padded, 1e15f );
+        for( int i = 0; i < count; i++ )
+        {
+            siteX[i] = points[i].x;
+            siteY[i] = points[i].y;
+        }
+
+        closestRow = &SIMDSearch::closestRowScalar;
+        name = "scalar";
+#ifdef SIMD_SEARCH_X86
+        __builtin_cpu_init();
+        if( __builtin_cpu_supports( "avx2" ) )
+        {
+            closestRow = &SIMDSearch::closestRowAVX2;
+            name = "avx2";
+        }
+#endif
+    }
+
+    // Fills owner[0..width) with the closest site to each pixel in row y
+    void row( int y, int width, int* owner ) const
+    {
+        (this->*closestRow)( y, width, owner );
+    }
+
+    const char* instructionSet() const { return name; }
+
+private:
+    void closestRowScalar( int y, int width, int* owner ) const
+    {
+        for( int x = 0; x < width; x++ )
+        {
+            float dist_squared = startDist;
+            int closest_point = 0;
+
+            for( int i = 0; i < count; i++ )
+            {
+                float x_dist = siteX[i] - x;
+                float y_dist = siteY[i] - y;
+
+                if( x_dist * x_dist + y_dist * y_dist < dist_squared )
+                {
+                    closest_point = i;
+                    dist_squared = x_dist * x_dist + y_dist * y_dist;
+                }
+            }
+
+            owner[x] = closest_point;
+        }
+    }
+
+#ifdef SIMD_SEARCH_X86
+    __attribute__((target("avx2")))
+    void closestRowAVX2( int y, int width, int* owner ) const
+    {
+        int padded = (int)siteX.size();
+
+        // y_dist * y_dist doesn't change along the row, so work it out once per site
+        std::vector<float> ySquared( padded );
+        __m256 py = _mm256_set1_ps( (float)y );
+        for( int i = 0; i < padded; i += 8 )
+        {
+            __m256 dy = _mm256_sub_ps( _mm256_loadu_ps( &siteY[i] ), py );
+            _mm256_storeu_ps( &ySquared[i], _mm256_mul_ps( dy, dy ) );
+        }
+
+        const __m256i step = _mm256_set1_epi32( 8 );
+
+        for( int x = 0; x < width; x++ )
+        {
+            __m256 px = _mm256_set1_ps( (float)x );
+            __m256 bestDist = _mm256_set1_ps( startDist );
+            __m256i bestIndex = _mm256_setzero_si256();
+            __m256i index = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+
+            for( int i = 0; i < padded; i += 8 )
+            {
+                __m256 dx = _mm256_sub_ps( _mm256_loadu_ps( &siteX[i] ), px );
+                __m256 dist = _mm256_add_ps( _mm256_mul_ps( dx, dx ), _mm256_loadu_ps( &ySquared[i] ) );
+
+                __m256 closer = _mm256_cmp_ps( dist, bestDist, _CMP_LT_OQ );
+                bestDist = _mm256_blendv_ps( bestDist, dist, closer );
+                bestIndex = _mm256_castps_si256( _mm256_blendv_ps(
+                    _mm256_castsi256_ps( bestIndex ), _mm256_castsi256_ps( index ), closer ) );
+
+                index = _mm256_add_epi32( index, step );
+            }
+
+            float dist[8];
+            int indices[8];
+            _mm256_storeu_ps( dist, bestDist );
+            _mm256_storeu_si256( (__m256i*)indices, bestIndex );
+
+            int best = 0;
+            for( int lane = 1; lane < 8; lane++ )
+            {
+                if( dist[lane] < dist[best] || ( dist[lane] == dist[best] && indices[lane] < indices[best] ) )
+                    best = lane;
+            }
+            owner[x] = indices[best];
+        }
+    }
+#endif
+
+    int count = 0;
+    float startDist = 0;
+    std::vector<float> siteX, siteY;
+    void (SIMDSearch::*closestRow)( int, int, int* ) const = &SIMDSearch::closestRowScalar;
+    const char* name = "scalar";
+};
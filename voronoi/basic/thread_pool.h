@@ -0,0 +1,109 @@
+#pragma once
+
+// A handful of threads that stay alive between frames.
+//
+// parallelFor( count, func ) calls func( i ) for every i from 0 to count - 1.
+// The work is handed out from a shared counter, so a thread that finishes its
+// rows early just takes more, and the calling thread works too instead of
+// sitting and waiting.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // threads counts the calling thread, so 1 means no extra threads at all
+    explicit ThreadPool( int threads )
+    {
+        for( int i = 1; i < threads; i++ )
+            workers.emplace_back( &ThreadPool::work, this );
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            quit = true;
+        }
+        wake.notify_all();
+        for( auto& t : workers )
+            t.join();
+    }
+
+    int size() const { return (int)workers.size() + 1; }
+
+    void parallelFor( int count, const std::function<void( int )>& func )
+    {
+        if( workers.empty() )
+        {
+            for( int i = 0; i < count; i++ )
+                func( i );
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            job = &func;
+            jobCount = count;
+            next = 0;
+            busy = (int)workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        run( func, count );
+
+        // Wait for everyone to finish, func has to stay alive until they have
+        std::unique_lock<std::mutex> lock( mutex );
+        finished.wait( lock, [this]() { return busy == 0; } );
+        job = nullptr;
+    }
+
+private:
+    void run( const std::function<void( int )>& func, int count )
+    {
+        for( int i = next++; i < count; i = next++ )
+            func( i );
+    }
+
+    void work()
+    {
+        unsigned int seen = 0;
+        for( ;; )
+        {
+            const std::function<void( int )>* func;
+            int count;
+            {
+                std::unique_lock<std::mutex> lock( mutex );
+                wake.wait( lock, [&]() { return quit || generation != seen; } );
+                if( quit ) return;
+                seen = generation;
+                func = job;
+                count = jobCount;
+            }
+
+            run( *func, count );
+
+            std::lock_guard<std::mutex> lock( mutex );
+            if( --busy == 0 )
+                finished.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+
+    const std::function<void( int )>* job = nullptr;
+    int jobCount = 0;
+    std::atomic<int> next{ 0 };
+    int busy = 0;
+    unsigned int generation = 0;
+    bool quit = false;
+};
@@ -0,0 +1,496 @@
+#pragma once
+
+// The actual Voronoi diagram, built with Fortune's sweep line algorithm.
+//
+// voronoi/basic works out which site is closest to every pixel. That's fine for
+// a picture, but it never finds the shape of a cell. Fortune's algorithm finds
+// the whole diagram in O(n log n):
+//
+// A line sweeps down the plane (y increasing) and stops at every site. Above the
+// line, everything closer to a site than to the line is already settled, and the
+// edge of that region is the "beach line", a row of parabola arcs, one per site
+// (a site can have several arcs). The breakpoints between arcs trace out the
+// Voronoi edges as the line moves.
+//
+// Two things change the beach line:
+// - site events: the line reaches a new site, which splits the arc above it in two
+//   with a new arc in the middle
+// - circle events: an arc shrinks to nothing between its neighbours. That happens
+//   where the line touches the bottom of the circle through the three sites,
+//   and the centre of that circle is a Voronoi vertex.
+//
+// The beach line is kept in a balanced binary tree (a treap, balanced by random
+// priorities) so finding the arc above a new site is O(log n), and the arcs are
+// also linked left to right so their neighbours are O(1). Circle events go in a
+// priority queue. When an arc changes, its event is thrown away by bumping the
+// arc's stamp rather than digging it out of the queue.
+//
+// What comes out:
+// - the Voronoi vertices, and the three sites around each, which are exactly the
+//   Delaunay triangles (each vertex is its triangle's circumcentre)
+// - the Delaunay edges, every pair of sites whose cells share an edge
+// - every cell as a convex polygon, clipped to a box. A cell is the box cut down
+//   by the bisector with each of its Delaunay neighbours, which is simple and
+//   doesn't need any special cases for cells that run off to infinity.
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <vector>
+
+namespace fortune
+{
+    struct Vec2
+    {
+        double x, y;
+    };
+
+    struct Diagram
+    {
+        std::vector<Vec2> sites;
+
+        // Voronoi vertices, vertex i is the circumcentre of Delaunay triangle i
+        std::vector<Vec2> vertices;
+        std::vector<int> triangles;     // 3 sites per vertex
+
+        // Delaunay edges, 2 sites each
+        std::vector<int> edges;
+
+        // -1, or the site this one sits exactly on top of (it gets no cell)
+        std::vector<int> duplicateOf;
+
+        // Cell polygons, site i's corners are cellPoints[cellStart[i]] up to cellStart[i + 1]
+        std::vector<int> cellStart;
+        std::vector<Vec2> cellPoints;
+    };
+
+    // Where the parabolas for left site p and right site q cross, with the sweep line at l
+    inline double breakpoint( const Vec2& p, const Vec2& q, double l )
+    {
+        if( p.y == q.y ) return ( p.x + q.x ) / 2;
+        if( p.y == l ) return p.x;
+        if( q.y == l ) return q.x;
+
+        // Solve a x^2 + b x + c = 0 for the root where p's arc is on the left
+        double dp = 2 * ( p.y - l );
+        double dq = 2 * ( q.y - l );
+        double a = dq - dp;
+        double b = 2 * ( q.x * dp - p.x * dq );
+        double c = ( p.x * p.x + p.y * p.y - l * l ) * dq - ( q.x * q.x + q.y * q.y - l * l ) * dp;
+        double s = std::sqrt( std::max( 0.0, b * b - 4 * a * c ) );
+
+        // (-b - s) / 2a, written whichever way doesn't cancel out
+        return b < 0 ? 2 * c / ( -b + s ) : ( -b - s ) / ( 2 * a );
+    }
+
+    class Sweep
+    {
+    public:
+        Sweep( Diagram& diagram ) : d( diagram ), sites( diagram.sites ) {}
+
+        void run()
+        {
+            int n = (int)sites.size();
+            d.duplicateOf.assign( n, -1 );
+            arcs.reserve( 2 * n + 1 );
+
+            std::vector<int> order( n );
+            for( int i = 0; i < n; i++ ) order[i] = i;
+            std::sort( order.begin(), order.end(), [&]( int a, int b )
+            {
+                return sites[a].y < sites[b].y || ( sites[a].y == sites[b].y && sites[a].x < sites[b].x );
+            });
+
+            size_t next = 0;
+            int last = -1;
+            while( next < order.size() || !events.empty() )
+            {
+                bool circleFirst = !events.empty() && ( next == order.size() || events.top().y < sites[order[next]].y
+                    || ( events.top().y == sites[order[next]].y && events.top().x < sites[order[next]].x ) );
+
+                if( circleFirst )
+                {
+                    Event e = events.top();
+                    events.pop();
+                    if( e.stamp == arcs[e.arc].stamp )
+                        circleEvent( e );
+                }
+                else
+                {
+                    int s = order[next++];
+                    if( last >= 0 && sites[s].x == sites[last].x && sites[s].y == sites[last].y )
+                    {
+                        d.duplicateOf[s] = d.duplicateOf[last] >= 0 ? d.duplicateOf[last] : last;
+                        continue;
+                    }
+                    siteEvent( s );
+                    last = s;
+                }
+            }
+        }
+
+    private:
+        struct Arc
+        {
+            int site;
+            int parent = -1, left = -1, right = -1;    // in the tree
+            int prev = -1, next = -1;                  // along the beach line
+            unsigned int priority;
+            unsigned int stamp = 0;    // changes whenever its circle event stops being true
+        };
+
+        struct Event
+        {
+            double y, x;
+            Vec2 centre;
+            int arc;
+            unsigned int stamp;
+        };
+
+        struct Later
+        {
+            bool operator()( const Event& a, const Event& b ) const
+            {
+                return a.y > b.y || ( a.y == b.y && a.x > b.x );
+            }
+        };
+
+        int newArc( int site )
+        {
+            // xorshift, the same tree every run
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+
+            Arc arc;
+            arc.site = site;
+            arc.priority = seed;
+            arcs.push_back( arc );
+            return (int)arcs.size() - 1;
+        }
+
+        const Vec2& siteOf( int arc ) const { return sites[arcs[arc].site]; }
+
+        // Moves x up above its parent, keeping the left to right order
+        void rotateUp( int x )
+        {
+            int p = arcs[x].parent;
+            int g = arcs[p].parent;
+
+            if( arcs[p].left == x )
+            {
+                arcs[p].left = arcs[x].right;
+                if( arcs[x].right >= 0 ) arcs[arcs[x].right].parent = p;
+                arcs[x].right = p;
+            }
+            else
+            {
+                arcs[p].right = arcs[x].left;
+                if( arcs[x].left >= 0 ) arcs[arcs[x].left].parent = p;
+                arcs[x].left = p;
+            }
+
+            arcs[p].parent = x;
+            arcs[x].parent = g;
+            if( g < 0 ) root = x;
+            else if( arcs[g].left == p ) arcs[g].left = x;
+            else arcs[g].right = x;
+        }
+
+        // Puts arc x just to the right of arc at
+        void insertAfter( int at, int x )
+        {
+            if( arcs[at].right < 0 )
+            {
+                arcs[at].right = x;
+                arcs[x].parent = at;
+            }
+            else
+            {
+                int s = arcs[at].right;
+                while( arcs[s].left >= 0 ) s = arcs[s].left;
+                arcs[s].left = x;
+                arcs[x].parent = s;
+            }
+
+            while( arcs[x].parent >= 0 && arcs[x].priority < arcs[arcs[x].parent].priority )
+                rotateUp( x );
+
+            arcs[x].prev = at;
+            arcs[x].next = arcs[at].next;
+            if( arcs[at].next >= 0 ) arcs[arcs[at].next].prev = x;
+            arcs[at].next = x;
+        }
+
+        void remove( int x )
+        {
+            // Rotate it down until it has at most one child, then splice it out
+            while( arcs[x].left >= 0 && arcs[x].right >= 0 )
+            {
+                int l = arcs[x].left, r = arcs[x].right;
+                rotateUp( arcs[l].priority < arcs[r].priority ? l : r );
+            }
+
+            int child = arcs[x].left >= 0 ? arcs[x].left : arcs[x].right;
+            int p = arcs[x].parent;
+            if( child >= 0 ) arcs[child].parent = p;
+            if( p < 0 ) root = child;
+            else if( arcs[p].left == x ) arcs[p].left = child;
+            else arcs[p].right = child;
+
+            if( arcs[x].prev >= 0 ) arcs[arcs[x].prev].next = arcs[x].next;
+            if( arcs[x].next >= 0 ) arcs[arcs[x].next].prev = arcs[x].prev;
+            arcs[x].stamp++;
+        }
+
+        // The arc directly above x, with the sweep line at l
+        int findArc( double x, double l ) const
+        {
+            int n = root;
+            for( ;; )
+            {
+                const Arc& a = arcs[n];
+                if( a.prev >= 0 && a.left >= 0 && x < breakpoint( siteOf( a.prev ), sites[a.site], l ) )
+                    n = a.left;
+                else if( a.next >= 0 && a.right >= 0 && x > breakpoint( sites[a.site], siteOf( a.next ), l ) )
+                    n = a.right;
+                else
+                    return n;
+            }
+        }
+
+        void addEdge( int a, int b )
+        {
+            d.edges.push_back( a );
+            d.edges.push_back( b );
+        }
+
+        void siteEvent( int s )
+        {
+            if( root < 0 )
+            {
+                root = newArc( s );
+                return;
+            }
+
+            double l = sites[s].y;
+            int above = findArc( sites[s].x, l );
+
+            // Sites on the very first row all have flat "arcs" on the sweep line,
+            // so there's nothing to split, the new one just goes on the end
+            if( siteOf( above ).y == l )
+            {
+                int arc = newArc( s );
+                insertAfter( above, arc );
+                addEdge( arcs[above].site, s );
+                return;
+            }
+
+            // above, new, copy of above
+            arcs[above].stamp++;
+            int arc = newArc( s );
+            insertAfter( above, arc );
+            int copy = newArc( arcs[above].site );
+            insertAfter( arc, copy );
+
+            addEdge( arcs[above].site, s );
+
+            checkCircle( above );
+            checkCircle( copy );
+        }
+
+        void circleEvent( const Event& e )
+        {
+            int b = e.arc;
+            int a = arcs[b].prev;
+            int c = arcs[b].next;
+
+            d.vertices.push_back( e.centre );
+            d.triangles.push_back( arcs[a].site );
+            d.triangles.push_back( arcs[b].site );
+            d.triangles.push_back( arcs[c].site );
+
+            remove( b );
+            arcs[a].stamp++;
+            arcs[c].stamp++;
+
+            addEdge( arcs[a].site, arcs[c].site );
+
+            checkCircle( a );
+            checkCircle( c );
+        }
+
+        // Queues the event for arc b disappearing, if its breakpoints are heading towards each other
+        void checkCircle( int b )
+        {
+            int a = arcs[b].prev;
+            int c = arcs[b].next;
+            if( a < 0 || c < 0 || arcs[a].site == arcs[c].site ) return;
+
+            const Vec2& A = siteOf( a );
+            const Vec2& B = siteOf( b );
+            const Vec2& C = siteOf( c );
+
+            // They only meet if a, b, c turn the right way, with y pointing down
+            double bx = B.x - A.x, by = B.y - A.y;
+            double cx = C.x - A.x, cy = C.y - A.y;
+            double cross = bx * cy - by * cx;
+            if( cross <= 0 ) return;
+
+            // Circumcentre, relative to A
+            double b2 = bx * bx + by * by;
+            double c2 = cx * cx + cy * cy;
+            double ux = ( cy * b2 - by * c2 ) / ( 2 * cross );
+            double uy = ( bx * c2 - cx * b2 ) / ( 2 * cross );
+
+            Event e;
+            e.centre = { A.x + ux, A.y + uy };
+            e.y = e.centre.y + std::sqrt( ux * ux + uy * uy );
+            e.x = e.centre.x;
+            e.arc = b;
+            e.stamp = arcs[b].stamp;
+            events.push( e );
+        }
+
+        Diagram& d;
+        const std::vector<Vec2>& sites;
+        std::vector<Arc> arcs;
+        int root = -1;
+        unsigned int seed = 2463534242u;
+        std::priority_queue<Event, std::vector<Event>, Later> events;
+    };
+
+    // Cuts a convex polygon down to the side of the line a.x * x + a.y * y <= limit
+    inline void clip( std::vector<Vec2>& poly, Vec2 a, double limit, std::vector<Vec2>& scratch )
+    {
+        scratch.clear();
+        for( size_t i = 0; i < poly.size(); i++ )
+        {
+            const Vec2& p = poly[i];
+            const Vec2& q = poly[( i + 1 ) % poly.size()];
+            double dp = a.x * p.x + a.y * p.y - limit;
+            double dq = a.x * q.x + a.y * q.y - limit;
+
+            if( dp <= 0 ) scratch.push_back( p );
+            if( ( dp < 0 && dq > 0 ) || ( dp > 0 && dq < 0 ) )
+            {
+                double t = dp / ( dp - dq );
+                scratch.push_back( { p.x + ( q.x - p.x ) * t, p.y + ( q.y - p.y ) * t } );
+            }
+        }
+        poly.swap( scratch );
+    }
+
+    // Every cell as a polygon inside the box, from the Delaunay edges
+    inline void buildCells( Diagram& d, double minX, double minY, double maxX, double maxY )
+    {
+        int n = (int)d.sites.size();
+
+        // Neighbours of each site, from the edges
+        std::vector<int> start( n + 1, 0 );
+        for( int e : d.edges ) start[e + 1]++;
+        for( int i = 0; i < n; i++ ) start[i + 1] += start[i];
+        std::vector<int> neighbours( d.edges.size() );
+        std::vector<int> fill( start.begin(), start.end() - 1 );
+        for( size_t i = 0; i < d.edges.size(); i += 2 )
+        {
+            neighbours[fill[d.edges[i]]++] = d.edges[i + 1];
+            neighbours[fill[d.edges[i + 1]]++] = d.edges[i];
+        }
+
+        d.cellStart.assign( 1, 0 );
+        d.cellStart.reserve( n + 1 );
+        d.cellPoints.clear();
+        d.cellPoints.reserve( (size_t)n * 6 );
+
+        std::vector<Vec2> poly, scratch;
+        for( int i = 0; i < n; i++ )
+        {
+            if( d.duplicateOf[i] < 0 )
+            {
+                poly.assign( { { minX, minY }, { maxX, minY }, { maxX, maxY }, { minX, maxY } } );
+
+                // Keep the side of each bisector that's closer to this site:
+                // (q - s) . p <= (|q|^2 - |s|^2) / 2
+                const Vec2& s = d.sites[i];
+                for( int k = start[i]; k < start[i + 1] && !poly.empty(); k++ )
+                {
+                    const Vec2& q = d.sites[neighbours[k]];
+                    clip( poly, { q.x - s.x, q.y - s.y }, ( q.x * q.x + q.y * q.y - s.x * s.x - s.y * s.y ) / 2, scratch );
+                }
+
+                d.cellPoints.insert( d.cellPoints.end(), poly.begin(), poly.end() );
+            }
+            d.cellStart.push_back( (int)d.cellPoints.size() );
+        }
+    }
+
+    // Builds the whole diagram for these sites, with cells clipped to the box
+    inline Diagram build( const std::vector<Vec2>& sites, double minX, double minY, double maxX, double maxY )
+    {
+        Diagram d;
+        d.sites = sites;
+        Sweep( d ).run();
+        buildCells( d, minX, minY, maxX, maxY );
+        return d;
+    }
+
+    // How far off the pixel grid rasterise() samples, see below. Different
+    // amounts across and down, or the sample would still sit on diagonal edges.
+    const double RASTER_NUDGE_X = 1e-6;
+    const double RASTER_NUDGE_Y = 0.618e-6;
+
+    // Fills owner[y * width + x] with the site whose cell covers pixel (x, y), a
+    // polygon at a time. Each row of a cell is a single run of pixels, from the
+    // first pixel at or right of its left edge up to (not including) the first at
+    // or right of its right edge, so neighbouring cells never both take a pixel.
+    //
+    // Neighbouring cells work out their shared edge separately, so it can come out
+    // a hair different in each. If it landed exactly on a pixel (sites on whole
+    // numbers do that a lot) both cells could skip that pixel. So each pixel is
+    // sampled a tiny bit down and right of where it is, well clear of rounding.
+    inline void rasterise( const Diagram& d, int width, int height, int* owner )
+    {
+        int n = (int)d.sites.size();
+        for( int i = 0; i < n; i++ )
+        {
+            const Vec2* poly = &d.cellPoints[d.cellStart[i]];
+            int count = d.cellStart[i + 1] - d.cellStart[i];
+            if( count < 3 ) continue;
+
+            double top = poly[0].y, bottom = poly[0].y;
+            for( int k = 1; k < count; k++ )
+            {
+                top = std::min( top, poly[k].y );
+                bottom = std::max( bottom, poly[k].y );
+            }
+
+            int y0 = std::max( 0, (int)std::ceil( top - RASTER_NUDGE_Y ) );
+            int y1 = std::min( height, (int)std::ceil( bottom - RASTER_NUDGE_Y ) );
+            for( int y = y0; y < y1; y++ )
+            {
+                double sy = y + RASTER_NUDGE_Y;
+
+                // A convex polygon crosses each row twice
+                double left = INFINITY, right = -INFINITY;
+                for( int k = 0; k < count; k++ )
+                {
+                    const Vec2& p = poly[k];
+                    const Vec2& q = poly[( k + 1 ) % count];
+                    if( ( p.y <= sy && sy < q.y ) || ( q.y <= sy && sy < p.y ) )
+                    {
+                        double x = p.x + ( q.x - p.x ) * ( sy - p.y ) / ( q.y - p.y );
+                        left = std::min( left, x );
+                        right = std::max( right, x );
+                    }
+                }
+                if( left > right ) continue;
+
+                int x0 = std::max( 0, (int)std::ceil( left - RASTER_NUDGE_X ) );
+                int x1 = std::min( width, (int)std::ceil( right - RASTER_NUDGE_X ) );
+                for( int x = x0; x < x1; x++ )
+                    owner[y * width + x] = i;
+            }
+        }
+    }
+}
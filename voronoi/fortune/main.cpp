@@ -0,0 +1,307 @@
+#include <SDL2/SDL.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "fortune.h"
+#include "../basic/grid.h"
+
+SDL_Window* win = NULL;
+SDL_Renderer* ren = NULL;
+SDL_Texture* tex = NULL;
+const int WIDTH = 800;
+const int HEIGHT = 600;
+bool redraw = true;
+
+// How many sites to scatter, can be changed on the command line
+int siteCount = 1000;
+
+// Draw the Delaunay triangulation over the cells (press D)
+bool showDelaunay = true;
+
+std::vector<fortune::Vec2> sites;
+std::vector<Uint32> colours;
+fortune::Diagram diagram;
+
+// Which site each pixel belongs to, and the picture made from it
+std::vector<int> owner( WIDTH * HEIGHT );
+std::vector<Uint32> framebuffer( WIDTH * HEIGHT );
+
+void init();
+void draw();
+void randomSites();
+void build( bool report );
+void fill();
+bool writePPM( const char* filename );
+int headless( const char* filename );
+int bench();
+int check();
+
+int main( int argc, char* argv[] )
+{
+    const char* headlessFile = NULL;
+    bool benchOnly = false;
+    bool checkOnly = false;
+    for( int i = 1; i < argc; i++ )
+    {
+        if( strcmp( argv[i], "-bench" ) == 0 ) benchOnly = true;
+        else if( strcmp( argv[i], "-check" ) == 0 ) checkOnly = true;
+        else if( strcmp( argv[i], "-headless" ) == 0 )
+        {
+            // Saves to fortune.ppm unless a .ppm name comes next
+            headlessFile = "fortune.ppm";
+            if( i + 1 < argc && strstr( argv[i + 1], ".ppm" ) ) headlessFile = argv[++i];
+        }
+        else siteCount = std::max( 1, atoi( argv[i] ) );
+    }
+
+    if( benchOnly )
+        return bench();
+
+    if( checkOnly )
+        return check();
+
+    if( headlessFile )
+        return headless( headlessFile );
+
+    init();
+
+    SDL_Event event;
+    bool done = false;
+    while( !done )
+    {
+        while( SDL_PollEvent( &event ) )
+        {
+            if( event.type == SDL_QUIT ) done = true;
+            if( event.type == SDL_KEYDOWN )
+            {
+                if( event.key.keysym.scancode == SDL_SCANCODE_ESCAPE )
+                {
+                    done = true;
+                }
+                else if( event.key.keysym.scancode == SDL_SCANCODE_D )
+                {
+                    showDelaunay = !showDelaunay;
+                    fill();
+                    draw();
+                }
+                else
+                {
+                    redraw = true;
+                }
+            }
+        }
+
+        if( redraw )
+        {
+            randomSites();
+            build( true );
+            fill();
+            draw();
+            redraw = false;
+        }
+    }
+
+    SDL_DestroyTexture( tex );
+    SDL_Quit();
+    return 0;
+}
+
+void init()
+{
+    SDL_Init( SDL_INIT_EVERYTHING );
+    win = SDL_CreateWindow( "Voronoi Fortune", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT, SDL_WINDOW_SHOWN );
+    ren = SDL_CreateRenderer( win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+    tex = SDL_CreateTexture( ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT );
+}
+
+// Same as voronoi/basic, positions are floats so the grid there sees the exact same sites
+void randomSites()
+{
+    sites.clear();
+    colours.clear();
+
+    for( int i = 0; i < siteCount; i++ )
+    {
+        float x = ( rand()/float(RAND_MAX) ) * WIDTH;
+        float y = ( rand()/float(RAND_MAX) ) * HEIGHT;
+        sites.push_back( { x, y } );
+        colours.push_back( 0xff000000u | ( ( rand() % 256 ) << 16 ) | ( ( rand() % 256 ) << 8 ) | ( rand() % 256 ) );
+    }
+}
+
+double millisecondsSince( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Sweep, cells and raster, timing each
+void build( bool report )
+{
+    auto start = std::chrono::steady_clock::now();
+
+    diagram = fortune::Diagram();
+    diagram.sites = sites;
+    fortune::Sweep( diagram ).run();
+    double sweepTime = millisecondsSince( start );
+
+    start = std::chrono::steady_clock::now();
+    fortune::buildCells( diagram, 0, 0, WIDTH, HEIGHT );
+    double cellTime = millisecondsSince( start );
+
+    start = std::chrono::steady_clock::now();
+    fortune::rasterise( diagram, WIDTH, HEIGHT, owner.data() );
+    double rasterTime = millisecondsSince( start );
+
+    if( report )
+    {
+        std::cout << sites.size() << " sites: sweep " << sweepTime << " ms, cells " << cellTime
+                  << " ms, raster " << rasterTime << " ms, " << diagram.vertices.size() << " vertices, "
+                  << diagram.edges.size() / 2 << " Delaunay edges" << std::endl;
+    }
+}
+
+void drawLine( double x0, double y0, double x1, double y1, Uint32 colour )
+{
+    int steps = (int)std::max( std::fabs( x1 - x0 ), std::fabs( y1 - y0 ) ) + 1;
+    for( int i = 0; i <= steps; i++ )
+    {
+        int x = (int)( x0 + ( x1 - x0 ) * i / steps );
+        int y = (int)( y0 + ( y1 - y0 ) * i / steps );
+        if( x >= 0 && x < WIDTH && y >= 0 && y < HEIGHT )
+            framebuffer[y * WIDTH + x] = colour;
+    }
+}
+
+// Cells in their colours, the Delaunay edges in black and the sites in white
+void fill()
+{
+    for( int i = 0; i < WIDTH * HEIGHT; i++ )
+    {
+        framebuffer[i] = colours[owner[i]];
+    }
+
+    if( showDelaunay )
+    {
+        for( size_t i = 0; i < diagram.edges.size(); i += 2 )
+        {
+            const fortune::Vec2& a = sites[diagram.edges[i]];
+            const fortune::Vec2& b = sites[diagram.edges[i + 1]];
+            drawLine( a.x, a.y, b.x, b.y, 0xff000000u );
+        }
+    }
+
+    for( const fortune::Vec2& s : sites )
+    {
+        drawLine( s.x, s.y, s.x, s.y, 0xffffffffu );
+    }
+}
+
+void draw()
+{
+    SDL_UpdateTexture( tex, NULL, framebuffer.data(), WIDTH * sizeof(Uint32) );
+    SDL_RenderCopy( ren, tex, NULL, NULL );
+    SDL_RenderPresent( ren );
+}
+
+// Saves the framebuffer as a binary PPM
+bool writePPM( const char* filename )
+{
+    FILE* file = fopen( filename, "wb" );
+    if( !file ) return false;
+
+    fprintf( file, "P6\n%d %d\n255\n", WIDTH, HEIGHT );
+
+    std::vector<Uint8> row( WIDTH * 3 );
+    for( int y = 0; y < HEIGHT; y++ )
+    {
+        for( int x = 0; x < WIDTH; x++ )
+        {
+            Uint32 c = framebuffer[y * WIDTH + x];
+            row[x * 3] = c >> 16;
+            row[x * 3 + 1] = c >> 8;
+            row[x * 3 + 2] = c;
+        }
+        fwrite( row.data(), 1, row.size(), file );
+    }
+
+    bool ok = !ferror( file );
+    return fclose( file ) == 0 && ok;
+}
+
+// One diagram without a window, saved as an image
+int headless( const char* filename )
+{
+    randomSites();
+    build( true );
+    fill();
+
+    if( !writePPM( filename ) )
+    {
+        std::cout << "could not write " << filename << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Times the sweep on bigger and bigger sets of sites, up to a million
+int bench()
+{
+    for( int count = 1000; count <= 1000000; count *= 10 )
+    {
+        siteCount = count;
+        randomSites();
+        build( true );
+    }
+    return 0;
+}
+
+struct GridPoint
+{
+    float x, y;
+};
+
+// The raster should match the closest site to every pixel, checked with the
+// exact grid search from voronoi/basic. Pixels can only disagree where they sit
+// right on the edge between two cells, within the raster's nudge of it.
+int check()
+{
+    randomSites();
+    build( true );
+
+    std::vector<GridPoint> points;
+    for( const fortune::Vec2& s : sites )
+        points.push_back( { (float)s.x, (float)s.y } );
+
+    SiteGrid grid;
+    grid.build( points, WIDTH, HEIGHT );
+
+    int different = 0, tied = 0;
+    for( int y = 0; y < HEIGHT; y++ )
+    {
+        for( int x = 0; x < WIDTH; x++ )
+        {
+            int a = owner[y * WIDTH + x];
+            int b = grid.closest( x, y );
+            if( a == b || diagram.duplicateOf[b] == a ) continue;
+
+            // rasterise() samples a hair off the pixel, so measure from the same
+            // place. If a is no further away than b there (to within rounding), the
+            // pixel is on the edge between them and the grid search broke the tie.
+            double sx = x + fortune::RASTER_NUDGE_X, sy = y + fortune::RASTER_NUDGE_Y;
+            double da = ( sites[a].x - sx ) * ( sites[a].x - sx ) + ( sites[a].y - sy ) * ( sites[a].y - sy );
+            double db = ( sites[b].x - sx ) * ( sites[b].x - sx ) + ( sites[b].y - sy ) * ( sites[b].y - sy );
+            if( da - db <= 1e-9 * std::max( 1.0, db ) )
+                tied++;
+            else
+                different++;
+        }
+    }
+
+    std::cout << different << " pixels in the wrong cell, " << tied << " on a boundary" << std::endl;
+    return different == 0 ? 0 : 1;
+}